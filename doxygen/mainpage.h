@@ -3,6 +3,13 @@
  * Welcome to the documentation for the TinyALSA project.
  * <br><br>
  * To start, you may either view the @ref libtinyalsa-pcm or @ref libtinyalsa-mixer.
+ * To wait on many PCMs and mixers at once, see the @ref libtinyalsa-waitset.
+ * For callback driven streaming on a real-time thread, see the @ref libtinyalsa-engine.
+ * To hand frames to or from a real-time thread without locks, see the @ref libtinyalsa-ring.
+ * To measure the clock drift of a sound card, see the @ref libtinyalsa-drift.
+ * To bridge two sound cards that run from different clocks, see the @ref libtinyalsa-asrc.
+ * To convert samples between formats, see the @ref libtinyalsa-convert.
+ * To reorder or (de)interleave channels, see the @ref libtinyalsa-route.
  * <br><br>
  * If you find an error in the documentation or an area for improvement,
  * open an issue or send a pull request to the <a href="https://github.com/tinyalsa/tinyalsa">github page</a>.
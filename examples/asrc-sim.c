@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <tinyalsa/asrc.h>
+
+/* Runs a sample rate converter between two synthetic clocks: the input
+ * is produced at its nominal rate plus a known drift, the output is
+ * consumed at its nominal rate. The correction of the converter should
+ * settle at the injected drift, with the fill level at the target. */
+
+int main(int argc, char **argv)
+{
+    double ppm = 100.0;
+    unsigned int seconds = 120;
+    unsigned int period = 256;
+    struct pcm_asrc_config config = {
+        .channels = 2,
+        .format = PCM_FORMAT_S16_LE,
+        .in_rate = 48000,
+        .out_rate = 48000,
+        .taps = 32,
+        .max_frames = 1024,
+        .target = 1024,
+    };
+    struct pcm_asrc *asrc;
+    int16_t *in, *out;
+    double dt, due_in = 0.0, due_out = 0.0, phase = 0.0, elapsed = 0.0;
+    double max_error = 0.0;
+    long fill;
+    unsigned int frames, written, produced, n, ch, next_report = 1;
+
+    while (--argc > 0) {
+        argv++;
+        if (strcmp(*argv, "-p") == 0 && argc > 1) {
+            ppm = atof(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-t") == 0 && argc > 1) {
+            seconds = atoi(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-r") == 0 && argc > 1) {
+            config.in_rate = atoi(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-R") == 0 && argc > 1) {
+            config.out_rate = atoi(*++argv);
+            argc--;
+        } else {
+            fprintf(stderr, "usage: asrc-sim [-p ppm] [-t seconds] [-r in_rate] [-R out_rate]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    asrc = pcm_asrc_open(&config);
+    if (asrc == NULL) {
+        fprintf(stderr, "failed to open the converter\n");
+        return EXIT_FAILURE;
+    }
+
+    in = calloc(config.max_frames * 2, sizeof(*in) * config.channels);
+    out = calloc(config.max_frames * 4, sizeof(*out) * config.channels);
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "failed to allocate buffers\n");
+        return EXIT_FAILURE;
+    }
+
+    fill = config.target;
+    dt = (double)period / config.out_rate;
+
+    while (elapsed < seconds) {
+        /* the input clock runs fast or slow by the injected drift */
+        due_in += config.in_rate * (1.0 + ppm * 1e-6) * dt;
+        frames = (unsigned int)due_in;
+        due_in -= frames;
+        for (n = 0; n < frames; n++) {
+            for (ch = 0; ch < config.channels; ch++)
+                in[n * config.channels + ch] = (int16_t)(16384.0 * sin(phase));
+            phase += 2.0 * M_PI * 1000.0 / config.in_rate;
+        }
+
+        for (written = 0; written < frames; ) {
+            written += pcm_asrc_write(asrc, in + written * config.channels, frames - written);
+            while ((produced = pcm_asrc_read(asrc, out, config.max_frames * 4)) > 0)
+                fill += produced;
+        }
+
+        /* the output clock is the reference */
+        due_out += config.out_rate * dt;
+        frames = (unsigned int)due_out;
+        due_out -= frames;
+        fill -= frames;
+
+        pcm_asrc_update(asrc, fill, dt);
+        elapsed += dt;
+
+        if (elapsed > seconds / 2 && fabs(fill - (double)config.target) > max_error)
+            max_error = fabs(fill - (double)config.target);
+
+        if (elapsed >= next_report) {
+            printf("%4u s: fill %6ld (target %u), correction %8.2f ppm\n",
+                   next_report, fill, config.target, pcm_asrc_get_ppm(asrc));
+            next_report++;
+        }
+    }
+
+    printf("injected %.2f ppm, settled at %.2f ppm, "
+           "largest fill error over the second half %.0f frames\n",
+           ppm, pcm_asrc_get_ppm(asrc), max_error);
+
+    free(in);
+    free(out);
+    pcm_asrc_close(asrc);
+    return EXIT_SUCCESS;
+}
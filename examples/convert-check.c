@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <tinyalsa/convert.h>
+
+/* Checks that the vector conversion kernels give the same results, to the
+ * bit, as the scalar ones. Every instruction set that the build and the
+ * CPU support is run on the same input as the scalar code, with lengths
+ * that leave a tail, buffers that are not aligned, and inputs that are
+ * special values, full scale, rounding ties and random bit patterns. */
+
+#define MAX_SAMPLES 4099
+#define MAX_BYTES (MAX_SAMPLES * 8 + 16)
+
+static const struct {
+    enum pcm_format format;
+    const char *name;
+} formats[] = {
+    { PCM_FORMAT_S16_LE, "S16_LE" },
+    { PCM_FORMAT_S24_LE, "S24_LE" },
+    { PCM_FORMAT_S32_LE, "S32_LE" },
+    { PCM_FORMAT_S8, "S8" },
+    { PCM_FORMAT_U8, "U8" },
+    { PCM_FORMAT_S16_BE, "S16_BE" },
+    { PCM_FORMAT_S24_3LE, "S24_3LE" },
+    { PCM_FORMAT_U32_LE, "U32_LE" },
+};
+
+static const struct {
+    enum pcm_convert_isa isa;
+    const char *name;
+} isas[] = {
+    { PCM_CONVERT_ISA_SSE2, "sse2" },
+    { PCM_CONVERT_ISA_AVX2, "avx2" },
+    { PCM_CONVERT_ISA_NEON, "neon" },
+};
+
+static const unsigned int lengths[] = {
+    0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 65, 1001, MAX_SAMPLES,
+};
+
+static uint32_t seed = 1;
+
+/* A small xorshift generator, so that every run sees the same input */
+static uint32_t random_bits(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/* Fills float input that starts with the values at the edges of the
+ * range, followed by rounding ties and random bit patterns. NaN converts
+ * to an unspecified value, so it is left out. */
+static void fill_float(float *in, unsigned int samples, unsigned int bits)
+{
+    static const float specials[] = {
+        INFINITY, -INFINITY, 1.0f, -1.0f, 0.0f, -0.0f, 0.5f, -0.5f,
+        0.99999994f, -0.99999994f, 1.0000001f, -1.0000001f, 2.0f, -2.0f,
+        1e-30f, -1e-30f, 3e38f, -3e38f,
+    };
+    float scale = ldexpf(1.0f, -(int)(bits - 1));
+    unsigned int n;
+    uint32_t value;
+
+    for (n = 0; n < samples; n++) {
+        if (n < sizeof(specials) / sizeof(specials[0])) {
+            in[n] = specials[n];
+        } else if (n % 3 == 0) {
+            /* exactly halfway between two output codes */
+            in[n] = ((float)((int32_t)random_bits() >> (33 - bits)) + 0.5f) * scale;
+        } else {
+            do {
+                value = random_bits();
+                memcpy(&in[n], &value, sizeof(value));
+            } while (isnan(in[n]));
+        }
+    }
+}
+
+static int check(const char *name, enum pcm_convert_isa isa, unsigned int index)
+{
+    enum pcm_format format = formats[index].format;
+    static uint8_t in[MAX_BYTES], expected[MAX_BYTES], out[MAX_BYTES];
+    static float floats[MAX_SAMPLES + 4];
+    unsigned int bits = pcm_format_to_bits(format), bytes = bits / 8;
+    unsigned int l, align, n, samples;
+    float *src;
+    int failures = 0;
+
+    for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        for (align = 0; align < 4; align++) {
+            samples = lengths[l];
+
+            /* integer samples to float, from any bit pattern */
+            for (n = 0; n < samples * bytes + align; n++)
+                in[n] = random_bits();
+            pcm_convert_set_isa(PCM_CONVERT_ISA_SCALAR);
+            memset(expected, 0x55, sizeof(expected));
+            pcm_convert_to_float((float *)(void *)(expected + align), in + align, format, samples);
+            pcm_convert_set_isa(isa);
+            memset(out, 0x55, sizeof(out));
+            pcm_convert_to_float((float *)(void *)(out + align), in + align, format, samples);
+            if (memcmp(expected, out, samples * sizeof(float) + align + 4) != 0) {
+                fprintf(stderr, "%s: %s to float of %u samples at offset %u differs\n",
+                        name, formats[index].name, samples, align);
+                failures++;
+            }
+
+            /* float to integer samples, rounded and clipped */
+            src = (float *)(void *)((uint8_t *)floats + align);
+            fill_float(src, samples, bits);
+            pcm_convert_set_isa(PCM_CONVERT_ISA_SCALAR);
+            memset(expected, 0x55, sizeof(expected));
+            pcm_convert_from_float(expected + align, format, src, samples);
+            pcm_convert_set_isa(isa);
+            memset(out, 0x55, sizeof(out));
+            pcm_convert_from_float(out + align, format, src, samples);
+            if (memcmp(expected, out, samples * bytes + align + 4) != 0) {
+                fprintf(stderr, "%s: %s from float of %u samples at offset %u differs\n",
+                        name, formats[index].name, samples, align);
+                failures++;
+            }
+        }
+    }
+
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    enum pcm_convert_isa best = pcm_convert_get_isa();
+    unsigned int i, f;
+    int failures = 0, ret;
+
+    while (--argc > 0) {
+        argv++;
+        if (strcmp(*argv, "-s") == 0 && argc > 1) {
+            seed = strtoul(*++argv, NULL, 0);
+            if (seed == 0)
+                seed = 1;
+            argc--;
+        } else {
+            fprintf(stderr, "usage: convert-check [-s seed]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+        if (pcm_convert_set_isa(isas[i].isa) < 0) {
+            printf("%s: not supported, skipped\n", isas[i].name);
+            continue;
+        }
+        ret = 0;
+        for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+            ret += check(isas[i].name, isas[i].isa, f);
+        printf("%s: %s\n", isas[i].name, ret ? "FAILED" : "same as scalar");
+        failures += ret;
+    }
+
+    pcm_convert_set_isa(best);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
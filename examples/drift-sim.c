@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <tinyalsa/drift.h>
+
+/* Feeds a drift estimator with the hardware pointer of a synthetic stream:
+ * the clock of the stream runs fast or slow by a known drift, every period
+ * is timestamped with some jitter, and the pointer wraps around at the
+ * boundary several times. The estimate should settle at the injected drift
+ * and never start over. */
+
+int main(int argc, char **argv)
+{
+    double ppm = 100.0, jitter_us = 200.0;
+    unsigned int seconds = 120;
+    unsigned int rate = 48000;
+    unsigned int period = 256;
+    unsigned int window = 1024;
+    unsigned long boundary = 1024UL << 10;
+    struct pcm_drift *drift;
+    struct timespec tstamp;
+    unsigned long position = boundary - 10 * period, periods, n;
+    double time, estimate = 0.0, error = 0.0;
+    unsigned int wraps = 0, restarts = 0, next_report = 10;
+    int valid = 0;
+
+    while (--argc > 0) {
+        argv++;
+        if (strcmp(*argv, "-p") == 0 && argc > 1) {
+            ppm = atof(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-j") == 0 && argc > 1) {
+            jitter_us = atof(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-t") == 0 && argc > 1) {
+            seconds = atoi(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-r") == 0 && argc > 1) {
+            rate = atoi(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-w") == 0 && argc > 1) {
+            window = atoi(*++argv);
+            argc--;
+        } else {
+            fprintf(stderr, "usage: drift-sim [-p ppm] [-j jitter_us] [-t seconds] "
+                    "[-r rate] [-w window]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    drift = pcm_drift_open(rate, window);
+    if (drift == NULL) {
+        fprintf(stderr, "failed to open the drift estimator\n");
+        return EXIT_FAILURE;
+    }
+    pcm_drift_set_boundary(drift, boundary);
+
+    srand(1);
+    periods = (unsigned long)seconds * rate / period;
+    for (n = 0; n < periods; n++) {
+        /* the end of each period is timestamped late or early by up to the jitter */
+        time = (double)n * period / (rate * (1.0 + ppm * 1e-6));
+        time += jitter_us * 1e-6 * (2.0 * rand() / RAND_MAX - 1.0);
+        tstamp.tv_sec = 1000 + (time_t)floor(time);
+        tstamp.tv_nsec = (long)((time - floor(time)) * 1e9);
+
+        if (pcm_drift_add(drift, position, &tstamp) == 0 && n > 0 && valid &&
+            pcm_drift_get_ppm(drift, &estimate, &error) < 0)
+            restarts++;
+        valid = pcm_drift_get_ppm(drift, &estimate, &error) == 0;
+
+        position += period;
+        if (position >= boundary) {
+            position -= boundary;
+            wraps++;
+        }
+
+        if (time >= next_report) {
+            if (valid)
+                printf("%4u s: %8.2f ppm +- %.2f\n", next_report, estimate, 2.0 * error);
+            next_report += 10;
+        }
+    }
+
+    printf("injected %.2f ppm with %.0f us of jitter, estimated %.2f ppm +- %.2f, "
+           "%u wraps, %u restarts\n", ppm, jitter_us, estimate, 2.0 * error, wraps, restarts);
+
+    pcm_drift_close(drift);
+
+    if (!valid || restarts || fabs(estimate - ppm) > 2.0 * error + 0.5) {
+        fprintf(stderr, "the estimate is off\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
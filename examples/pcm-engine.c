@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/engine.h>
+
+struct saw {
+    int16_t value;
+    int16_t step;
+};
+
+static int fill_period(struct pcm * pcm, void * data, unsigned int frames, void * user_data){
+
+    struct saw * saw = user_data;
+    int16_t * samples = data;
+    unsigned int channels = pcm_get_channels(pcm);
+    unsigned int i, ch;
+
+    for (i = 0; i < frames; i++) {
+        for (ch = 0; ch < channels; ch++) {
+            *samples++ = saw->value / 8;
+        }
+        saw->value += saw->step;
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    unsigned int card = 0;
+    unsigned int device = 0;
+    int flags = PCM_OUT | PCM_MMAP;
+    struct saw saw = { 0, 440 * 65536 / 48000 };
+
+    const struct pcm_config config = {
+        .channels = 2,
+        .rate = 48000,
+        .format = PCM_FORMAT_S16_LE,
+        .period_size = 256,
+        .period_count = 2,
+        .start_threshold = 512,
+        .silence_threshold = 0,
+        .stop_threshold = 512
+    };
+
+    const struct pcm_engine_config engine_config = {
+        .priority = 0,
+        .lock_memory = 0
+    };
+
+    struct pcm * pcm = pcm_open(card, device, flags, &config);
+    if (pcm == NULL) {
+        fprintf(stderr, "failed to allocate memory for PCM\n");
+        return EXIT_FAILURE;
+    } else if (!pcm_is_ready(pcm)){
+        fprintf(stderr, "failed to open PCM: %s\n", pcm_get_error(pcm));
+        pcm_close(pcm);
+        return EXIT_FAILURE;
+    }
+
+    struct pcm_engine * engine = pcm_engine_open(&engine_config);
+    if (engine == NULL) {
+        fprintf(stderr, "failed to allocate memory for engine\n");
+        pcm_close(pcm);
+        return EXIT_FAILURE;
+    }
+
+    if ((pcm_engine_add(engine, pcm, fill_period, &saw) < 0)
+     || (pcm_engine_start(engine) < 0)) {
+        fprintf(stderr, "failed to start engine\n");
+        pcm_engine_close(engine);
+        pcm_close(pcm);
+        return EXIT_FAILURE;
+    }
+
+    /* the tone is played from the engine thread */
+    sleep(2);
+
+    int err = pcm_engine_stop(engine);
+    if (err != 0) {
+        fprintf(stderr, "engine stopped with error %d\n", err);
+    }
+    printf("xruns: %u\n", pcm_engine_get_xruns(engine));
+
+    pcm_engine_close(engine);
+    pcm_close(pcm);
+
+    return err == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <tinyalsa/route.h>
+
+/* Measures the throughput of the channel routing calls per channel count,
+ * against plain C loops that do the same thing, and checks that both give
+ * the same frames. Throughput is in GB/s of input. "remap" reverses the
+ * channels of interleaved frames. The figures only mean something if the
+ * library and this program are built with optimization, for example with
+ * CFLAGS="-O2 ..." on the make command line. */
+
+#define MAX_CHANNELS 64
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The plain C loops, on samples of a given type */
+#define REFERENCE(type) \
+static void reference_deinterleave_##type(uint8_t **dst, const uint8_t *src, \
+                                          unsigned int frames, unsigned int channels) \
+{ \
+    const type *in = (const type *)src; \
+    unsigned int f, ch; \
+\
+    for (f = 0; f < frames; f++) \
+        for (ch = 0; ch < channels; ch++) \
+            ((type *)dst[ch])[f] = in[f * channels + ch]; \
+} \
+static void reference_interleave_##type(uint8_t *dst, uint8_t *const *src, \
+                                        unsigned int frames, unsigned int channels) \
+{ \
+    type *out = (type *)dst; \
+    unsigned int f, ch; \
+\
+    for (f = 0; f < frames; f++) \
+        for (ch = 0; ch < channels; ch++) \
+            out[f * channels + ch] = ((const type *)src[ch])[f]; \
+} \
+static void reference_remap_##type(uint8_t *dst, const uint8_t *src, \
+                                   unsigned int frames, unsigned int channels) \
+{ \
+    const type *in = (const type *)src; \
+    type *out = (type *)dst; \
+    unsigned int f, ch; \
+\
+    for (f = 0; f < frames; f++) \
+        for (ch = 0; ch < channels; ch++) \
+            out[f * channels + ch] = in[f * channels + channels - 1 - ch]; \
+}
+
+REFERENCE(uint16_t)
+REFERENCE(uint32_t)
+
+static void reference_deinterleave(uint8_t **dst, const uint8_t *src, unsigned int frames,
+                                   unsigned int channels, unsigned int size)
+{
+    if (size == 2)
+        reference_deinterleave_uint16_t(dst, src, frames, channels);
+    else
+        reference_deinterleave_uint32_t(dst, src, frames, channels);
+}
+
+static void reference_interleave(uint8_t *dst, uint8_t *const *src, unsigned int frames,
+                                 unsigned int channels, unsigned int size)
+{
+    if (size == 2)
+        reference_interleave_uint16_t(dst, src, frames, channels);
+    else
+        reference_interleave_uint32_t(dst, src, frames, channels);
+}
+
+static void reference_remap(uint8_t *dst, const uint8_t *src, unsigned int frames,
+                            unsigned int channels, unsigned int size)
+{
+    if (size == 2)
+        reference_remap_uint16_t(dst, src, frames, channels);
+    else
+        reference_remap_uint32_t(dst, src, frames, channels);
+}
+
+enum operation { DEINTERLEAVE, INTERLEAVE, REMAP };
+
+/* Runs an operation over and over for about @p seconds, returns GB/s */
+static double measure(enum operation op, const struct pcm_route *route, int reference,
+                      uint8_t *interleaved, uint8_t *out, uint8_t **planes,
+                      unsigned int frames, unsigned int channels, unsigned int size,
+                      double seconds)
+{
+    double start = now(), elapsed;
+    unsigned long runs = 0;
+
+    do {
+        switch (op) {
+        case DEINTERLEAVE:
+            if (reference)
+                reference_deinterleave(planes, interleaved, frames, channels, size);
+            else
+                pcm_route_deinterleave(route, (void *const *)planes, interleaved, frames);
+            break;
+        case INTERLEAVE:
+            if (reference)
+                reference_interleave(out, planes, frames, channels, size);
+            else
+                pcm_route_interleave(route, out, (const void *const *)planes, frames);
+            break;
+        case REMAP:
+            if (reference)
+                reference_remap(out, interleaved, frames, channels, size);
+            else
+                pcm_route_apply(route, out, interleaved, frames);
+            break;
+        }
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    return (double)runs * frames * channels * size / elapsed / 1e9;
+}
+
+/* Runs an operation once each way on the same input and compares the output */
+static int verify(enum operation op, const struct pcm_route *route, uint8_t *interleaved,
+                  uint8_t *expected, uint8_t *out, uint8_t **planes, uint8_t **expected_planes,
+                  unsigned int frames, unsigned int channels, unsigned int size)
+{
+    size_t bytes = (size_t)frames * channels * size;
+    unsigned int ch;
+
+    switch (op) {
+    case DEINTERLEAVE:
+        reference_deinterleave(expected_planes, interleaved, frames, channels, size);
+        pcm_route_deinterleave(route, (void *const *)planes, interleaved, frames);
+        for (ch = 0; ch < channels; ch++)
+            if (memcmp(planes[ch], expected_planes[ch], (size_t)frames * size) != 0)
+                return -1;
+        return 0;
+    case INTERLEAVE:
+        reference_interleave(expected, planes, frames, channels, size);
+        pcm_route_interleave(route, out, (const void *const *)planes, frames);
+        break;
+    case REMAP:
+        reference_remap(expected, interleaved, frames, channels, size);
+        pcm_route_apply(route, out, interleaved, frames);
+        break;
+    }
+    return memcmp(out, expected, bytes) != 0 ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int channel_counts[] = { 2, 4, 8, 16, 32, 64 };
+    static const struct {
+        enum pcm_format format;
+        unsigned int bits;
+    } formats[] = {
+        { PCM_FORMAT_S16_LE, 16 },
+        { PCM_FORMAT_S32_LE, 32 },
+    };
+    static const char *const names[] = { "deinterleave", "interleave", "remap" };
+    unsigned int frames = 4096, size, channels, f, c, ch, op;
+    double seconds = 0.2, ref, lib;
+    uint8_t *interleaved, *expected, *out;
+    uint8_t *planes[MAX_CHANNELS], *expected_planes[MAX_CHANNELS];
+    int map[MAX_CHANNELS], failures = 0;
+    struct pcm_route *identity, *reversal;
+    size_t n;
+
+    while (--argc > 0) {
+        argv++;
+        if (strcmp(*argv, "-f") == 0 && argc > 1) {
+            frames = atoi(*++argv);
+            argc--;
+        } else if (strcmp(*argv, "-t") == 0 && argc > 1) {
+            seconds = atof(*++argv);
+            argc--;
+        } else {
+            fprintf(stderr, "usage: route-bench [-f frames] [-t seconds per measurement]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (frames == 0)
+        frames = 1;
+
+    interleaved = malloc((size_t)frames * MAX_CHANNELS * 4);
+    expected = malloc((size_t)frames * MAX_CHANNELS * 4);
+    out = malloc((size_t)frames * MAX_CHANNELS * 4);
+    for (ch = 0; ch < MAX_CHANNELS; ch++) {
+        planes[ch] = malloc((size_t)frames * 4);
+        expected_planes[ch] = malloc((size_t)frames * 4);
+        if (!planes[ch] || !expected_planes[ch])
+            return EXIT_FAILURE;
+    }
+    if (!interleaved || !expected || !out) {
+        fprintf(stderr, "failed to allocate buffers\n");
+        return EXIT_FAILURE;
+    }
+    for (n = 0; n < (size_t)frames * MAX_CHANNELS * 4; n++)
+        interleaved[n] = rand();
+
+    printf("GB/s of input, %u frames, reference -> library\n\n", frames);
+    printf("               %-18s %-18s %-18s\n", names[0], names[1], names[2]);
+
+    for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        size = formats[f].bits / 8;
+        for (c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++) {
+            channels = channel_counts[c];
+            for (ch = 0; ch < channels; ch++)
+                map[ch] = channels - 1 - ch;
+            identity = pcm_route_open(formats[f].format, channels, channels, NULL);
+            reversal = pcm_route_open(formats[f].format, channels, channels, map);
+            if (!identity || !reversal) {
+                fprintf(stderr, "failed to open the routes\n");
+                return EXIT_FAILURE;
+            }
+
+            printf("%2u-bit %2uch  ", formats[f].bits, channels);
+            for (op = DEINTERLEAVE; op <= REMAP; op++) {
+                const struct pcm_route *route = op == REMAP ? reversal : identity;
+
+                if (verify(op, route, interleaved, expected, out, planes, expected_planes,
+                           frames, channels, size) < 0) {
+                    printf(" %-18s", "MISMATCH");
+                    failures++;
+                    continue;
+                }
+                ref = measure(op, route, 1, interleaved, out, planes, frames, channels,
+                              size, seconds);
+                lib = measure(op, route, 0, interleaved, out, planes, frames, channels,
+                              size, seconds);
+                printf(" %6.1f -> %-8.1f", ref, lib);
+            }
+            printf("\n");
+
+            pcm_route_close(identity);
+            pcm_route_close(reversal);
+        }
+    }
+
+    for (ch = 0; ch < MAX_CHANNELS; ch++) {
+        free(planes[ch]);
+        free(expected_planes[ch]);
+    }
+    free(interleaved);
+    free(expected);
+    free(out);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -31,6 +31,13 @@
 
 #include "mixer.h"
 #include "pcm.h"
+#include "waitset.h"
+#include "engine.h"
+#include "ring.h"
+#include "drift.h"
+#include "asrc.h"
+#include "convert.h"
+#include "route.h"
 #include "version.h"
 
 #endif
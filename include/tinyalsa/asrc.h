@@ -0,0 +1,97 @@
+/* asrc.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/** @file */
+
+/** @defgroup libtinyalsa-asrc Asynchronous Sample Rate Converter Interface
+ * @brief Bridges a capture PCM and a playback PCM that run from different clocks.
+ */
+
+#ifndef TINYALSA_ASRC_H
+#define TINYALSA_ASRC_H
+
+#include <tinyalsa/pcm.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** Parameters of a sample rate converter.
+ * @ingroup libtinyalsa-asrc
+ */
+struct pcm_asrc_config {
+    /** The number of channels, the same on both sides */
+    unsigned int channels;
+    /** The sample format, the same on both sides.
+     * One of @ref PCM_FORMAT_S16_LE, @ref PCM_FORMAT_S24_LE, @ref PCM_FORMAT_S32_LE
+     * or @ref PCM_FORMAT_FLOAT_LE. */
+    enum pcm_format format;
+    /** The nominal rate of the input, in frames per second */
+    unsigned int in_rate;
+    /** The nominal rate of the output, in frames per second */
+    unsigned int out_rate;
+    /** The length of the interpolation filter, in input frames.
+     * Rounded up to a multiple of eight; zero selects 32.
+     * Each output frame costs this many multiply-adds per channel. */
+    unsigned int taps;
+    /** The most input frames that can be queued at once; zero selects 4096 */
+    unsigned int max_frames;
+    /** The number of output frames to keep queued downstream,
+     * which is the latency that the controller holds constant */
+    unsigned int target;
+};
+
+struct pcm_asrc;
+
+struct pcm_asrc *pcm_asrc_open(const struct pcm_asrc_config *config);
+
+void pcm_asrc_close(struct pcm_asrc *asrc);
+
+unsigned int pcm_asrc_write(struct pcm_asrc *asrc, const void *data, unsigned int frames);
+
+unsigned int pcm_asrc_read(struct pcm_asrc *asrc, void *data, unsigned int frames);
+
+void pcm_asrc_set_drift(struct pcm_asrc *asrc, double ppm);
+
+void pcm_asrc_update(struct pcm_asrc *asrc, long fill, double seconds);
+
+double pcm_asrc_get_ppm(const struct pcm_asrc *asrc);
+
+int pcm_asrc_start(struct pcm_asrc *asrc, struct pcm *capture, struct pcm *playback,
+                   int priority);
+
+int pcm_asrc_stop(struct pcm_asrc *asrc);
+
+unsigned int pcm_asrc_get_xruns(const struct pcm_asrc *asrc);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
+#endif
+
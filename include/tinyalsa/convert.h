@@ -0,0 +1,77 @@
+/* convert.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/** @file */
+
+/** @defgroup libtinyalsa-convert Conversion Interface
+ * @brief Converts samples between PCM formats, and to and from float.
+ */
+
+#ifndef TINYALSA_CONVERT_H
+#define TINYALSA_CONVERT_H
+
+#include <tinyalsa/pcm.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** The instruction sets that the conversion kernels can use.
+ * @ingroup libtinyalsa-convert
+ */
+enum pcm_convert_isa {
+    /** Plain C, available everywhere */
+    PCM_CONVERT_ISA_SCALAR = 0,
+    /** x86 SSE2 */
+    PCM_CONVERT_ISA_SSE2,
+    /** x86 AVX2 */
+    PCM_CONVERT_ISA_AVX2,
+    /** 64-bit ARM NEON */
+    PCM_CONVERT_ISA_NEON,
+};
+
+int pcm_convert(void *dst, enum pcm_format dst_format,
+                const void *src, enum pcm_format src_format,
+                unsigned int samples);
+
+int pcm_convert_to_float(float *dst, const void *src, enum pcm_format format,
+                         unsigned int samples);
+
+int pcm_convert_from_float(void *dst, enum pcm_format format, const float *src,
+                           unsigned int samples);
+
+enum pcm_convert_isa pcm_convert_get_isa(void);
+
+int pcm_convert_set_isa(enum pcm_convert_isa isa);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
+#endif
+
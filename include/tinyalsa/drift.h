@@ -0,0 +1,70 @@
+/* drift.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/** @file */
+
+/** @defgroup libtinyalsa-drift Drift Interface
+ * @brief Estimates how fast the clock of a sound card runs compared with the system clock.
+ */
+
+#ifndef TINYALSA_DRIFT_H
+#define TINYALSA_DRIFT_H
+
+#include <time.h>
+
+#include <tinyalsa/pcm.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct pcm_drift;
+
+struct pcm_drift *pcm_drift_open(unsigned int rate, unsigned int window);
+
+void pcm_drift_close(struct pcm_drift *drift);
+
+void pcm_drift_reset(struct pcm_drift *drift);
+
+void pcm_drift_set_boundary(struct pcm_drift *drift, unsigned long boundary);
+
+int pcm_drift_add(struct pcm_drift *drift, unsigned long position,
+                  const struct timespec *tstamp);
+
+int pcm_drift_update(struct pcm_drift *drift, struct pcm *pcm);
+
+int pcm_drift_get_ppm(const struct pcm_drift *drift, double *ppm, double *error);
+
+unsigned int pcm_drift_get_outliers(const struct pcm_drift *drift);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
+#endif
+
@@ -0,0 +1,92 @@
+/* engine.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/** @file */
+
+/** @defgroup libtinyalsa-engine Engine Interface
+ * @brief A real-time thread that streams memory mapped PCMs through callbacks.
+ */
+
+#ifndef TINYALSA_ENGINE_H
+#define TINYALSA_ENGINE_H
+
+#include <tinyalsa/pcm.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** Called by the engine thread for every period of a stream.
+ * For a playback stream, the callback fills @p frames frames at @p data.
+ * For a capture stream, the callback consumes @p frames frames from @p data.
+ * @p data points straight into the memory mapped buffer of the PCM.
+ * The callback runs on the engine thread, so it must not block.
+ * @param pcm The PCM that the period belongs to.
+ * @param data The interleaved frames of the period.
+ * @param frames The number of frames at @p data.
+ *  This is the period size, unless the period is split by the end of the buffer.
+ * @param user_data The user data given to @ref pcm_engine_add.
+ * @returns Zero to continue streaming.
+ *  Any other value stops the engine, and is returned by @ref pcm_engine_stop.
+ * @ingroup libtinyalsa-engine
+ */
+typedef int (*pcm_engine_callback)(struct pcm *pcm, void *data, unsigned int frames,
+                                   void *user_data);
+
+/** Options of an engine.
+ * @ingroup libtinyalsa-engine
+ */
+struct pcm_engine_config {
+    /** The SCHED_FIFO priority of the engine thread.
+     * Zero leaves the thread with the default scheduling policy. */
+    int priority;
+    /** If non-zero, all memory of the process is locked (mlockall) when the engine starts. */
+    int lock_memory;
+};
+
+struct pcm_engine;
+
+struct pcm_engine *pcm_engine_open(const struct pcm_engine_config *config);
+
+void pcm_engine_close(struct pcm_engine *engine);
+
+int pcm_engine_add(struct pcm_engine *engine, struct pcm *pcm,
+                   pcm_engine_callback callback, void *user_data);
+
+int pcm_engine_start(struct pcm_engine *engine);
+
+int pcm_engine_stop(struct pcm_engine *engine);
+
+unsigned int pcm_engine_get_xruns(const struct pcm_engine *engine);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
+#endif
+
@@ -76,6 +76,8 @@ int mixer_add_new_ctls(struct mixer *mixer);
 
 const char *mixer_get_name(const struct mixer *mixer);
 
+int mixer_get_file_descriptor(const struct mixer *mixer);
+
 unsigned int mixer_get_num_ctls(const struct mixer *mixer);
 
 unsigned int mixer_get_num_ctls_by_name(const struct mixer *mixer, const char *name);
@@ -88,6 +88,39 @@ extern "C" {
  */
 #define PCM_MONOTONIC 0x00000008
 
+/** Specifies that the PCM is opened in non-blocking mode.
+ * Read and write functions never sleep; if no frames can be transferred
+ * they return -EAGAIN, otherwise they may transfer fewer frames than requested.
+ * Use @ref pcm_wait, or poll the file descriptor, to wait for the PCM.
+ * Used in @ref pcm_open.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_NONBLOCK 0x00000010
+
+/** Specifies that the samples of each channel are stored in their own buffer
+ * (planar layout) instead of being interleaved into frames.
+ * Audio is transferred with @ref pcm_writen and @ref pcm_readn.
+ * With @ref PCM_MMAP, @ref pcm_mmap_begin returns one area per channel.
+ * Used in @ref pcm_open.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_NONINTERLEAVED 0x00000020
+
+/** Means a PCM is open, but has not been configured.
+ * @ingroup libtinyalsa-pcm
+ */
+#define	PCM_STATE_OPEN 0x00
+
+/** Means a PCM is configured, but has not been prepared.
+ * @ingroup libtinyalsa-pcm
+ */
+#define	PCM_STATE_SETUP 0x01
+
+/** Means a PCM is ready to be started.
+ * @ingroup libtinyalsa-pcm
+ */
+#define	PCM_STATE_PREPARED 0x02
+
 /** For inputs, this means the PCM is recording audio samples.
  * For outputs, this means the PCM is playing audio samples.
  * @ingroup libtinyalsa-pcm
@@ -104,6 +137,11 @@ extern "C" {
  */
 #define	PCM_STATE_DRAINING 0x05
 
+/** Means a PCM is paused.
+ * @ingroup libtinyalsa-pcm
+ */
+#define	PCM_STATE_PAUSED 0x06
+
 /** Means a PCM is suspended.
  * @ingroup libtinyalsa-pcm
  */
@@ -143,6 +181,36 @@ enum pcm_format {
     PCM_FORMAT_S32_LE,
     /** Signed, 32-bit, big endian */
     PCM_FORMAT_S32_BE,
+    /** Unsigned, 8-bit */
+    PCM_FORMAT_U8,
+    /** Unsigned, 16-bit, little endian */
+    PCM_FORMAT_U16_LE,
+    /** Unsigned, 16-bit, big endian */
+    PCM_FORMAT_U16_BE,
+    /** Unsigned, 24-bit (32-bit in memory), little endian */
+    PCM_FORMAT_U24_LE,
+    /** Unsigned, 24-bit (32-bit in memory), big endian */
+    PCM_FORMAT_U24_BE,
+    /** Unsigned, 32-bit, little endian */
+    PCM_FORMAT_U32_LE,
+    /** Unsigned, 32-bit, big endian */
+    PCM_FORMAT_U32_BE,
+    /** IEEE 754 single precision float in [-1, 1], little endian */
+    PCM_FORMAT_FLOAT_LE,
+    /** IEEE 754 single precision float in [-1, 1], big endian */
+    PCM_FORMAT_FLOAT_BE,
+    /** IEEE 754 double precision float in [-1, 1], little endian */
+    PCM_FORMAT_FLOAT64_LE,
+    /** IEEE 754 double precision float in [-1, 1], big endian */
+    PCM_FORMAT_FLOAT64_BE,
+    /** Signed, 20-bit (24-bit in memory), little endian */
+    PCM_FORMAT_S20_3LE,
+    /** Signed, 20-bit (24-bit in memory), big endian */
+    PCM_FORMAT_S20_3BE,
+    /** Signed, 18-bit (24-bit in memory), little endian */
+    PCM_FORMAT_S18_3LE,
+    /** Signed, 18-bit (24-bit in memory), big endian */
+    PCM_FORMAT_S18_3BE,
     /** Max of the enumeration list, not an actual format. */
     PCM_FORMAT_MAX
 };
@@ -183,6 +251,42 @@ struct pcm_config {
     unsigned int silence_threshold;
 };
 
+/** The configurations that @ref pcm_open_negotiated may settle on.
+ * Each range is inclusive, and a bound of zero leaves that side of it open.
+ * Within the ranges, the value closest to the preferred one that the
+ * hardware supports is chosen.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_constraints {
+    /** The configuration to get as close to as possible.
+     * If its period size or count is zero, a default is used. */
+    struct pcm_config preferred;
+    /** The formats accepted besides the preferred one,
+     * as a bitwise OR of (1 << @ref pcm_format).
+     * If zero, only the preferred format is accepted. */
+    unsigned int formats;
+    /** The smallest acceptable number of channels */
+    unsigned int min_channels;
+    /** The largest acceptable number of channels */
+    unsigned int max_channels;
+    /** The lowest acceptable rate */
+    unsigned int min_rate;
+    /** The highest acceptable rate */
+    unsigned int max_rate;
+    /** The smallest acceptable number of frames in a period */
+    unsigned int min_period_size;
+    /** The largest acceptable number of frames in a period */
+    unsigned int max_period_size;
+    /** The smallest acceptable number of periods */
+    unsigned int min_period_count;
+    /** The largest acceptable number of periods */
+    unsigned int max_period_count;
+    /** The latency to aim for, in microseconds, or zero for none.
+     * If set, the period size is chosen so that the buffer holds
+     * as close to this as possible, and the preferred period size is ignored. */
+    unsigned int latency_us;
+};
+
 /** Enumeration of a PCM's hardware parameters.
  * Each of these parameters is either a mask or an interval.
  * @ingroup libtinyalsa-pcm
@@ -216,6 +320,153 @@ enum pcm_param
     PCM_PARAM_TICK_TIME,
 }; /* enum pcm_param */
 
+/** Enumeration of the ioctls that are counted in @ref pcm_stats.
+ * @ingroup libtinyalsa-pcm
+ */
+enum pcm_ioctl
+{
+    /** SNDRV_PCM_IOCTL_INFO */
+    PCM_IOCTL_INFO,
+    /** SNDRV_PCM_IOCTL_HW_PARAMS */
+    PCM_IOCTL_HW_PARAMS,
+    /** SNDRV_PCM_IOCTL_SW_PARAMS */
+    PCM_IOCTL_SW_PARAMS,
+    /** SNDRV_PCM_IOCTL_SYNC_PTR */
+    PCM_IOCTL_SYNC_PTR,
+    /** SNDRV_PCM_IOCTL_HWSYNC */
+    PCM_IOCTL_HWSYNC,
+    /** SNDRV_PCM_IOCTL_DELAY */
+    PCM_IOCTL_DELAY,
+    /** SNDRV_PCM_IOCTL_PREPARE */
+    PCM_IOCTL_PREPARE,
+    /** SNDRV_PCM_IOCTL_START */
+    PCM_IOCTL_START,
+    /** SNDRV_PCM_IOCTL_DROP */
+    PCM_IOCTL_DROP,
+    /** SNDRV_PCM_IOCTL_WRITEI_FRAMES */
+    PCM_IOCTL_WRITEI_FRAMES,
+    /** SNDRV_PCM_IOCTL_READI_FRAMES */
+    PCM_IOCTL_READI_FRAMES,
+    /** SNDRV_PCM_IOCTL_WRITEN_FRAMES */
+    PCM_IOCTL_WRITEN_FRAMES,
+    /** SNDRV_PCM_IOCTL_READN_FRAMES */
+    PCM_IOCTL_READN_FRAMES,
+    /** SNDRV_PCM_IOCTL_STATUS and SNDRV_PCM_IOCTL_STATUS_EXT */
+    PCM_IOCTL_STATUS,
+    /** Any other ioctl (e.g. link, unlink, timestamp type) */
+    PCM_IOCTL_OTHER,
+    /** Max of the enumeration list, not an actual ioctl. */
+    PCM_IOCTL_MAX
+};
+
+/** The number of buckets in @ref pcm_stats.lateness_histogram.
+ * @ingroup libtinyalsa-pcm
+ */
+#define PCM_STATS_LATENESS_BUCKETS 16
+
+/** Runtime statistics of a PCM.
+ * Retrieved with @ref pcm_get_stats and cleared with @ref pcm_reset_stats.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_stats {
+    /** The number of ioctls issued on the PCM, indexed by @ref pcm_ioctl */
+    unsigned long ioctls[PCM_IOCTL_MAX];
+    /** The number of underruns of an output, as seen by the read and write functions */
+    unsigned long underruns;
+    /** The number of overruns of an input, as seen by the read and write functions */
+    unsigned long overruns;
+    /** The number of times that @ref pcm_wait returned with the PCM ready */
+    unsigned long wakeups;
+    /** The number of frames read or written */
+    unsigned long long frames;
+    /** The time spent blocked in poll() by @ref pcm_wait, in nanoseconds */
+    unsigned long long poll_time_ns;
+    /** The time spent copying frames to or from the mmap buffer,
+     * including software gain and metering, in nanoseconds */
+    unsigned long long copy_time_ns;
+    /** The number of wakeups of @ref pcm_wait that were caused by the
+     * hardware pointer moving, whose lateness was measured.
+     * Lateness is only measured when the status page of the PCM could be
+     * mapped, so this stays zero on kernels that need sync_ptr. */
+    unsigned long lateness_count;
+    /** The smallest time from a hardware pointer update, normally
+     * the end of a period, to the wakeup it caused, in nanoseconds */
+    unsigned long long lateness_min_ns;
+    /** The average lateness of wakeups, in nanoseconds */
+    unsigned long long lateness_avg_ns;
+    /** The largest lateness of wakeups, in nanoseconds */
+    unsigned long long lateness_max_ns;
+    /** The lateness of wakeups by powers of two of microseconds.
+     * Bucket zero counts wakeups less than 1us late, bucket n counts
+     * those from 2^(n-1) up to 2^n us late, and the last bucket also
+     * counts every later one. */
+    unsigned long lateness_histogram[PCM_STATS_LATENESS_BUCKETS];
+};
+
+/** A segment of frames, used in @ref pcm_writev and @ref pcm_readv.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_iovec {
+    /** The interleaved frames of the segment.
+     * For a PCM opened with @ref PCM_NONINTERLEAVED,
+     * an array of one sample buffer per channel. */
+    void *base;
+    /** The number of frames in the segment */
+    unsigned int frames;
+};
+
+/** Enumeration of the clocks that an audio timestamp may be taken from.
+ * The values match the types of the kernel.
+ * @ingroup libtinyalsa-pcm
+ */
+enum pcm_audio_tstamp_type
+{
+    /** The timestamp of kernels without typed audio timestamps */
+    PCM_AUDIO_TSTAMP_TYPE_COMPAT,
+    /** The DMA time, as reported by the hardware pointer */
+    PCM_AUDIO_TSTAMP_TYPE_DEFAULT,
+    /** The link time, reset when the stream starts */
+    PCM_AUDIO_TSTAMP_TYPE_LINK,
+    /** The link time, not reset when the stream starts */
+    PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE,
+    /** The link time, estimated indirectly */
+    PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED,
+    /** The link time, synchronized with the system time */
+    PCM_AUDIO_TSTAMP_TYPE_LINK_SYNCHRONIZED
+};
+
+/** The status of a PCM, sampled at a single point in time.
+ * Retrieved with @ref pcm_get_status.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_status {
+    /** The state of the PCM, e.g. @ref PCM_STATE_RUNNING */
+    int state;
+    /** For an input, the number of frames ready to be read.
+     * For an output, the number of frames that can be written. */
+    unsigned int avail;
+    /** The delay of the PCM, in frames, including any delay reported by the driver */
+    long delay;
+    /** The position of the hardware in the buffer, in frames, modulo the boundary */
+    unsigned long hw_ptr;
+    /** The position of the application in the buffer, in frames, modulo the boundary */
+    unsigned long appl_ptr;
+    /** When the PCM was last started, stopped or paused */
+    struct timespec trigger_tstamp;
+    /** When the other fields were sampled.
+     * The clock is CLOCK_MONOTONIC if @ref PCM_MONOTONIC was specified in
+     * @ref pcm_open, otherwise it is CLOCK_REALTIME. */
+    struct timespec tstamp;
+    /** The amount of audio processed by the hardware at @ref tstamp,
+     * as measured by the clock in @ref audio_tstamp_type */
+    struct timespec audio_tstamp;
+    /** The clock that @ref audio_tstamp was taken from.
+     * This may differ from the requested one if the driver does not support it. */
+    enum pcm_audio_tstamp_type audio_tstamp_type;
+    /** The accuracy of @ref audio_tstamp in nanoseconds, zero if unknown */
+    unsigned int audio_tstamp_accuracy;
+};
+
 struct pcm_params;
 
 struct pcm_params *pcm_params_get(unsigned int card, unsigned int device,
@@ -229,6 +480,15 @@ unsigned int pcm_params_get_min(const struct pcm_params *pcm_params, enum pcm_pa
 
 unsigned int pcm_params_get_max(const struct pcm_params *pcm_params, enum pcm_param param);
 
+struct pcm_params_cache;
+
+struct pcm_params_cache *pcm_params_cache_open(const char *path);
+
+struct pcm_params *pcm_params_cache_get(struct pcm_params_cache *cache, unsigned int card,
+                                        unsigned int device, unsigned int flags);
+
+int pcm_params_cache_close(struct pcm_params_cache *cache);
+
 struct pcm;
 
 struct pcm *pcm_open(unsigned int card,
@@ -240,6 +500,11 @@ struct pcm *pcm_open_by_name(const char *name,
                              unsigned int flags,
                              const struct pcm_config *config);
 
+struct pcm *pcm_open_negotiated(unsigned int card,
+                                unsigned int device,
+                                unsigned int flags,
+                                const struct pcm_constraints *constraints);
+
 int pcm_close(struct pcm *pcm);
 
 int pcm_is_ready(const struct pcm *pcm);
@@ -254,14 +519,22 @@ enum pcm_format pcm_get_format(const struct pcm *pcm);
 
 int pcm_get_file_descriptor(const struct pcm *pcm);
 
+unsigned int pcm_get_flags(const struct pcm *pcm);
+
 const char *pcm_get_error(const struct pcm *pcm);
 
 int pcm_set_config(struct pcm *pcm, const struct pcm_config *config);
 
 unsigned int pcm_format_to_bits(enum pcm_format format);
 
+void pcm_format_set_silence(enum pcm_format format, void *data, unsigned int samples);
+
 unsigned int pcm_get_buffer_size(const struct pcm *pcm);
 
+unsigned int pcm_get_boundary(const struct pcm *pcm);
+
+unsigned int pcm_get_latency(const struct pcm *pcm);
+
 unsigned int pcm_frames_to_bytes(const struct pcm *pcm, unsigned int frames);
 
 unsigned int pcm_bytes_to_frames(const struct pcm *pcm, unsigned int bytes);
@@ -274,6 +547,14 @@ int pcm_writei(struct pcm *pcm, const void *data, unsigned int frame_count);
 
 int pcm_readi(struct pcm *pcm, void *data, unsigned int frame_count);
 
+int pcm_writen(struct pcm *pcm, void **data, unsigned int frame_count);
+
+int pcm_readn(struct pcm *pcm, void **data, unsigned int frame_count);
+
+int pcm_writev(struct pcm *pcm, const struct pcm_iovec *segments, unsigned int count);
+
+int pcm_readv(struct pcm *pcm, const struct pcm_iovec *segments, unsigned int count);
+
 #ifdef __GNUC__
 
 int pcm_write(struct pcm *pcm, const void *data, unsigned int count) __attribute((deprecated));
@@ -306,10 +587,44 @@ int pcm_start(struct pcm *pcm);
 
 int pcm_stop(struct pcm *pcm);
 
+int pcm_set_avail_min(struct pcm *pcm, unsigned int avail_min);
+
+int pcm_set_gain(struct pcm *pcm, float gain, unsigned int ramp_frames);
+
+int pcm_set_channel_gains(struct pcm *pcm, const float *gains, unsigned int ramp_frames);
+
+int pcm_set_metering(struct pcm *pcm, int enable);
+
+int pcm_get_levels(struct pcm *pcm, float *peak, float *rms, unsigned int channels,
+                   int reset);
+
+/** Called when the adaptive latency of an output changes its target.
+ * The callback runs in the thread that writes to the PCM, from within
+ * the write that caused the change.
+ * @param pcm The PCM whose target changed.
+ * @param frames The number of frames that the PCM now keeps queued.
+ * @param data The user data given to @ref pcm_set_adaptive_latency.
+ * @ingroup libtinyalsa-pcm
+ */
+typedef void (*pcm_latency_callback)(struct pcm *pcm, unsigned int frames, void *data);
+
+int pcm_set_adaptive_latency(struct pcm *pcm, int enable, unsigned int min_frames,
+                             unsigned int max_frames, pcm_latency_callback callback,
+                             void *data);
+
 int pcm_wait(struct pcm *pcm, int timeout);
 
+int pcm_state(struct pcm *pcm);
+
 long pcm_get_delay(struct pcm *pcm);
 
+int pcm_get_stats(const struct pcm *pcm, struct pcm_stats *stats);
+
+int pcm_reset_stats(struct pcm *pcm);
+
+int pcm_get_status(struct pcm *pcm, enum pcm_audio_tstamp_type type,
+                   struct pcm_status *status);
+
 #if defined(__cplusplus)
 }  /* extern "C" */
 #endif
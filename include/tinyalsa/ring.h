@@ -0,0 +1,90 @@
+/* ring.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/** @file */
+
+/** @defgroup libtinyalsa-ring Ring Interface
+ * @brief A lock-free frame queue between one producer and one consumer thread,
+ *  and a real-time thread that pumps it into or out of a PCM.
+ */
+
+#ifndef TINYALSA_RING_H
+#define TINYALSA_RING_H
+
+#include <tinyalsa/pcm.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct pcm_ring;
+
+struct pcm_ring *pcm_ring_open(const struct pcm_config *config, unsigned int frames);
+
+void pcm_ring_close(struct pcm_ring *ring);
+
+unsigned int pcm_ring_get_size(const struct pcm_ring *ring);
+
+unsigned int pcm_ring_get_frame_size(const struct pcm_ring *ring);
+
+unsigned int pcm_ring_get_fill(const struct pcm_ring *ring);
+
+unsigned int pcm_ring_get_space(const struct pcm_ring *ring);
+
+unsigned int pcm_ring_get_high_water(struct pcm_ring *ring, int reset);
+
+unsigned int pcm_ring_get_underruns(const struct pcm_ring *ring);
+
+unsigned int pcm_ring_get_overruns(const struct pcm_ring *ring);
+
+unsigned int pcm_ring_write(struct pcm_ring *ring, const void *data, unsigned int frames);
+
+unsigned int pcm_ring_read(struct pcm_ring *ring, void *data, unsigned int frames);
+
+unsigned int pcm_ring_write_begin(struct pcm_ring *ring, void **data, unsigned int frames);
+
+void pcm_ring_write_commit(struct pcm_ring *ring, unsigned int frames);
+
+unsigned int pcm_ring_read_begin(struct pcm_ring *ring, void **data, unsigned int frames);
+
+void pcm_ring_read_commit(struct pcm_ring *ring, unsigned int frames);
+
+struct pcm_ring_pump;
+
+struct pcm_ring_pump *pcm_ring_pump_start(struct pcm_ring *ring, struct pcm *pcm, int priority);
+
+int pcm_ring_pump_get_error(const struct pcm_ring_pump *pump);
+
+int pcm_ring_pump_stop(struct pcm_ring_pump *pump);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
+#endif
+
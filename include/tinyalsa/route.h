@@ -0,0 +1,65 @@
+/* route.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/** @file */
+
+/** @defgroup libtinyalsa-route Routing Interface
+ * @brief Reorders, picks and (de)interleaves the channels of PCM frames.
+ */
+
+#ifndef TINYALSA_ROUTE_H
+#define TINYALSA_ROUTE_H
+
+#include <tinyalsa/pcm.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct pcm_route;
+
+struct pcm_route *pcm_route_open(enum pcm_format format, unsigned int in_channels,
+                                 unsigned int out_channels, const int *map);
+
+void pcm_route_close(struct pcm_route *route);
+
+int pcm_route_apply(const struct pcm_route *route, void *dst, const void *src,
+                    unsigned int frames);
+
+int pcm_route_deinterleave(const struct pcm_route *route, void *const *dst,
+                           const void *src, unsigned int frames);
+
+int pcm_route_interleave(const struct pcm_route *route, void *dst,
+                         const void *const *src, unsigned int frames);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
+#endif
+
@@ -0,0 +1,99 @@
+/* waitset.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/** @file */
+
+/** @defgroup libtinyalsa-waitset Wait Set Interface
+ * @brief Waits on any number of PCMs and mixers with a single system call.
+ */
+
+#ifndef TINYALSA_WAITSET_H
+#define TINYALSA_WAITSET_H
+
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/mixer.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** The type of handle in a @ref waitset_event.
+ * @ingroup libtinyalsa-waitset
+ */
+enum waitset_type {
+    /** The handle is a PCM */
+    WAITSET_PCM,
+    /** The handle is a mixer */
+    WAITSET_MIXER,
+};
+
+/** A handle that became ready, returned by @ref waitset_wait.
+ * @ingroup libtinyalsa-waitset
+ */
+struct waitset_event {
+    /** The type of @ref handle */
+    enum waitset_type type;
+    /** The handle that became ready */
+    union {
+        /** Valid if @ref type is @ref WAITSET_PCM */
+        struct pcm *pcm;
+        /** Valid if @ref type is @ref WAITSET_MIXER */
+        struct mixer *mixer;
+    } handle;
+    /** The user data that was given when the handle was added */
+    void *user_data;
+    /** One if the handle is ready for IO.
+     * Otherwise, the error that @ref pcm_wait or @ref mixer_wait_event
+     * would have returned (-EPIPE, -ESTRPIPE, -ENODEV or -EIO).
+     */
+    int status;
+};
+
+struct waitset;
+
+struct waitset *waitset_open(void);
+
+void waitset_close(struct waitset *waitset);
+
+int waitset_add_pcm(struct waitset *waitset, struct pcm *pcm, void *user_data);
+
+int waitset_add_mixer(struct waitset *waitset, struct mixer *mixer, void *user_data);
+
+int waitset_remove_pcm(struct waitset *waitset, struct pcm *pcm);
+
+int waitset_remove_mixer(struct waitset *waitset, struct mixer *mixer);
+
+int waitset_wait(struct waitset *waitset, struct waitset_event *events,
+                 unsigned int max_events, int timeout);
+
+#if defined(__cplusplus)
+}  /* extern "C" */
+#endif
+
+#endif
+
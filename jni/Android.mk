@@ -6,7 +6,7 @@ utilsdir ?= $(LOCAL_PATH)/../utils
 
 include $(CLEAR_VARS)
 LOCAL_C_INCLUDES:= $(incdir)
-LOCAL_SRC_FILES:= $(srcdir)/mixer.c $(srcdir)/pcm.c
+LOCAL_SRC_FILES:= $(srcdir)/mixer.c $(srcdir)/pcm.c $(srcdir)/waitset.c $(srcdir)/engine.c $(srcdir)/ring.c $(srcdir)/drift.c $(srcdir)/asrc.c $(srcdir)/convert.c $(srcdir)/route.c $(srcdir)/gain.c $(srcdir)/meter.c $(srcdir)/cache.c
 LOCAL_MODULE := libtinyalsa
 LOCAL_SHARED_LIBRARIES:= libcutils libutils
 LOCAL_MODULE_TAGS := optional
@@ -0,0 +1,732 @@
+/* asrc.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <tinyalsa/asrc.h>
+#include <tinyalsa/drift.h>
+
+#include "thread.h"
+
+/* The number of filter phases between two input frames. The coefficients
+ * for an output frame are interpolated between the two nearest phases. */
+#define PCM_ASRC_PHASES 256
+
+/* The shape of the Kaiser window of the interpolation filter */
+#define PCM_ASRC_KAISER_BETA 8.0
+
+/* The passband of the filter, as a fraction of the lower Nyquist frequency */
+#define PCM_ASRC_CUTOFF 0.91
+
+/* The bandwidth and damping of the loop that holds the fill level at the
+ * target. It is slow enough to average out the period sized steps that the
+ * fill level moves in, and fast enough to follow a drifting crystal. */
+#define PCM_ASRC_LOOP_HZ 0.05
+#define PCM_ASRC_LOOP_DAMPING 0.7
+
+/* The largest correction of the ratio, as a fraction */
+#define PCM_ASRC_MAX_CORRECTION 1e-3
+
+/* The drift estimates of the bridged PCMs are only used once they are
+ * known to within this many ppm */
+#define PCM_ASRC_MAX_DRIFT_ERROR 5.0
+
+#define PCM_ASRC_PI 3.14159265358979323846
+
+/* Four floats, mapped onto SSE or NEON registers by the compiler */
+typedef float pcm_asrc_vec __attribute__((vector_size(16)));
+
+/** A polyphase resampler whose ratio is trimmed to hold the fill level of
+ * its output at a target, optionally running between two PCMs.
+ * @ingroup libtinyalsa-asrc
+ */
+struct pcm_asrc {
+    /** The parameters given to @ref pcm_asrc_open */
+    struct pcm_asrc_config config;
+    /** Half of config.taps */
+    unsigned int half;
+    /** The filter, (PCM_ASRC_PHASES + 1) rows of config.taps coefficients */
+    float *filter;
+    /** The coefficients for the current output frame */
+    float *coefs;
+    /** The queued input of each channel, as floats */
+    float **history;
+    /** The capacity of each history, in frames */
+    unsigned int capacity;
+    /** The number of frames in each history */
+    unsigned int filled;
+    /** The input time of the next output frame, in frames from the start of the history */
+    double position;
+    /** The input frames per output frame at the nominal rates */
+    double nominal_step;
+    /** The input frames per output frame after correction */
+    double step;
+    /** The proportional and integral gains of the loop */
+    double kp;
+    double ki;
+    /** The feed-forward part of the correction, see @ref pcm_asrc_set_drift */
+    double drift;
+    /** The integral part of the correction */
+    double integral;
+    /** The total correction of the ratio */
+    double correction;
+
+    /** The bridged PCMs, see @ref pcm_asrc_start */
+    struct pcm *capture;
+    struct pcm *playback;
+    /** The clock drift of each bridged PCM */
+    struct pcm_drift *capture_drift;
+    struct pcm_drift *playback_drift;
+    /** A period of captured frames */
+    void *in_buffer;
+    /** Resampled frames on their way to the playback PCM */
+    void *out_buffer;
+    /** The capacity of @ref out_buffer, in frames */
+    unsigned int out_frames;
+    /** The bridge thread */
+    pthread_t thread;
+    /** Whether @ref thread has been created */
+    int started;
+    /** Set when the thread must exit */
+    atomic_int stopping;
+    /** The reason why the thread exited, zero if it was stopped */
+    int error;
+    /** The number of times the playback PCM had to be restarted */
+    atomic_uint xruns;
+};
+
+static double pcm_asrc_bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    unsigned int k;
+
+    for (k = 1; term > sum * 1e-12; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/* Builds a Kaiser windowed sinc, sampled at PCM_ASRC_PHASES + 1 fractional
+ * delays between zero and one input frame. Each row is normalized to unity
+ * gain at DC. */
+static void pcm_asrc_build_filter(struct pcm_asrc *asrc)
+{
+    unsigned int taps = asrc->config.taps;
+    double cutoff = PCM_ASRC_CUTOFF;
+    double x, w, window, sinc, sum;
+    unsigned int phase, k;
+    float *row;
+
+    if (asrc->config.out_rate < asrc->config.in_rate)
+        cutoff *= (double)asrc->config.out_rate / asrc->config.in_rate;
+
+    for (phase = 0; phase <= PCM_ASRC_PHASES; phase++) {
+        row = asrc->filter + phase * taps;
+        sum = 0.0;
+        for (k = 0; k < taps; k++) {
+            /* the distance from the output frame to input frame k */
+            x = (double)asrc->half - 1 - k + (double)phase / PCM_ASRC_PHASES;
+            w = x / asrc->half;
+            window = (w * w < 1.0) ?
+                pcm_asrc_bessel_i0(PCM_ASRC_KAISER_BETA * sqrt(1.0 - w * w)) /
+                pcm_asrc_bessel_i0(PCM_ASRC_KAISER_BETA) : 0.0;
+            sinc = (x == 0.0) ? 1.0 :
+                sin(PCM_ASRC_PI * cutoff * x) / (PCM_ASRC_PI * cutoff * x);
+            row[k] = cutoff * sinc * window;
+            sum += row[k];
+        }
+        for (k = 0; k < taps; k++)
+            row[k] /= sum;
+    }
+}
+
+/** Creates a sample rate converter.
+ * @param config The parameters of the converter.
+ * @returns A converter on success, NULL on failure.
+ * @ingroup libtinyalsa-asrc
+ */
+struct pcm_asrc *pcm_asrc_open(const struct pcm_asrc_config *config)
+{
+    struct pcm_asrc *asrc;
+    double omega;
+    unsigned int ch;
+
+    if (!config || !config->channels || !config->in_rate || !config->out_rate)
+        return NULL;
+    switch (config->format) {
+    case PCM_FORMAT_S16_LE:
+    case PCM_FORMAT_S24_LE:
+    case PCM_FORMAT_S32_LE:
+    case PCM_FORMAT_FLOAT_LE:
+        break;
+    default:
+        return NULL;
+    }
+
+    asrc = calloc(1, sizeof(*asrc));
+    if (!asrc)
+        return NULL;
+
+    asrc->config = *config;
+    atomic_init(&asrc->stopping, 0);
+    atomic_init(&asrc->xruns, 0);
+    if (asrc->config.taps == 0)
+        asrc->config.taps = 32;
+    asrc->config.taps = (asrc->config.taps + 7) & ~7u;
+    if (asrc->config.max_frames == 0)
+        asrc->config.max_frames = 4096;
+    asrc->half = asrc->config.taps / 2;
+    asrc->capacity = asrc->config.taps + asrc->config.max_frames;
+
+    asrc->filter = calloc((PCM_ASRC_PHASES + 1) * asrc->config.taps, sizeof(float));
+    asrc->coefs = calloc(asrc->config.taps, sizeof(float));
+    asrc->history = calloc(config->channels, sizeof(*asrc->history));
+    if (!asrc->filter || !asrc->coefs || !asrc->history) {
+        pcm_asrc_close(asrc);
+        return NULL;
+    }
+    for (ch = 0; ch < config->channels; ch++) {
+        asrc->history[ch] = calloc(asrc->capacity, sizeof(float));
+        if (!asrc->history[ch]) {
+            pcm_asrc_close(asrc);
+            return NULL;
+        }
+    }
+
+    pcm_asrc_build_filter(asrc);
+
+    /* start with half a filter of silence, so the first output frame
+     * lines up with the first input frame */
+    asrc->filled = asrc->half;
+    asrc->position = asrc->half;
+    asrc->nominal_step = (double)config->in_rate / config->out_rate;
+    asrc->step = asrc->nominal_step;
+
+    /* the fill level integrates the ratio error, so with the PI controller
+     * of pcm_asrc_update the loop is of second order with these parameters */
+    omega = 2.0 * PCM_ASRC_PI * PCM_ASRC_LOOP_HZ;
+    asrc->kp = 2.0 * PCM_ASRC_LOOP_DAMPING * omega / config->out_rate;
+    asrc->ki = omega * omega / config->out_rate;
+
+    return asrc;
+}
+
+/** Frees a sample rate converter, stopping its bridge first.
+ * @param asrc A converter, may be NULL.
+ * @ingroup libtinyalsa-asrc
+ */
+void pcm_asrc_close(struct pcm_asrc *asrc)
+{
+    unsigned int ch;
+
+    if (!asrc)
+        return;
+
+    pcm_asrc_stop(asrc);
+    if (asrc->history) {
+        for (ch = 0; ch < asrc->config.channels; ch++)
+            free(asrc->history[ch]);
+    }
+    free(asrc->history);
+    free(asrc->coefs);
+    free(asrc->filter);
+    free(asrc);
+}
+
+/** Queues input frames of a converter.
+ * @param asrc A converter.
+ * @param data Interleaved frames in the format of the converter.
+ * @param frames The number of frames at @p data.
+ * @returns The number of frames queued,
+ *  which is less than @p frames if the queue is full.
+ * @ingroup libtinyalsa-asrc
+ */
+unsigned int pcm_asrc_write(struct pcm_asrc *asrc, const void *data, unsigned int frames)
+{
+    unsigned int channels = asrc->config.channels;
+    unsigned int ch, n;
+    float *dst;
+
+    if (frames > asrc->capacity - asrc->filled)
+        frames = asrc->capacity - asrc->filled;
+
+    for (ch = 0; ch < channels; ch++) {
+        dst = asrc->history[ch] + asrc->filled;
+        switch (asrc->config.format) {
+        case PCM_FORMAT_S16_LE: {
+            const int16_t *src = (const int16_t *)data + ch;
+            for (n = 0; n < frames; n++)
+                dst[n] = src[n * channels] * (1.0f / 32768.0f);
+            break;
+        }
+        case PCM_FORMAT_S24_LE: {
+            const int32_t *src = (const int32_t *)data + ch;
+            for (n = 0; n < frames; n++)
+                dst[n] = (int32_t)((uint32_t)src[n * channels] << 8) *
+                         (1.0f / 2147483648.0f);
+            break;
+        }
+        case PCM_FORMAT_FLOAT_LE: {
+            const float *src = (const float *)data + ch;
+            for (n = 0; n < frames; n++)
+                dst[n] = src[n * channels];
+            break;
+        }
+        default: {
+            const int32_t *src = (const int32_t *)data + ch;
+            for (n = 0; n < frames; n++)
+                dst[n] = src[n * channels] * (1.0f / 2147483648.0f);
+            break;
+        }
+        }
+    }
+
+    asrc->filled += frames;
+    return frames;
+}
+
+/* Interpolates the coefficients for an output frame between two phases */
+static void pcm_asrc_interpolate(const float *row0, const float *row1, float frac,
+                                 float *coefs, unsigned int taps)
+{
+    pcm_asrc_vec a, b;
+    unsigned int k;
+
+    for (k = 0; k < taps; k += 4) {
+        memcpy(&a, row0 + k, sizeof(a));
+        memcpy(&b, row1 + k, sizeof(b));
+        a += (b - a) * frac;
+        memcpy(coefs + k, &a, sizeof(a));
+    }
+}
+
+static float pcm_asrc_dot(const float *x, const float *coefs, unsigned int taps)
+{
+    pcm_asrc_vec acc0 = { 0.0f, 0.0f, 0.0f, 0.0f };
+    pcm_asrc_vec acc1 = acc0;
+    pcm_asrc_vec a, b;
+    unsigned int k;
+
+    for (k = 0; k < taps; k += 8) {
+        memcpy(&a, x + k, sizeof(a));
+        memcpy(&b, coefs + k, sizeof(b));
+        acc0 += a * b;
+        memcpy(&a, x + k + 4, sizeof(a));
+        memcpy(&b, coefs + k + 4, sizeof(b));
+        acc1 += a * b;
+    }
+    acc0 += acc1;
+    return acc0[0] + acc0[1] + acc0[2] + acc0[3];
+}
+
+static void pcm_asrc_store(const struct pcm_asrc *asrc, void *data, unsigned int index,
+                           float value)
+{
+    switch (asrc->config.format) {
+    case PCM_FORMAT_S16_LE:
+        value *= 32768.0f;
+        if (value > 32767.0f)
+            value = 32767.0f;
+        else if (value < -32768.0f)
+            value = -32768.0f;
+        ((int16_t *)data)[index] = lrintf(value);
+        break;
+    case PCM_FORMAT_S24_LE:
+        value *= 8388608.0f;
+        if (value > 8388607.0f)
+            value = 8388607.0f;
+        else if (value < -8388608.0f)
+            value = -8388608.0f;
+        ((int32_t *)data)[index] = lrintf(value);
+        break;
+    case PCM_FORMAT_FLOAT_LE:
+        ((float *)data)[index] = value;
+        break;
+    default:
+        /* the largest float below 2^31 */
+        value *= 2147483648.0f;
+        if (value > 2147483520.0f)
+            value = 2147483520.0f;
+        else if (value < -2147483648.0f)
+            value = -2147483648.0f;
+        ((int32_t *)data)[index] = lrintf(value);
+        break;
+    }
+}
+
+/** Produces resampled frames from the queued input of a converter.
+ * Each output frame costs a fixed number of operations, set by the
+ * filter length.
+ * @param asrc A converter.
+ * @param data Receives interleaved frames in the format of the converter.
+ * @param frames The number of frames that fit at @p data.
+ * @returns The number of frames produced,
+ *  which is less than @p frames if the queued input runs out.
+ * @ingroup libtinyalsa-asrc
+ */
+unsigned int pcm_asrc_read(struct pcm_asrc *asrc, void *data, unsigned int frames)
+{
+    unsigned int channels = asrc->config.channels;
+    unsigned int taps = asrc->config.taps;
+    unsigned int produced, index, phase, base, drop, ch;
+    double offset;
+    float frac;
+
+    for (produced = 0; produced < frames; produced++) {
+        index = (unsigned int)asrc->position;
+        if (index + asrc->half >= asrc->filled)
+            break;
+
+        offset = (asrc->position - index) * PCM_ASRC_PHASES;
+        phase = (unsigned int)offset;
+        frac = offset - phase;
+        pcm_asrc_interpolate(asrc->filter + phase * taps, asrc->filter + (phase + 1) * taps,
+                             frac, asrc->coefs, taps);
+
+        base = index + 1 - asrc->half;
+        for (ch = 0; ch < channels; ch++)
+            pcm_asrc_store(asrc, data, produced * channels + ch,
+                           pcm_asrc_dot(asrc->history[ch] + base, asrc->coefs, taps));
+
+        asrc->position += asrc->step;
+    }
+
+    /* drop the input that no later output frame reaches back to */
+    drop = (unsigned int)asrc->position + 1 - asrc->half;
+    if (drop > asrc->filled)
+        drop = asrc->filled;
+    if (drop > 0) {
+        for (ch = 0; ch < channels; ch++)
+            memmove(asrc->history[ch], asrc->history[ch] + drop,
+                    (asrc->filled - drop) * sizeof(float));
+        asrc->filled -= drop;
+        asrc->position -= drop;
+    }
+
+    return produced;
+}
+
+/** Sets the known clock drift between the input and the output of a converter.
+ * It is applied to the ratio straight away, so that the fill level loop only
+ * has to correct what is left. The loop alone converges without it.
+ * @param asrc A converter.
+ * @param ppm How much faster the input clock runs than the output clock,
+ *  in parts per million.
+ * @ingroup libtinyalsa-asrc
+ */
+void pcm_asrc_set_drift(struct pcm_asrc *asrc, double ppm)
+{
+    double drift = ppm * 1e-6;
+
+    /* move the change out of the integral, so the ratio does not jump */
+    asrc->integral -= drift - asrc->drift;
+    asrc->drift = drift;
+}
+
+/** Trims the ratio of a converter from the fill level of its output.
+ * This is called regularly, e.g. once per period, with the number of output
+ * frames queued downstream, for a playback PCM its delay.
+ * A proportional-integral loop moves the ratio so that the fill level settles
+ * at the target of the converter.
+ * @param asrc A converter.
+ * @param fill The number of output frames that are queued.
+ * @param seconds The time since the last update.
+ * @ingroup libtinyalsa-asrc
+ */
+void pcm_asrc_update(struct pcm_asrc *asrc, long fill, double seconds)
+{
+    double error = (double)fill - asrc->config.target;
+    double integral = asrc->integral + asrc->ki * error * seconds;
+    double correction = asrc->drift + asrc->kp * error + integral;
+
+    /* the integral is held while the correction is clamped */
+    if (correction > PCM_ASRC_MAX_CORRECTION)
+        correction = PCM_ASRC_MAX_CORRECTION;
+    else if (correction < -PCM_ASRC_MAX_CORRECTION)
+        correction = -PCM_ASRC_MAX_CORRECTION;
+    else
+        asrc->integral = integral;
+
+    asrc->correction = correction;
+    asrc->step = asrc->nominal_step * (1.0 + correction);
+}
+
+/** Gets the current correction of the ratio of a converter.
+ * Once the loop has settled, this is the drift between the input clock
+ * and the output clock.
+ * @param asrc A converter.
+ * @returns How many more input frames than nominal are consumed per output frame,
+ *  in parts per million.
+ * @ingroup libtinyalsa-asrc
+ */
+double pcm_asrc_get_ppm(const struct pcm_asrc *asrc)
+{
+    return asrc->correction * 1e6;
+}
+
+/* Writes silence to the playback PCM up to the target and starts it */
+static int pcm_asrc_prime(struct pcm_asrc *asrc)
+{
+    struct pcm_iovec segment;
+    struct pcm_status status;
+    unsigned int frames;
+    int ret;
+
+    ret = pcm_get_status(asrc->playback, PCM_AUDIO_TSTAMP_TYPE_DEFAULT, &status);
+    if (ret < 0)
+        return ret;
+
+    memset(asrc->out_buffer, 0, pcm_frames_to_bytes(asrc->playback, asrc->out_frames));
+    if (status.state != PCM_STATE_PREPARED && status.state != PCM_STATE_RUNNING)
+        status.delay = 0;
+    while (status.delay < (long)asrc->config.target) {
+        frames = asrc->config.target - status.delay;
+        if (frames > asrc->out_frames)
+            frames = asrc->out_frames;
+        segment.base = asrc->out_buffer;
+        segment.frames = frames;
+        ret = pcm_writev(asrc->playback, &segment, 1);
+        if (ret < 0)
+            return ret;
+        status.delay += ret;
+    }
+
+    if (pcm_state(asrc->playback) == PCM_STATE_PREPARED && pcm_start(asrc->playback) < 0)
+        return -EIO;
+
+    pcm_drift_reset(asrc->playback_drift);
+    return 0;
+}
+
+/* Resamples the queued input and writes it to the playback PCM */
+static int pcm_asrc_flush(struct pcm_asrc *asrc)
+{
+    struct pcm_iovec segment;
+    int ret;
+
+    segment.base = asrc->out_buffer;
+    while ((segment.frames = pcm_asrc_read(asrc, asrc->out_buffer, asrc->out_frames)) > 0) {
+        ret = pcm_writev(asrc->playback, &segment, 1);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static void *pcm_asrc_thread(void *arg)
+{
+    struct pcm_asrc *asrc = arg;
+    const struct pcm_config *config = pcm_get_config(asrc->capture);
+    double capture_ppm, capture_error, playback_ppm, playback_error;
+    struct pcm_iovec segment;
+    struct pcm_status status;
+    unsigned int frames, offset;
+    int ret;
+
+    ret = pcm_asrc_prime(asrc);
+    while (ret >= 0 && !atomic_load_explicit(&asrc->stopping, memory_order_relaxed)) {
+        segment.base = asrc->in_buffer;
+        segment.frames = config->period_size;
+        ret = pcm_readv(asrc->capture, &segment, 1);
+        if (ret < 0)
+            break;
+        frames = ret;
+
+        for (offset = 0; offset < frames && ret >= 0; ) {
+            offset += pcm_asrc_write(asrc, (char *)asrc->in_buffer +
+                                     pcm_frames_to_bytes(asrc->capture, offset),
+                                     frames - offset);
+            ret = pcm_asrc_flush(asrc);
+        }
+        if (ret < 0)
+            break;
+
+        ret = pcm_get_status(asrc->playback, PCM_AUDIO_TSTAMP_TYPE_DEFAULT, &status);
+        if (ret < 0)
+            break;
+        if (status.state != PCM_STATE_RUNNING) {
+            atomic_fetch_add_explicit(&asrc->xruns, 1, memory_order_relaxed);
+            ret = pcm_asrc_prime(asrc);
+            continue;
+        }
+
+        pcm_drift_update(asrc->capture_drift, asrc->capture);
+        pcm_drift_add(asrc->playback_drift, status.hw_ptr, &status.tstamp);
+        if (pcm_drift_get_ppm(asrc->capture_drift, &capture_ppm, &capture_error) == 0 &&
+            pcm_drift_get_ppm(asrc->playback_drift, &playback_ppm, &playback_error) == 0 &&
+            capture_error < PCM_ASRC_MAX_DRIFT_ERROR &&
+            playback_error < PCM_ASRC_MAX_DRIFT_ERROR)
+            pcm_asrc_set_drift(asrc, capture_ppm - playback_ppm);
+
+        pcm_asrc_update(asrc, status.delay, (double)frames / asrc->config.in_rate);
+    }
+
+    if (ret < 0)
+        asrc->error = ret;
+    pcm_stop(asrc->capture);
+    pcm_stop(asrc->playback);
+    return NULL;
+}
+
+/** Starts a thread that captures from one PCM, resamples, and plays to another.
+ * The playback PCM is first filled with silence up to the target of the
+ * converter. Then every captured period is resampled and written, and the
+ * ratio is trimmed from the delay of the playback PCM, so the latency stays
+ * constant however the two clocks drift. The drift of each PCM is also
+ * estimated from its timestamps and fed forward, see @ref pcm_asrc_set_drift;
+ * this needs both PCMs opened with the same timestamp clock, e.g. both with
+ * @ref PCM_MONOTONIC.
+ * If the playback PCM underruns, it is filled and started again.
+ * @param asrc A converter whose parameters match both PCMs.
+ * @param capture A capture PCM.
+ * @param playback A playback PCM.
+ *  Neither may be opened with @ref PCM_NONBLOCK or @ref PCM_NONINTERLEAVED,
+ *  and neither may be used by the application while the bridge runs.
+ * @param priority The SCHED_FIFO priority of the thread.
+ *  Zero leaves the thread with the default scheduling policy.
+ * @returns On success, zero.
+ *  On failure, a negative errno value.
+ * @ingroup libtinyalsa-asrc
+ */
+int pcm_asrc_start(struct pcm_asrc *asrc, struct pcm *capture, struct pcm *playback,
+                   int priority)
+{
+    const struct pcm_config *config;
+    pthread_attr_t attr;
+    unsigned int excluded = PCM_NONBLOCK | PCM_NONINTERLEAVED;
+    int ret;
+
+    if (!asrc || !pcm_is_ready(capture) || !pcm_is_ready(playback))
+        return -EINVAL;
+    if (asrc->started)
+        return -EBUSY;
+    if (!(pcm_get_flags(capture) & PCM_IN) || (pcm_get_flags(playback) & PCM_IN))
+        return -EINVAL;
+    if ((pcm_get_flags(capture) & excluded) || (pcm_get_flags(playback) & excluded))
+        return -EINVAL;
+    if (pcm_get_channels(capture) != asrc->config.channels ||
+        pcm_get_channels(playback) != asrc->config.channels ||
+        pcm_get_format(capture) != asrc->config.format ||
+        pcm_get_format(playback) != asrc->config.format ||
+        pcm_get_rate(capture) != asrc->config.in_rate ||
+        pcm_get_rate(playback) != asrc->config.out_rate)
+        return -EINVAL;
+    if (asrc->config.target >= pcm_get_buffer_size(playback))
+        return -EINVAL;
+
+    config = pcm_get_config(capture);
+    asrc->capture = capture;
+    asrc->playback = playback;
+    asrc->out_frames = (unsigned long long)config->period_size * asrc->config.out_rate /
+                       asrc->config.in_rate + 64;
+
+    asrc->capture_drift = pcm_drift_open(asrc->config.in_rate, 0);
+    asrc->playback_drift = pcm_drift_open(asrc->config.out_rate, 0);
+    if (asrc->playback_drift)
+        pcm_drift_set_boundary(asrc->playback_drift, pcm_get_boundary(playback));
+    asrc->in_buffer = malloc(pcm_frames_to_bytes(capture, config->period_size));
+    asrc->out_buffer = malloc(pcm_frames_to_bytes(playback, asrc->out_frames));
+    if (!asrc->capture_drift || !asrc->playback_drift ||
+        !asrc->in_buffer || !asrc->out_buffer) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    atomic_store_explicit(&asrc->stopping, 0, memory_order_relaxed);
+    asrc->error = 0;
+    atomic_store_explicit(&asrc->xruns, 0, memory_order_relaxed);
+
+    pcm_thread_attr_init(&attr, priority);
+    ret = -pthread_create(&asrc->thread, &attr, pcm_asrc_thread, asrc);
+    pthread_attr_destroy(&attr);
+    if (ret < 0)
+        goto fail;
+
+    asrc->started = 1;
+    return 0;
+
+fail:
+    pcm_drift_close(asrc->capture_drift);
+    pcm_drift_close(asrc->playback_drift);
+    free(asrc->in_buffer);
+    free(asrc->out_buffer);
+    asrc->capture_drift = NULL;
+    asrc->playback_drift = NULL;
+    asrc->in_buffer = NULL;
+    asrc->out_buffer = NULL;
+    return ret;
+}
+
+/** Stops the bridge thread of a converter and waits for it to exit.
+ * Both PCMs are stopped.
+ * @param asrc A converter.
+ * @returns Zero if the bridge was running normally,
+ *  otherwise the negative errno value of the error that stopped it.
+ * @ingroup libtinyalsa-asrc
+ */
+int pcm_asrc_stop(struct pcm_asrc *asrc)
+{
+    if (!asrc)
+        return -EINVAL;
+    if (!asrc->started)
+        return 0;
+
+    atomic_store_explicit(&asrc->stopping, 1, memory_order_relaxed);
+    pthread_join(asrc->thread, NULL);
+    asrc->started = 0;
+
+    pcm_drift_close(asrc->capture_drift);
+    pcm_drift_close(asrc->playback_drift);
+    free(asrc->in_buffer);
+    free(asrc->out_buffer);
+    asrc->capture_drift = NULL;
+    asrc->playback_drift = NULL;
+    asrc->in_buffer = NULL;
+    asrc->out_buffer = NULL;
+
+    return asrc->error;
+}
+
+/** Gets the number of times that the bridge of a converter restarted
+ * the playback PCM after an underrun.
+ * @param asrc A converter.
+ * @returns The number of xruns since the bridge was started.
+ * @ingroup libtinyalsa-asrc
+ */
+unsigned int pcm_asrc_get_xruns(const struct pcm_asrc *asrc)
+{
+    return atomic_load_explicit(&asrc->xruns, memory_order_relaxed);
+}
+
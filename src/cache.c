@@ -0,0 +1,460 @@
+/* cache.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/ioctl.h>
+#define __force
+#define __bitwise
+#define __user
+#include <sound/asound.h>
+
+#include <tinyalsa/pcm.h>
+
+#define PCM_PARAMS_CACHE_MAGIC 0x43504154 /* "TAPC" */
+#define PCM_PARAMS_CACHE_VERSION 1
+
+#define PCM_PARAMS_CACHE_MASKS \
+    (SNDRV_PCM_HW_PARAM_LAST_MASK - SNDRV_PCM_HW_PARAM_FIRST_MASK + 1)
+#define PCM_PARAMS_CACHE_INTERVALS \
+    (SNDRV_PCM_HW_PARAM_LAST_INTERVAL - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL + 1)
+#define PCM_PARAMS_CACHE_MASK_WORDS ((SNDRV_MASK_MAX + 31) / 32)
+
+#define PCM_PARAMS_CACHE_OPENMIN 0x1
+#define PCM_PARAMS_CACHE_OPENMAX 0x2
+#define PCM_PARAMS_CACHE_INTEGER 0x4
+#define PCM_PARAMS_CACHE_EMPTY   0x8
+
+/* The start of a cache file */
+struct pcm_params_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    /* The size of an entry, so that a file written with other kernel headers is ignored */
+    uint32_t entry_size;
+    uint32_t count;
+};
+
+struct pcm_params_cache_interval {
+    uint32_t min;
+    uint32_t max;
+    uint32_t flags;
+};
+
+/* The refined hardware parameters of one direction of one device, without
+ * the reserved space of struct snd_pcm_hw_params */
+struct pcm_params_cache_entry {
+    uint32_t card;
+    uint32_t device;
+    /* Zero for playback, one for capture */
+    uint32_t capture;
+    /* The card that the parameters were read from, see SNDRV_CTL_IOCTL_CARD_INFO */
+    char id[16];
+    char driver[16];
+    uint32_t info;
+    uint32_t msbits;
+    uint32_t rate_num;
+    uint32_t rate_den;
+    uint32_t fifo_size;
+    uint32_t masks[PCM_PARAMS_CACHE_MASKS][PCM_PARAMS_CACHE_MASK_WORDS];
+    struct pcm_params_cache_interval intervals[PCM_PARAMS_CACHE_INTERVALS];
+};
+
+/** A cache of the hardware parameters of PCMs, kept in a file.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_params_cache {
+    /** The file that the cache is loaded from and saved to */
+    char *path;
+    /** The file mapped into memory, or NULL if there was no valid file */
+    void *map;
+    size_t map_size;
+    /** The entries of the file */
+    const struct pcm_params_cache_entry *entries;
+    unsigned int count;
+    /** Entries probed since the file was loaded, which take precedence over it */
+    struct pcm_params_cache_entry *added;
+    unsigned int added_count;
+    unsigned int added_capacity;
+    pthread_mutex_t lock;
+};
+
+/** Opens a cache of PCM hardware parameters.
+ * The file is mapped into memory and its entries are used as they are,
+ * until they are found to be stale.
+ * A missing or invalid file gives an empty cache.
+ * @param path The file that the cache is loaded from, and saved to by
+ *  @ref pcm_params_cache_close.
+ * @returns A cache on success, NULL if memory could not be allocated.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_params_cache *pcm_params_cache_open(const char *path)
+{
+    struct pcm_params_cache_header header;
+    struct pcm_params_cache *cache;
+    struct stat st;
+    int fd;
+
+    if (!path)
+        return NULL;
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+    cache->path = strdup(path);
+    if (!cache->path) {
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return cache;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header)) {
+        close(fd);
+        return cache;
+    }
+
+    cache->map_size = st.st_size;
+    cache->map = mmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache->map == MAP_FAILED) {
+        cache->map = NULL;
+        return cache;
+    }
+
+    memcpy(&header, cache->map, sizeof(header));
+    if (header.magic != PCM_PARAMS_CACHE_MAGIC ||
+        header.version != PCM_PARAMS_CACHE_VERSION ||
+        header.entry_size != sizeof(struct pcm_params_cache_entry) ||
+        header.count > (cache->map_size - sizeof(header)) / sizeof(struct pcm_params_cache_entry)) {
+        munmap(cache->map, cache->map_size);
+        cache->map = NULL;
+        return cache;
+    }
+
+    cache->entries = (const struct pcm_params_cache_entry *)
+                     ((const char *)cache->map + sizeof(header));
+    cache->count = header.count;
+    return cache;
+}
+
+/* Gets the id and driver of a card, which change if another card takes
+ * its number or its driver is updated */
+static int pcm_params_cache_card_info(unsigned int card, struct snd_ctl_card_info *info)
+{
+    char fn[256];
+    int fd, ret;
+
+    snprintf(fn, sizeof(fn), "/dev/snd/controlC%u", card);
+    fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    memset(info, 0, sizeof(*info));
+    ret = ioctl(fd, SNDRV_CTL_IOCTL_CARD_INFO, info);
+    if (ret < 0)
+        ret = -errno;
+    close(fd);
+    return ret;
+}
+
+static int pcm_params_cache_matches(const struct pcm_params_cache_entry *entry,
+                                    unsigned int card, unsigned int device,
+                                    unsigned int capture)
+{
+    return entry->card == card && entry->device == device && entry->capture == capture;
+}
+
+static int pcm_params_cache_is_current(const struct pcm_params_cache_entry *entry,
+                                       const struct snd_ctl_card_info *info)
+{
+    return strncmp(entry->id, (const char *)info->id, sizeof(entry->id)) == 0 &&
+           strncmp(entry->driver, (const char *)info->driver, sizeof(entry->driver)) == 0;
+}
+
+static struct pcm_params *pcm_params_cache_expand(const struct pcm_params_cache_entry *entry)
+{
+    struct snd_pcm_hw_params *params;
+    unsigned int n;
+
+    params = calloc(1, sizeof(*params));
+    if (!params)
+        return NULL;
+
+    for (n = 0; n < PCM_PARAMS_CACHE_MASKS; n++)
+        memcpy(params->masks[n].bits, entry->masks[n], sizeof(entry->masks[n]));
+    for (n = 0; n < PCM_PARAMS_CACHE_INTERVALS; n++) {
+        const struct pcm_params_cache_interval *interval = &entry->intervals[n];
+        params->intervals[n].min = interval->min;
+        params->intervals[n].max = interval->max;
+        params->intervals[n].openmin = !!(interval->flags & PCM_PARAMS_CACHE_OPENMIN);
+        params->intervals[n].openmax = !!(interval->flags & PCM_PARAMS_CACHE_OPENMAX);
+        params->intervals[n].integer = !!(interval->flags & PCM_PARAMS_CACHE_INTEGER);
+        params->intervals[n].empty = !!(interval->flags & PCM_PARAMS_CACHE_EMPTY);
+    }
+    params->info = entry->info;
+    params->msbits = entry->msbits;
+    params->rate_num = entry->rate_num;
+    params->rate_den = entry->rate_den;
+    params->fifo_size = entry->fifo_size;
+
+    return (struct pcm_params *)params;
+}
+
+static void pcm_params_cache_compact(struct pcm_params_cache_entry *entry,
+                                     const struct pcm_params *pcm_params)
+{
+    const struct snd_pcm_hw_params *params = (const struct snd_pcm_hw_params *)pcm_params;
+    unsigned int n;
+
+    for (n = 0; n < PCM_PARAMS_CACHE_MASKS; n++)
+        memcpy(entry->masks[n], params->masks[n].bits, sizeof(entry->masks[n]));
+    for (n = 0; n < PCM_PARAMS_CACHE_INTERVALS; n++) {
+        const struct snd_interval *interval = &params->intervals[n];
+        entry->intervals[n].min = interval->min;
+        entry->intervals[n].max = interval->max;
+        entry->intervals[n].flags = (interval->openmin ? PCM_PARAMS_CACHE_OPENMIN : 0) |
+                                    (interval->openmax ? PCM_PARAMS_CACHE_OPENMAX : 0) |
+                                    (interval->integer ? PCM_PARAMS_CACHE_INTEGER : 0) |
+                                    (interval->empty ? PCM_PARAMS_CACHE_EMPTY : 0);
+    }
+    entry->info = params->info;
+    entry->msbits = params->msbits;
+    entry->rate_num = params->rate_num;
+    entry->rate_den = params->rate_den;
+    entry->fifo_size = params->fifo_size;
+}
+
+/* Adds or replaces the entry of a PCM, with the cache locked */
+static void pcm_params_cache_add(struct pcm_params_cache *cache,
+                                 const struct pcm_params_cache_entry *entry)
+{
+    struct pcm_params_cache_entry *added;
+    unsigned int n;
+
+    for (n = 0; n < cache->added_count; n++) {
+        if (pcm_params_cache_matches(&cache->added[n], entry->card, entry->device,
+                                     entry->capture)) {
+            cache->added[n] = *entry;
+            return;
+        }
+    }
+
+    if (cache->added_count == cache->added_capacity) {
+        unsigned int capacity = cache->added_capacity ? cache->added_capacity * 2 : 8;
+        added = realloc(cache->added, capacity * sizeof(*added));
+        if (!added)
+            return;
+        cache->added = added;
+        cache->added_capacity = capacity;
+    }
+    cache->added[cache->added_count++] = *entry;
+}
+
+/** Gets the hardware parameters of a PCM from a cache.
+ * The parameters are the same as those returned by @ref pcm_params_get,
+ * and are read with the same accessors.
+ * An entry is only used if the id and driver of the card are still those
+ * it was probed from, otherwise the PCM is probed again and the entry replaced.
+ * @param cache A cache returned by @ref pcm_params_cache_open.
+ * @param card The card of the PCM.
+ * @param device The device of the PCM.
+ * @param flags Specifies whether the PCM is an input or output.
+ *  May be one of the following:
+ *   - @ref PCM_IN
+ *   - @ref PCM_OUT
+ * @returns On success, the hardware parameters of the PCM, to be freed with
+ *  @ref pcm_params_free; on failure, NULL.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm_params *pcm_params_cache_get(struct pcm_params_cache *cache, unsigned int card,
+                                        unsigned int device, unsigned int flags)
+{
+    const struct pcm_params_cache_entry *entry = NULL;
+    struct pcm_params_cache_entry probed;
+    struct snd_ctl_card_info info;
+    struct pcm_params *params;
+    unsigned int capture = (flags & PCM_IN) ? 1 : 0;
+    unsigned int n;
+
+    if (!cache)
+        return pcm_params_get(card, device, flags);
+
+    /* without a card identity there is nothing to validate an entry against */
+    if (pcm_params_cache_card_info(card, &info) < 0)
+        return pcm_params_get(card, device, flags);
+
+    pthread_mutex_lock(&cache->lock);
+
+    for (n = 0; n < cache->added_count && !entry; n++) {
+        if (pcm_params_cache_matches(&cache->added[n], card, device, capture))
+            entry = &cache->added[n];
+    }
+    for (n = 0; n < cache->count && !entry; n++) {
+        if (pcm_params_cache_matches(&cache->entries[n], card, device, capture))
+            entry = &cache->entries[n];
+    }
+
+    if (entry && pcm_params_cache_is_current(entry, &info)) {
+        params = pcm_params_cache_expand(entry);
+        pthread_mutex_unlock(&cache->lock);
+        return params;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    params = pcm_params_get(card, device, flags);
+    if (!params)
+        return NULL;
+
+    memset(&probed, 0, sizeof(probed));
+    probed.card = card;
+    probed.device = device;
+    probed.capture = capture;
+    strncpy(probed.id, (const char *)info.id, sizeof(probed.id));
+    strncpy(probed.driver, (const char *)info.driver, sizeof(probed.driver));
+    pcm_params_cache_compact(&probed, params);
+
+    pthread_mutex_lock(&cache->lock);
+    pcm_params_cache_add(cache, &probed);
+    pthread_mutex_unlock(&cache->lock);
+
+    return params;
+}
+
+/* Writes the entries of the file that were not replaced, then the new ones,
+ * to a temporary file that is renamed over the old one */
+static int pcm_params_cache_save(struct pcm_params_cache *cache)
+{
+    struct pcm_params_cache_header header;
+    unsigned int n, m;
+    size_t size;
+    char *tmp;
+    FILE *file;
+    int fd, ret = 0;
+
+    size = strlen(cache->path) + 8;
+    tmp = malloc(size);
+    if (!tmp)
+        return -ENOMEM;
+    snprintf(tmp, size, "%s.XXXXXX", cache->path);
+
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        ret = -errno;
+        free(tmp);
+        return ret;
+    }
+    /* the cache is shared by every process that probes the cards */
+    fchmod(fd, 0644);
+    file = fdopen(fd, "wb");
+    if (!file) {
+        ret = -errno;
+        close(fd);
+        goto err;
+    }
+
+    header.magic = PCM_PARAMS_CACHE_MAGIC;
+    header.version = PCM_PARAMS_CACHE_VERSION;
+    header.entry_size = sizeof(struct pcm_params_cache_entry);
+    header.count = cache->added_count;
+    for (n = 0; n < cache->count; n++) {
+        for (m = 0; m < cache->added_count; m++) {
+            if (pcm_params_cache_matches(&cache->added[m], cache->entries[n].card,
+                                         cache->entries[n].device, cache->entries[n].capture))
+                break;
+        }
+        if (m == cache->added_count)
+            header.count++;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        ret = -EIO;
+    for (n = 0; n < cache->count && ret == 0; n++) {
+        for (m = 0; m < cache->added_count; m++) {
+            if (pcm_params_cache_matches(&cache->added[m], cache->entries[n].card,
+                                         cache->entries[n].device, cache->entries[n].capture))
+                break;
+        }
+        if (m == cache->added_count &&
+            fwrite(&cache->entries[n], sizeof(cache->entries[n]), 1, file) != 1)
+            ret = -EIO;
+    }
+    if (ret == 0 && cache->added_count &&
+        fwrite(cache->added, sizeof(*cache->added), cache->added_count, file) != cache->added_count)
+        ret = -EIO;
+
+    if (fclose(file) != 0 && ret == 0)
+        ret = -errno;
+    if (ret == 0 && rename(tmp, cache->path) < 0)
+        ret = -errno;
+
+err:
+    if (ret < 0)
+        unlink(tmp);
+    free(tmp);
+    return ret;
+}
+
+/** Closes a cache of PCM hardware parameters.
+ * If any PCM was probed since the cache was opened, the cache file is
+ * replaced with one that includes it.
+ * @param cache A cache returned by @ref pcm_params_cache_open, may be NULL.
+ * @returns Zero on success, a negative errno if the file could not be saved.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_params_cache_close(struct pcm_params_cache *cache)
+{
+    int ret = 0;
+
+    if (!cache)
+        return 0;
+
+    if (cache->added_count > 0)
+        ret = pcm_params_cache_save(cache);
+
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->added);
+    free(cache->path);
+    free(cache);
+    return ret;
+}
+
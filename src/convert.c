@@ -0,0 +1,935 @@
+/* convert.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <tinyalsa/convert.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCM_CONVERT_X86 1
+#endif
+
+/* vcvtnq_s32_f32, which rounds like lrintf, only exists on 64-bit ARM */
+#if defined(__aarch64__) && defined(__ARM_NEON) && \
+    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#include <arm_neon.h>
+#define PCM_CONVERT_NEON 1
+#endif
+
+/* The number of samples converted at a time by @ref pcm_convert */
+#define PCM_CONVERT_CHUNK 256
+
+/* The largest float below 2^31, the upper limit of a 32 bit sample */
+#define PCM_CONVERT_S32_MAX 2147483520.0f
+
+/** The kernels that convert one format.
+ * Integer samples are converted to and from int32, left justified.
+ * Floating point formats have no int32 kernels.
+ * @ingroup libtinyalsa-convert
+ */
+struct pcm_convert_kernel {
+    void (*to_float)(float *dst, const void *src, unsigned int samples);
+    void (*from_float)(void *dst, const float *src, unsigned int samples);
+    void (*to_s32)(int32_t *dst, const void *src, unsigned int samples);
+    void (*from_s32)(void *dst, const int32_t *src, unsigned int samples);
+};
+
+/* The kernels of each instruction set, filled in by pcm_convert_init() */
+static struct pcm_convert_kernel pcm_convert_tables[PCM_CONVERT_ISA_NEON + 1][PCM_FORMAT_MAX];
+
+/* The kernels in use */
+static const struct pcm_convert_kernel *pcm_convert_kernels;
+static enum pcm_convert_isa pcm_convert_isa;
+static pthread_once_t pcm_convert_once = PTHREAD_ONCE_INIT;
+
+/** The layout of the samples of a format.
+ * @ingroup libtinyalsa-convert
+ */
+struct pcm_convert_format {
+    /** The size of a sample in memory */
+    uint8_t bytes;
+    /** The number of significant bits, which are the low ones */
+    uint8_t bits;
+    uint8_t is_big_endian;
+    /** Whether zero is the most negative value rather than silence */
+    uint8_t is_unsigned;
+    uint8_t is_float;
+};
+
+/* Indexed with constants in the kernels, so the lookups fold away */
+static const struct pcm_convert_format pcm_convert_formats[PCM_FORMAT_MAX] = {
+    [PCM_FORMAT_S8] = { 1, 8, 0, 0, 0 },
+    [PCM_FORMAT_S16_LE] = { 2, 16, 0, 0, 0 },
+    [PCM_FORMAT_S16_BE] = { 2, 16, 1, 0, 0 },
+    [PCM_FORMAT_S24_LE] = { 4, 24, 0, 0, 0 },
+    [PCM_FORMAT_S24_BE] = { 4, 24, 1, 0, 0 },
+    [PCM_FORMAT_S24_3LE] = { 3, 24, 0, 0, 0 },
+    [PCM_FORMAT_S24_3BE] = { 3, 24, 1, 0, 0 },
+    [PCM_FORMAT_S32_LE] = { 4, 32, 0, 0, 0 },
+    [PCM_FORMAT_S32_BE] = { 4, 32, 1, 0, 0 },
+    [PCM_FORMAT_U8] = { 1, 8, 0, 1, 0 },
+    [PCM_FORMAT_U16_LE] = { 2, 16, 0, 1, 0 },
+    [PCM_FORMAT_U16_BE] = { 2, 16, 1, 1, 0 },
+    [PCM_FORMAT_U24_LE] = { 4, 24, 0, 1, 0 },
+    [PCM_FORMAT_U24_BE] = { 4, 24, 1, 1, 0 },
+    [PCM_FORMAT_U32_LE] = { 4, 32, 0, 1, 0 },
+    [PCM_FORMAT_U32_BE] = { 4, 32, 1, 1, 0 },
+    [PCM_FORMAT_FLOAT_LE] = { 4, 32, 0, 0, 1 },
+    [PCM_FORMAT_FLOAT_BE] = { 4, 32, 1, 0, 1 },
+    [PCM_FORMAT_FLOAT64_LE] = { 8, 64, 0, 0, 1 },
+    [PCM_FORMAT_FLOAT64_BE] = { 8, 64, 1, 0, 1 },
+    [PCM_FORMAT_S20_3LE] = { 3, 20, 0, 0, 0 },
+    [PCM_FORMAT_S20_3BE] = { 3, 20, 1, 0, 0 },
+    [PCM_FORMAT_S18_3LE] = { 3, 18, 0, 0, 0 },
+    [PCM_FORMAT_S18_3BE] = { 3, 18, 1, 0, 0 },
+};
+
+/* The number of significant bits of a sample */
+static inline unsigned int pcm_convert_bits(enum pcm_format format)
+{
+    return pcm_convert_formats[format].bits;
+}
+
+/* Reads the bytes of a sample into an integer */
+static inline uint64_t pcm_convert_read(const uint8_t *p, enum pcm_format format)
+{
+    const struct pcm_convert_format *f = &pcm_convert_formats[format];
+    uint64_t value = 0;
+    unsigned int i;
+
+    for (i = 0; i < f->bytes; i++)
+        value = (value << 8) | p[f->is_big_endian ? i : f->bytes - 1 - i];
+    return value;
+}
+
+/* Writes the low bytes of an integer as a sample */
+static inline void pcm_convert_write(uint8_t *p, enum pcm_format format, uint64_t value)
+{
+    const struct pcm_convert_format *f = &pcm_convert_formats[format];
+    unsigned int i;
+
+    for (i = 0; i < f->bytes; i++)
+        p[f->is_big_endian ? f->bytes - 1 - i : i] = value >> (8 * i);
+}
+
+/* Reads an integer sample, as signed and sign extended to 32 bits */
+static inline int32_t pcm_convert_load(const uint8_t *p, enum pcm_format format)
+{
+    unsigned int bits = pcm_convert_bits(format);
+    uint32_t value = (uint32_t) pcm_convert_read(p, format);
+
+    if (pcm_convert_formats[format].is_unsigned)
+        value ^= 1u << (bits - 1);
+    return (int32_t) (value << (32 - bits)) >> (32 - bits);
+}
+
+/* Writes an integer sample that is within the range of the format */
+static inline void pcm_convert_store(uint8_t *p, enum pcm_format format, int32_t sample)
+{
+    unsigned int bits = pcm_convert_bits(format);
+    uint32_t value = (uint32_t) sample;
+
+    if (pcm_convert_formats[format].is_unsigned)
+        value = (value ^ (1u << (bits - 1))) & (UINT32_MAX >> (32 - bits));
+    pcm_convert_write(p, format, value);
+}
+
+static inline float pcm_convert_load_float(const uint8_t *p, enum pcm_format format)
+{
+    uint64_t value = pcm_convert_read(p, format);
+    uint32_t value32 = (uint32_t) value;
+    double sample64;
+    float sample;
+
+    if (pcm_convert_formats[format].bytes == 8) {
+        memcpy(&sample64, &value, sizeof(sample64));
+        return (float) sample64;
+    }
+    memcpy(&sample, &value32, sizeof(sample));
+    return sample;
+}
+
+static inline void pcm_convert_store_float(uint8_t *p, enum pcm_format format, float sample)
+{
+    double sample64 = sample;
+    uint64_t value;
+    uint32_t value32;
+
+    if (pcm_convert_formats[format].bytes == 8) {
+        memcpy(&value, &sample64, sizeof(value));
+    } else {
+        memcpy(&value32, &sample, sizeof(value32));
+        value = value32;
+    }
+    pcm_convert_write(p, format, value);
+}
+
+/* The factor that maps a sample of @p bits bits to [-1, 1) */
+static inline float pcm_convert_scale(unsigned int bits)
+{
+    return 1.0f / (float) (1u << (bits - 1));
+}
+
+/* The largest float that converts to a sample of @p bits bits */
+static inline float pcm_convert_max(unsigned int bits)
+{
+    return bits == 32 ? PCM_CONVERT_S32_MAX : (float) ((1u << (bits - 1)) - 1);
+}
+
+/* Scales, clamps and rounds a float to a sample. The comparisons are the
+ * ones done by minps and maxps, so that the vector kernels match this to
+ * the bit. NaN has no defined result. */
+static inline int32_t pcm_convert_quantize(float value, float scale, float min, float max)
+{
+    value *= scale;
+    value = max < value ? max : value;
+    value = min > value ? min : value;
+    return (int32_t) lrintf(value);
+}
+
+static inline void pcm_convert_scalar_to_float(float *dst, const void *src,
+                                               unsigned int samples,
+                                               enum pcm_format format)
+{
+    const uint8_t *in = src;
+    unsigned int bytes = pcm_convert_formats[format].bytes;
+    float scale = pcm_convert_scale(pcm_convert_bits(format));
+    unsigned int n;
+
+    for (n = 0; n < samples; n++)
+        dst[n] = (float) pcm_convert_load(in + n * bytes, format) * scale;
+}
+
+static inline void pcm_convert_scalar_from_float(void *dst, const float *src,
+                                                 unsigned int samples,
+                                                 enum pcm_format format)
+{
+    uint8_t *out = dst;
+    unsigned int bits = pcm_convert_bits(format);
+    unsigned int bytes = pcm_convert_formats[format].bytes;
+    float scale = 1.0f / pcm_convert_scale(bits);
+    float min = -scale;
+    float max = pcm_convert_max(bits);
+    unsigned int n;
+
+    for (n = 0; n < samples; n++)
+        pcm_convert_store(out + n * bytes, format,
+                          pcm_convert_quantize(src[n], scale, min, max));
+}
+
+static inline void pcm_convert_scalar_to_s32(int32_t *dst, const void *src,
+                                             unsigned int samples,
+                                             enum pcm_format format)
+{
+    const uint8_t *in = src;
+    unsigned int bytes = pcm_convert_formats[format].bytes;
+    unsigned int shift = 32 - pcm_convert_bits(format);
+    unsigned int n;
+
+    for (n = 0; n < samples; n++)
+        dst[n] = (int32_t) ((uint32_t) pcm_convert_load(in + n * bytes, format) << shift);
+}
+
+static inline void pcm_convert_scalar_from_s32(void *dst, const int32_t *src,
+                                               unsigned int samples,
+                                               enum pcm_format format)
+{
+    uint8_t *out = dst;
+    unsigned int bytes = pcm_convert_formats[format].bytes;
+    unsigned int shift = 32 - pcm_convert_bits(format);
+    unsigned int n;
+
+    /* Narrowing truncates, like the linear plugin of alsa-lib */
+    for (n = 0; n < samples; n++)
+        pcm_convert_store(out + n * bytes, format, src[n] >> shift);
+}
+
+/* Floating point formats are only widened, narrowed or byte swapped */
+static inline void pcm_convert_scalar_float_to_float(float *dst, const void *src,
+                                                     unsigned int samples,
+                                                     enum pcm_format format)
+{
+    const uint8_t *in = src;
+    unsigned int bytes = pcm_convert_formats[format].bytes;
+    unsigned int n;
+
+    for (n = 0; n < samples; n++)
+        dst[n] = pcm_convert_load_float(in + n * bytes, format);
+}
+
+static inline void pcm_convert_scalar_float_from_float(void *dst, const float *src,
+                                                       unsigned int samples,
+                                                       enum pcm_format format)
+{
+    uint8_t *out = dst;
+    unsigned int bytes = pcm_convert_formats[format].bytes;
+    unsigned int n;
+
+    for (n = 0; n < samples; n++)
+        pcm_convert_store_float(out + n * bytes, format, src[n]);
+}
+
+/* Instantiates the scalar kernels of a format, so that the compiler can
+ * specialize the loads and stores */
+#define PCM_CONVERT_SCALAR(format) \
+static void pcm_convert_to_float_##format(float *dst, const void *src, \
+                                          unsigned int samples) \
+{ \
+    pcm_convert_scalar_to_float(dst, src, samples, PCM_FORMAT_##format); \
+} \
+static void pcm_convert_from_float_##format(void *dst, const float *src, \
+                                            unsigned int samples) \
+{ \
+    pcm_convert_scalar_from_float(dst, src, samples, PCM_FORMAT_##format); \
+} \
+static void pcm_convert_to_s32_##format(int32_t *dst, const void *src, \
+                                        unsigned int samples) \
+{ \
+    pcm_convert_scalar_to_s32(dst, src, samples, PCM_FORMAT_##format); \
+} \
+static void pcm_convert_from_s32_##format(void *dst, const int32_t *src, \
+                                          unsigned int samples) \
+{ \
+    pcm_convert_scalar_from_s32(dst, src, samples, PCM_FORMAT_##format); \
+}
+
+PCM_CONVERT_SCALAR(S8)
+PCM_CONVERT_SCALAR(S16_LE)
+PCM_CONVERT_SCALAR(S16_BE)
+PCM_CONVERT_SCALAR(S24_LE)
+PCM_CONVERT_SCALAR(S24_BE)
+PCM_CONVERT_SCALAR(S24_3LE)
+PCM_CONVERT_SCALAR(S24_3BE)
+PCM_CONVERT_SCALAR(S32_LE)
+PCM_CONVERT_SCALAR(S32_BE)
+PCM_CONVERT_SCALAR(U8)
+PCM_CONVERT_SCALAR(U16_LE)
+PCM_CONVERT_SCALAR(U16_BE)
+PCM_CONVERT_SCALAR(U24_LE)
+PCM_CONVERT_SCALAR(U24_BE)
+PCM_CONVERT_SCALAR(U32_LE)
+PCM_CONVERT_SCALAR(U32_BE)
+PCM_CONVERT_SCALAR(S20_3LE)
+PCM_CONVERT_SCALAR(S20_3BE)
+PCM_CONVERT_SCALAR(S18_3LE)
+PCM_CONVERT_SCALAR(S18_3BE)
+
+/* Floating point formats have no int32 kernels, so @ref pcm_convert goes
+ * through float for them */
+#define PCM_CONVERT_SCALAR_FLOAT(format) \
+static void pcm_convert_to_float_##format(float *dst, const void *src, \
+                                          unsigned int samples) \
+{ \
+    pcm_convert_scalar_float_to_float(dst, src, samples, PCM_FORMAT_##format); \
+} \
+static void pcm_convert_from_float_##format(void *dst, const float *src, \
+                                            unsigned int samples) \
+{ \
+    pcm_convert_scalar_float_from_float(dst, src, samples, PCM_FORMAT_##format); \
+}
+
+PCM_CONVERT_SCALAR_FLOAT(FLOAT_LE)
+PCM_CONVERT_SCALAR_FLOAT(FLOAT_BE)
+PCM_CONVERT_SCALAR_FLOAT(FLOAT64_LE)
+PCM_CONVERT_SCALAR_FLOAT(FLOAT64_BE)
+
+#define PCM_CONVERT_SCALAR_KERNEL(format) \
+    [PCM_FORMAT_##format] = { \
+        pcm_convert_to_float_##format, \
+        pcm_convert_from_float_##format, \
+        pcm_convert_to_s32_##format, \
+        pcm_convert_from_s32_##format, \
+    }
+
+#define PCM_CONVERT_SCALAR_FLOAT_KERNEL(format) \
+    [PCM_FORMAT_##format] = { \
+        pcm_convert_to_float_##format, \
+        pcm_convert_from_float_##format, \
+        NULL, \
+        NULL, \
+    }
+
+static const struct pcm_convert_kernel pcm_convert_scalar[PCM_FORMAT_MAX] = {
+    PCM_CONVERT_SCALAR_KERNEL(S8),
+    PCM_CONVERT_SCALAR_KERNEL(S16_LE),
+    PCM_CONVERT_SCALAR_KERNEL(S16_BE),
+    PCM_CONVERT_SCALAR_KERNEL(S24_LE),
+    PCM_CONVERT_SCALAR_KERNEL(S24_BE),
+    PCM_CONVERT_SCALAR_KERNEL(S24_3LE),
+    PCM_CONVERT_SCALAR_KERNEL(S24_3BE),
+    PCM_CONVERT_SCALAR_KERNEL(S32_LE),
+    PCM_CONVERT_SCALAR_KERNEL(S32_BE),
+    PCM_CONVERT_SCALAR_KERNEL(U8),
+    PCM_CONVERT_SCALAR_KERNEL(U16_LE),
+    PCM_CONVERT_SCALAR_KERNEL(U16_BE),
+    PCM_CONVERT_SCALAR_KERNEL(U24_LE),
+    PCM_CONVERT_SCALAR_KERNEL(U24_BE),
+    PCM_CONVERT_SCALAR_KERNEL(U32_LE),
+    PCM_CONVERT_SCALAR_KERNEL(U32_BE),
+    PCM_CONVERT_SCALAR_FLOAT_KERNEL(FLOAT_LE),
+    PCM_CONVERT_SCALAR_FLOAT_KERNEL(FLOAT_BE),
+    PCM_CONVERT_SCALAR_FLOAT_KERNEL(FLOAT64_LE),
+    PCM_CONVERT_SCALAR_FLOAT_KERNEL(FLOAT64_BE),
+    PCM_CONVERT_SCALAR_KERNEL(S20_3LE),
+    PCM_CONVERT_SCALAR_KERNEL(S20_3BE),
+    PCM_CONVERT_SCALAR_KERNEL(S18_3LE),
+    PCM_CONVERT_SCALAR_KERNEL(S18_3BE),
+};
+
+/* The vector kernels cover the native little endian formats. Each one
+ * leaves the samples that do not fill a vector to the scalar code, and
+ * rounds with the default rounding mode, as lrintf does. */
+
+#ifdef PCM_CONVERT_X86
+
+static __attribute__((target("sse2")))
+void pcm_convert_sse2_to_float_s16(float *dst, const void *src, unsigned int samples)
+{
+    const __m128i *in = src;
+    const __m128 scale = _mm_set1_ps(pcm_convert_scale(16));
+    unsigned int n;
+
+    for (n = 0; n + 8 <= samples; n += 8) {
+        __m128i v = _mm_loadu_si128(in++);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + n, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + n + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    pcm_convert_scalar_to_float(dst + n, (const int16_t *) src + n, samples - n,
+                                PCM_FORMAT_S16_LE);
+}
+
+static __attribute__((target("sse2")))
+void pcm_convert_sse2_from_float_s16(void *dst, const float *src, unsigned int samples)
+{
+    __m128i *out = dst;
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 min = _mm_set1_ps(-32768.0f);
+    const __m128 max = _mm_set1_ps(32767.0f);
+    unsigned int n;
+
+    for (n = 0; n + 8 <= samples; n += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + n), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + n + 4), scale);
+        a = _mm_max_ps(min, _mm_min_ps(max, a));
+        b = _mm_max_ps(min, _mm_min_ps(max, b));
+        _mm_storeu_si128(out++, _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    pcm_convert_scalar_from_float((int16_t *) dst + n, src + n, samples - n,
+                                  PCM_FORMAT_S16_LE);
+}
+
+/* S24_LE and S32_LE, which differ only in the number of bits used */
+static inline __attribute__((target("sse2")))
+void pcm_convert_sse2_to_float_32(float *dst, const void *src, unsigned int samples,
+                                  enum pcm_format format)
+{
+    const __m128i *in = src;
+    const int shift = 32 - pcm_convert_bits(format);
+    const __m128 scale = _mm_set1_ps(pcm_convert_scale(32 - shift));
+    unsigned int n;
+
+    for (n = 0; n + 4 <= samples; n += 4) {
+        __m128i v = _mm_loadu_si128(in++);
+        v = _mm_srai_epi32(_mm_slli_epi32(v, shift), shift);
+        _mm_storeu_ps(dst + n, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    pcm_convert_scalar_to_float(dst + n, (const int32_t *) src + n, samples - n, format);
+}
+
+static inline __attribute__((target("sse2")))
+void pcm_convert_sse2_from_float_32(void *dst, const float *src, unsigned int samples,
+                                    enum pcm_format format)
+{
+    __m128i *out = dst;
+    const unsigned int bits = pcm_convert_bits(format);
+    const __m128 scale = _mm_set1_ps(1.0f / pcm_convert_scale(bits));
+    const __m128 min = _mm_set1_ps(-1.0f / pcm_convert_scale(bits));
+    const __m128 max = _mm_set1_ps(pcm_convert_max(bits));
+    unsigned int n;
+
+    for (n = 0; n + 4 <= samples; n += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(src + n), scale);
+        v = _mm_max_ps(min, _mm_min_ps(max, v));
+        _mm_storeu_si128(out++, _mm_cvtps_epi32(v));
+    }
+    pcm_convert_scalar_from_float((int32_t *) dst + n, src + n, samples - n, format);
+}
+
+static __attribute__((target("sse2")))
+void pcm_convert_sse2_to_float_s24(float *dst, const void *src, unsigned int samples)
+{
+    pcm_convert_sse2_to_float_32(dst, src, samples, PCM_FORMAT_S24_LE);
+}
+
+static __attribute__((target("sse2")))
+void pcm_convert_sse2_from_float_s24(void *dst, const float *src, unsigned int samples)
+{
+    pcm_convert_sse2_from_float_32(dst, src, samples, PCM_FORMAT_S24_LE);
+}
+
+static __attribute__((target("sse2")))
+void pcm_convert_sse2_to_float_s32(float *dst, const void *src, unsigned int samples)
+{
+    pcm_convert_sse2_to_float_32(dst, src, samples, PCM_FORMAT_S32_LE);
+}
+
+static __attribute__((target("sse2")))
+void pcm_convert_sse2_from_float_s32(void *dst, const float *src, unsigned int samples)
+{
+    pcm_convert_sse2_from_float_32(dst, src, samples, PCM_FORMAT_S32_LE);
+}
+
+static __attribute__((target("avx2")))
+void pcm_convert_avx2_to_float_s16(float *dst, const void *src, unsigned int samples)
+{
+    const __m128i *in = src;
+    const __m256 scale = _mm256_set1_ps(pcm_convert_scale(16));
+    unsigned int n;
+
+    for (n = 0; n + 16 <= samples; n += 16) {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128(in++));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128(in++));
+        _mm256_storeu_ps(dst + n, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(dst + n + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    pcm_convert_scalar_to_float(dst + n, (const int16_t *) src + n, samples - n,
+                                PCM_FORMAT_S16_LE);
+}
+
+static __attribute__((target("avx2")))
+void pcm_convert_avx2_from_float_s16(void *dst, const float *src, unsigned int samples)
+{
+    __m256i *out = dst;
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 min = _mm256_set1_ps(-32768.0f);
+    const __m256 max = _mm256_set1_ps(32767.0f);
+    unsigned int n;
+
+    for (n = 0; n + 16 <= samples; n += 16) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + n), scale);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + n + 8), scale);
+        __m256i v;
+        a = _mm256_max_ps(min, _mm256_min_ps(max, a));
+        b = _mm256_max_ps(min, _mm256_min_ps(max, b));
+        /* packs works within each 128 bit lane, so put the lanes back in order */
+        v = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        _mm256_storeu_si256(out++, _mm256_permute4x64_epi64(v, 0xd8));
+    }
+    pcm_convert_scalar_from_float((int16_t *) dst + n, src + n, samples - n,
+                                  PCM_FORMAT_S16_LE);
+}
+
+static inline __attribute__((target("avx2")))
+void pcm_convert_avx2_to_float_32(float *dst, const void *src, unsigned int samples,
+                                  enum pcm_format format)
+{
+    const __m256i *in = src;
+    const int shift = 32 - pcm_convert_bits(format);
+    const __m256 scale = _mm256_set1_ps(pcm_convert_scale(32 - shift));
+    unsigned int n;
+
+    for (n = 0; n + 8 <= samples; n += 8) {
+        __m256i v = _mm256_loadu_si256(in++);
+        v = _mm256_srai_epi32(_mm256_slli_epi32(v, shift), shift);
+        _mm256_storeu_ps(dst + n, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    pcm_convert_scalar_to_float(dst + n, (const int32_t *) src + n, samples - n, format);
+}
+
+static inline __attribute__((target("avx2")))
+void pcm_convert_avx2_from_float_32(void *dst, const float *src, unsigned int samples,
+                                    enum pcm_format format)
+{
+    __m256i *out = dst;
+    const unsigned int bits = pcm_convert_bits(format);
+    const __m256 scale = _mm256_set1_ps(1.0f / pcm_convert_scale(bits));
+    const __m256 min = _mm256_set1_ps(-1.0f / pcm_convert_scale(bits));
+    const __m256 max = _mm256_set1_ps(pcm_convert_max(bits));
+    unsigned int n;
+
+    for (n = 0; n + 8 <= samples; n += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + n), scale);
+        v = _mm256_max_ps(min, _mm256_min_ps(max, v));
+        _mm256_storeu_si256(out++, _mm256_cvtps_epi32(v));
+    }
+    pcm_convert_scalar_from_float((int32_t *) dst + n, src + n, samples - n, format);
+}
+
+static __attribute__((target("avx2")))
+void pcm_convert_avx2_to_float_s24(float *dst, const void *src, unsigned int samples)
+{
+    pcm_convert_avx2_to_float_32(dst, src, samples, PCM_FORMAT_S24_LE);
+}
+
+static __attribute__((target("avx2")))
+void pcm_convert_avx2_from_float_s24(void *dst, const float *src, unsigned int samples)
+{
+    pcm_convert_avx2_from_float_32(dst, src, samples, PCM_FORMAT_S24_LE);
+}
+
+static __attribute__((target("avx2")))
+void pcm_convert_avx2_to_float_s32(float *dst, const void *src, unsigned int samples)
+{
+    pcm_convert_avx2_to_float_32(dst, src, samples, PCM_FORMAT_S32_LE);
+}
+
+static __attribute__((target("avx2")))
+void pcm_convert_avx2_from_float_s32(void *dst, const float *src, unsigned int samples)
+{
+    pcm_convert_avx2_from_float_32(dst, src, samples, PCM_FORMAT_S32_LE);
+}
+
+#endif /* PCM_CONVERT_X86 */
+
+#ifdef PCM_CONVERT_NEON
+
+static void pcm_convert_neon_to_float_s16(float *dst, const void *src, unsigned int samples)
+{
+    const uint8_t *in = src;
+    const float scale = pcm_convert_scale(16);
+    unsigned int n;
+
+    for (n = 0; n + 8 <= samples; n += 8) {
+        int16x8_t v = vreinterpretq_s16_u8(vld1q_u8(in + n * 2));
+        int32x4_t lo = vmovl_s16(vget_low_s16(v));
+        int32x4_t hi = vmovl_high_s16(v);
+        vst1q_f32(dst + n, vmulq_n_f32(vcvtq_f32_s32(lo), scale));
+        vst1q_f32(dst + n + 4, vmulq_n_f32(vcvtq_f32_s32(hi), scale));
+    }
+    pcm_convert_scalar_to_float(dst + n, in + n * 2, samples - n, PCM_FORMAT_S16_LE);
+}
+
+static void pcm_convert_neon_from_float_s16(void *dst, const float *src, unsigned int samples)
+{
+    uint8_t *out = dst;
+    const float32x4_t min = vdupq_n_f32(-32768.0f);
+    const float32x4_t max = vdupq_n_f32(32767.0f);
+    unsigned int n;
+
+    for (n = 0; n + 8 <= samples; n += 8) {
+        float32x4_t a = vmulq_n_f32(vld1q_f32(src + n), 32768.0f);
+        float32x4_t b = vmulq_n_f32(vld1q_f32(src + n + 4), 32768.0f);
+        int16x8_t v;
+        a = vmaxq_f32(vminq_f32(a, max), min);
+        b = vmaxq_f32(vminq_f32(b, max), min);
+        v = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)), vqmovn_s32(vcvtnq_s32_f32(b)));
+        vst1q_u8(out + n * 2, vreinterpretq_u8_s16(v));
+    }
+    pcm_convert_scalar_from_float(out + n * 2, src + n, samples - n, PCM_FORMAT_S16_LE);
+}
+
+static inline void pcm_convert_neon_to_float_32(float *dst, const void *src,
+                                                unsigned int samples,
+                                                enum pcm_format format)
+{
+    const uint8_t *in = src;
+    const int shift = 32 - pcm_convert_bits(format);
+    const int32x4_t left = vdupq_n_s32(shift);
+    const int32x4_t right = vdupq_n_s32(-shift);
+    const float scale = pcm_convert_scale(32 - shift);
+    unsigned int n;
+
+    for (n = 0; n + 4 <= samples; n += 4) {
+        int32x4_t v = vreinterpretq_s32_u8(vld1q_u8(in + n * 4));
+        v = vshlq_s32(vshlq_s32(v, left), right);
+        vst1q_f32(dst + n, vmulq_n_f32(vcvtq_f32_s32(v), scale));
+    }
+    pcm_convert_scalar_to_float(dst + n, in + n * 4, samples - n, format);
+}
+
+static inline void pcm_convert_neon_from_float_32(void *dst, const float *src,
+                                                  unsigned int samples,
+                                                  enum pcm_format format)
+{
+    uint8_t *out = dst;
+    const unsigned int bits = pcm_convert_bits(format);
+    const float scale = 1.0f / pcm_convert_scale(bits);
+    const float32x4_t min = vdupq_n_f32(-scale);
+    const float32x4_t max = vdupq_n_f32(pcm_convert_max(bits));
+    unsigned int n;
+
+    for (n = 0; n + 4 <= samples; n += 4) {
+        float32x4_t v = vmulq_n_f32(vld1q_f32(src + n), scale);
+        v = vmaxq_f32(vminq_f32(v, max), min);
+        vst1q_u8(out + n * 4, vreinterpretq_u8_s32(vcvtnq_s32_f32(v)));
+    }
+    pcm_convert_scalar_from_float(out + n * 4, src + n, samples - n, format);
+}
+
+static void pcm_convert_neon_to_float_s24(float *dst, const void *src, unsigned int samples)
+{
+    pcm_convert_neon_to_float_32(dst, src, samples, PCM_FORMAT_S24_LE);
+}
+
+static void pcm_convert_neon_from_float_s24(void *dst, const float *src, unsigned int samples)
+{
+    pcm_convert_neon_from_float_32(dst, src, samples, PCM_FORMAT_S24_LE);
+}
+
+static void pcm_convert_neon_to_float_s32(float *dst, const void *src, unsigned int samples)
+{
+    pcm_convert_neon_to_float_32(dst, src, samples, PCM_FORMAT_S32_LE);
+}
+
+static void pcm_convert_neon_from_float_s32(void *dst, const float *src, unsigned int samples)
+{
+    pcm_convert_neon_from_float_32(dst, src, samples, PCM_FORMAT_S32_LE);
+}
+
+#endif /* PCM_CONVERT_NEON */
+
+/* Whether the build and the CPU support an instruction set */
+static int pcm_convert_isa_supported(enum pcm_convert_isa isa)
+{
+    switch (isa) {
+    case PCM_CONVERT_ISA_SCALAR:
+        return 1;
+#ifdef PCM_CONVERT_X86
+    case PCM_CONVERT_ISA_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case PCM_CONVERT_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef PCM_CONVERT_NEON
+    case PCM_CONVERT_ISA_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+static void pcm_convert_init(void)
+{
+    struct pcm_convert_kernel *table;
+    enum pcm_convert_isa isa;
+
+#ifdef PCM_CONVERT_X86
+    __builtin_cpu_init();
+#endif
+
+    for (isa = PCM_CONVERT_ISA_SCALAR; isa <= PCM_CONVERT_ISA_NEON; isa++) {
+        table = pcm_convert_tables[isa];
+        memcpy(table, pcm_convert_scalar, sizeof(pcm_convert_scalar));
+
+        if (!pcm_convert_isa_supported(isa))
+            continue;
+
+        switch (isa) {
+#ifdef PCM_CONVERT_X86
+        case PCM_CONVERT_ISA_SSE2:
+            table[PCM_FORMAT_S16_LE].to_float = pcm_convert_sse2_to_float_s16;
+            table[PCM_FORMAT_S16_LE].from_float = pcm_convert_sse2_from_float_s16;
+            table[PCM_FORMAT_S24_LE].to_float = pcm_convert_sse2_to_float_s24;
+            table[PCM_FORMAT_S24_LE].from_float = pcm_convert_sse2_from_float_s24;
+            table[PCM_FORMAT_S32_LE].to_float = pcm_convert_sse2_to_float_s32;
+            table[PCM_FORMAT_S32_LE].from_float = pcm_convert_sse2_from_float_s32;
+            break;
+        case PCM_CONVERT_ISA_AVX2:
+            table[PCM_FORMAT_S16_LE].to_float = pcm_convert_avx2_to_float_s16;
+            table[PCM_FORMAT_S16_LE].from_float = pcm_convert_avx2_from_float_s16;
+            table[PCM_FORMAT_S24_LE].to_float = pcm_convert_avx2_to_float_s24;
+            table[PCM_FORMAT_S24_LE].from_float = pcm_convert_avx2_from_float_s24;
+            table[PCM_FORMAT_S32_LE].to_float = pcm_convert_avx2_to_float_s32;
+            table[PCM_FORMAT_S32_LE].from_float = pcm_convert_avx2_from_float_s32;
+            break;
+#endif
+#ifdef PCM_CONVERT_NEON
+        case PCM_CONVERT_ISA_NEON:
+            table[PCM_FORMAT_S16_LE].to_float = pcm_convert_neon_to_float_s16;
+            table[PCM_FORMAT_S16_LE].from_float = pcm_convert_neon_from_float_s16;
+            table[PCM_FORMAT_S24_LE].to_float = pcm_convert_neon_to_float_s24;
+            table[PCM_FORMAT_S24_LE].from_float = pcm_convert_neon_from_float_s24;
+            table[PCM_FORMAT_S32_LE].to_float = pcm_convert_neon_to_float_s32;
+            table[PCM_FORMAT_S32_LE].from_float = pcm_convert_neon_from_float_s32;
+            break;
+#endif
+        default:
+            break;
+        }
+        pcm_convert_isa = isa;
+    }
+
+    pcm_convert_kernels = pcm_convert_tables[pcm_convert_isa];
+}
+
+/* Gets the kernels of a format, or NULL if it cannot be converted */
+static const struct pcm_convert_kernel *pcm_convert_get_kernel(enum pcm_format format)
+{
+    pthread_once(&pcm_convert_once, pcm_convert_init);
+
+    if ((unsigned int) format >= PCM_FORMAT_MAX || !pcm_convert_kernels[format].to_float)
+        return NULL;
+    return &pcm_convert_kernels[format];
+}
+
+/** Converts samples from one format to another.
+ * Samples are only rescaled, so converting to a narrower format drops the
+ * low bits and converting to a wider one leaves them zero.
+ * Conversions to or from a floating point format go through float, as
+ * @ref pcm_convert_to_float and @ref pcm_convert_from_float do.
+ * The order of the samples is kept, so interleaved and planar
+ * buffers are converted alike.
+ * @param dst The converted samples. Must not overlap @p src,
+ *  unless it is @p src and both formats have the same width.
+ * @param dst_format The format of @p dst.
+ * @param src The samples to convert.
+ * @param src_format The format of @p src.
+ * @param samples The number of samples to convert.
+ * @returns Zero on success.
+ *  -EINVAL if either format is unknown.
+ * @ingroup libtinyalsa-convert
+ */
+int pcm_convert(void *dst, enum pcm_format dst_format,
+                const void *src, enum pcm_format src_format,
+                unsigned int samples)
+{
+    const struct pcm_convert_kernel *in = pcm_convert_get_kernel(src_format);
+    const struct pcm_convert_kernel *out = pcm_convert_get_kernel(dst_format);
+    unsigned int in_bytes = pcm_format_to_bits(src_format) / 8;
+    unsigned int out_bytes = pcm_format_to_bits(dst_format) / 8;
+    union {
+        int32_t s32[PCM_CONVERT_CHUNK];
+        float f[PCM_CONVERT_CHUNK];
+    } chunk;
+    unsigned int count;
+
+    if (!in || !out)
+        return -EINVAL;
+
+    if (src_format == dst_format) {
+        if (dst != src)
+            memcpy(dst, src, samples * in_bytes);
+        return 0;
+    }
+
+    while (samples > 0) {
+        count = samples < PCM_CONVERT_CHUNK ? samples : PCM_CONVERT_CHUNK;
+        if (in->to_s32 && out->from_s32) {
+            in->to_s32(chunk.s32, src, count);
+            out->from_s32(dst, chunk.s32, count);
+        } else {
+            in->to_float(chunk.f, src, count);
+            out->from_float(dst, chunk.f, count);
+        }
+        src = (const char *) src + count * in_bytes;
+        dst = (char *) dst + count * out_bytes;
+        samples -= count;
+    }
+
+    return 0;
+}
+
+/** Converts samples to float.
+ * A sample of n bits is divided by 2^(n - 1), so full scale is [-1, 1).
+ * Unsigned samples are offset by half their range first.
+ * @param dst The converted samples.
+ * @param src The samples to convert.
+ * @param format The format of @p src.
+ * @param samples The number of samples to convert.
+ * @returns Zero on success.
+ *  -EINVAL if the format is unknown.
+ * @ingroup libtinyalsa-convert
+ */
+int pcm_convert_to_float(float *dst, const void *src, enum pcm_format format,
+                         unsigned int samples)
+{
+    const struct pcm_convert_kernel *kernel = pcm_convert_get_kernel(format);
+
+    if (!kernel)
+        return -EINVAL;
+
+    kernel->to_float(dst, src, samples);
+    return 0;
+}
+
+/** Converts samples from float.
+ * Samples are multiplied by 2^(n - 1) for a format of n bits, clipped to
+ * the range of the format and rounded to the nearest integer.
+ * NaN converts to an unspecified value.
+ * Floating point formats are neither scaled nor clipped.
+ * @param dst The converted samples.
+ * @param format The format of @p dst.
+ * @param src The samples to convert.
+ * @param samples The number of samples to convert.
+ * @returns Zero on success.
+ *  -EINVAL if the format is unknown.
+ * @ingroup libtinyalsa-convert
+ */
+int pcm_convert_from_float(void *dst, enum pcm_format format, const float *src,
+                           unsigned int samples)
+{
+    const struct pcm_convert_kernel *kernel = pcm_convert_get_kernel(format);
+
+    if (!kernel)
+        return -EINVAL;
+
+    kernel->from_float(dst, src, samples);
+    return 0;
+}
+
+/** Gets the instruction set used by the conversions.
+ * Unless set with @ref pcm_convert_set_isa, this is the best one that
+ * the CPU supports.
+ * @returns The instruction set in use.
+ * @ingroup libtinyalsa-convert
+ */
+enum pcm_convert_isa pcm_convert_get_isa(void)
+{
+    pthread_once(&pcm_convert_once, pcm_convert_init);
+
+    return pcm_convert_isa;
+}
+
+/** Sets the instruction set used by the conversions.
+ * All of them give the same results, to the bit, so this is only useful
+ * to test or to measure them.
+ * It must not be called while other threads are converting.
+ * @param isa The instruction set to use.
+ * @returns Zero on success.
+ *  -ENOTSUP if the build or the CPU does not support @p isa.
+ * @ingroup libtinyalsa-convert
+ */
+int pcm_convert_set_isa(enum pcm_convert_isa isa)
+{
+    pthread_once(&pcm_convert_once, pcm_convert_init);
+
+    if ((unsigned int) isa > PCM_CONVERT_ISA_NEON || !pcm_convert_isa_supported(isa))
+        return -ENOTSUP;
+
+    pcm_convert_isa = isa;
+    pcm_convert_kernels = pcm_convert_tables[isa];
+    return 0;
+}
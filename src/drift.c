@@ -0,0 +1,379 @@
+/* drift.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <tinyalsa/drift.h>
+
+/* The number of points used when no window is given */
+#define PCM_DRIFT_DEFAULT_WINDOW 64
+
+/* The fewest points that give a usable fit */
+#define PCM_DRIFT_MIN_POINTS 8
+
+/* A point further than this many residual deviations from the fit is an
+ * outlier, unless it is within a millisecond of it */
+#define PCM_DRIFT_OUTLIER_SIGMA 6.0
+
+/* This many outliers in a row mean that the stream jumped,
+ * and the estimate starts over */
+#define PCM_DRIFT_MAX_OUTLIERS 8
+
+/* A position that moved more than twice as fast as the nominal rate, plus
+ * this many seconds, jumped: the stream was restarted or skipped frames */
+#define PCM_DRIFT_MAX_JUMP 0.25
+
+/** A least squares fit of the frame position of a stream against time,
+ * over a sliding window of points.
+ * @ingroup libtinyalsa-drift
+ */
+struct pcm_drift {
+    /** The nominal rate of the stream, in frames per second */
+    unsigned int rate;
+    /** The position at which the stream wraps around, zero if unknown */
+    unsigned long boundary;
+    /** The capacity of @ref times and @ref frames */
+    unsigned int window;
+    /** The time of each point, in seconds since @ref origin */
+    double *times;
+    /** The position of each point, in frames since @ref origin */
+    double *frames;
+    /** The number of points in the window */
+    unsigned int count;
+    /** The slot of the next point */
+    unsigned int next;
+    /** Whether the first point has been seen */
+    int started;
+    /** The time of the first point */
+    struct timespec origin;
+    /** The position and time of the last accepted point */
+    unsigned long last_position;
+    struct timespec last_tstamp;
+    /** The frames played or captured since @ref origin */
+    unsigned long long position;
+    /** Whether the fit below is usable */
+    int valid;
+    /** The mean of the points, which the fitted line goes through */
+    double mean_time;
+    double mean_frames;
+    /** The fitted rate, in frames per second */
+    double slope;
+    /** The standard error of @ref slope */
+    double slope_error;
+    /** The root mean square distance of the points from the line, in frames */
+    double rms;
+    /** The number of points rejected as outliers */
+    unsigned int outliers;
+    /** The number of points rejected since the last accepted one */
+    unsigned int rejected;
+};
+
+/** Creates a drift estimator.
+ * @param rate The nominal rate of the stream, in frames per second.
+ * @param window The number of points that the estimate is made from.
+ *  Longer windows give a more precise estimate that follows changes
+ *  more slowly. Zero selects a default.
+ * @returns A drift estimator on success, NULL on failure.
+ * @ingroup libtinyalsa-drift
+ */
+struct pcm_drift *pcm_drift_open(unsigned int rate, unsigned int window)
+{
+    struct pcm_drift *drift;
+
+    if (rate == 0)
+        return NULL;
+    if (window == 0)
+        window = PCM_DRIFT_DEFAULT_WINDOW;
+    if (window < PCM_DRIFT_MIN_POINTS)
+        window = PCM_DRIFT_MIN_POINTS;
+
+    drift = calloc(1, sizeof(*drift));
+    if (!drift)
+        return NULL;
+
+    drift->rate = rate;
+    drift->window = window;
+    drift->times = calloc(window, sizeof(*drift->times));
+    drift->frames = calloc(window, sizeof(*drift->frames));
+    if (!drift->times || !drift->frames) {
+        pcm_drift_close(drift);
+        return NULL;
+    }
+
+    return drift;
+}
+
+/** Frees a drift estimator.
+ * @param drift A drift estimator, may be NULL.
+ * @ingroup libtinyalsa-drift
+ */
+void pcm_drift_close(struct pcm_drift *drift)
+{
+    if (!drift)
+        return;
+
+    free(drift->times);
+    free(drift->frames);
+    free(drift);
+}
+
+/** Discards all points of a drift estimator.
+ * This should be called when the stream is stopped or restarted,
+ * although @ref pcm_drift_add notices it when the position jumps.
+ * @param drift A drift estimator.
+ * @ingroup libtinyalsa-drift
+ */
+void pcm_drift_reset(struct pcm_drift *drift)
+{
+    drift->count = 0;
+    drift->next = 0;
+    drift->started = 0;
+    drift->position = 0;
+    drift->valid = 0;
+    drift->rejected = 0;
+}
+
+/** Sets the position at which the positions given to @ref pcm_drift_add
+ * wrap around to zero, as returned by @ref pcm_get_boundary.
+ * Without it, only wraps of an unsigned long are followed.
+ * @ref pcm_drift_update sets it from the PCM.
+ * @param drift A drift estimator.
+ * @param boundary The boundary of the positions, zero if unknown.
+ * @ingroup libtinyalsa-drift
+ */
+void pcm_drift_set_boundary(struct pcm_drift *drift, unsigned long boundary)
+{
+    drift->boundary = boundary;
+}
+
+static double pcm_drift_seconds(const struct timespec *a, const struct timespec *b)
+{
+    return (double)(a->tv_sec - b->tv_sec) + (double)(a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+/* Fits a line through the points of the window, centered on their mean
+ * so that the sums keep their precision */
+static void pcm_drift_fit(struct pcm_drift *drift)
+{
+    double mean_time = 0.0, mean_frames = 0.0;
+    double sxx = 0.0, sxy = 0.0, sse = 0.0;
+    double dt, dy, residual;
+    unsigned int n, count = drift->count;
+
+    drift->valid = 0;
+    if (count < PCM_DRIFT_MIN_POINTS)
+        return;
+
+    for (n = 0; n < count; n++) {
+        mean_time += drift->times[n];
+        mean_frames += drift->frames[n];
+    }
+    mean_time /= count;
+    mean_frames /= count;
+
+    for (n = 0; n < count; n++) {
+        dt = drift->times[n] - mean_time;
+        dy = drift->frames[n] - mean_frames;
+        sxx += dt * dt;
+        sxy += dt * dy;
+    }
+    if (sxx <= 0.0)
+        return;
+
+    drift->slope = sxy / sxx;
+    for (n = 0; n < count; n++) {
+        residual = drift->frames[n] - mean_frames -
+                   drift->slope * (drift->times[n] - mean_time);
+        sse += residual * residual;
+    }
+
+    drift->mean_time = mean_time;
+    drift->mean_frames = mean_frames;
+    drift->slope_error = sqrt(sse / (count - 2) / sxx);
+    drift->rms = sqrt(sse / count);
+    drift->valid = 1;
+}
+
+/* Makes a point the first one of a new estimate */
+static void pcm_drift_start(struct pcm_drift *drift, unsigned long position,
+                            const struct timespec *tstamp)
+{
+    pcm_drift_reset(drift);
+    drift->started = 1;
+    drift->origin = *tstamp;
+    drift->last_position = position;
+    drift->last_tstamp = *tstamp;
+    drift->times[0] = 0.0;
+    drift->frames[0] = 0.0;
+    drift->count = 1;
+    drift->next = 1;
+}
+
+/** Adds a point to a drift estimator.
+ * The position and the timestamp must have been sampled together,
+ * for example the hardware pointer and the timestamp of @ref pcm_get_status.
+ * A point that is too far from the current fit is rejected as an outlier.
+ * Positions may wrap around at the boundary set with
+ * @ref pcm_drift_set_boundary. If the time goes backwards, if the position
+ * moves much further than the elapsed time allows, or if many points in a
+ * row are outliers, the stream is assumed to have restarted and the
+ * estimate starts over.
+ * @param drift A drift estimator.
+ * @param position The position of the stream, in frames.
+ * @param tstamp The time at which the stream was at @p position.
+ * @returns Zero if the point was used, one if it was rejected or is a
+ *  repetition of the previous point.
+ * @ingroup libtinyalsa-drift
+ */
+int pcm_drift_add(struct pcm_drift *drift, unsigned long position,
+                  const struct timespec *tstamp)
+{
+    double time, frames, limit, elapsed;
+    unsigned long long total;
+    unsigned long step;
+
+    if (!drift->started) {
+        pcm_drift_start(drift, position, tstamp);
+        return 0;
+    }
+
+    /* the status has not changed since the last wakeup */
+    if (tstamp->tv_sec == drift->last_tstamp.tv_sec &&
+        tstamp->tv_nsec == drift->last_tstamp.tv_nsec)
+        return 1;
+
+    /* the hardware pointer wraps around at the boundary, a position that
+     * really went backwards unwraps to a step far too large for the time */
+    if (drift->boundary)
+        step = (position % drift->boundary + drift->boundary -
+                drift->last_position % drift->boundary) % drift->boundary;
+    else
+        step = position - drift->last_position;
+
+    elapsed = pcm_drift_seconds(tstamp, &drift->last_tstamp);
+    if (elapsed < 0.0 ||
+        step > (2.0 * elapsed + PCM_DRIFT_MAX_JUMP) * drift->rate) {
+        pcm_drift_start(drift, position, tstamp);
+        return 0;
+    }
+
+    total = drift->position + step;
+    time = pcm_drift_seconds(tstamp, &drift->origin);
+    frames = (double)total;
+
+    if (drift->valid) {
+        limit = PCM_DRIFT_OUTLIER_SIGMA * drift->rms;
+        if (limit < drift->rate / 1000.0)
+            limit = drift->rate / 1000.0;
+        if (fabs(frames - drift->mean_frames -
+                 drift->slope * (time - drift->mean_time)) > limit) {
+            drift->outliers++;
+            if (++drift->rejected < PCM_DRIFT_MAX_OUTLIERS)
+                return 1;
+            pcm_drift_start(drift, position, tstamp);
+            return 0;
+        }
+    }
+    drift->rejected = 0;
+
+    drift->position = total;
+    drift->last_position = position;
+    drift->last_tstamp = *tstamp;
+
+    drift->times[drift->next] = time;
+    drift->frames[drift->next] = frames;
+    drift->next = (drift->next + 1) % drift->window;
+    if (drift->count < drift->window)
+        drift->count++;
+
+    pcm_drift_fit(drift);
+    return 0;
+}
+
+/** Adds the current hardware pointer and timestamp of a PCM to a drift estimator.
+ * This is cheap enough to be called on every period wakeup.
+ * The estimator is reset while the PCM is not running.
+ * @param drift A drift estimator.
+ * @param pcm A PCM handle.
+ * @returns Zero if the point was used, one if it was not.
+ *  On failure, a negative errno value.
+ * @ingroup libtinyalsa-drift
+ */
+int pcm_drift_update(struct pcm_drift *drift, struct pcm *pcm)
+{
+    struct pcm_status status;
+    int ret;
+
+    ret = pcm_get_status(pcm, PCM_AUDIO_TSTAMP_TYPE_DEFAULT, &status);
+    if (ret < 0)
+        return ret;
+
+    if (status.state != PCM_STATE_RUNNING && status.state != PCM_STATE_DRAINING) {
+        pcm_drift_reset(drift);
+        return 1;
+    }
+
+    drift->boundary = pcm_get_boundary(pcm);
+    return pcm_drift_add(drift, status.hw_ptr, &status.tstamp);
+}
+
+/** Gets the estimated drift of a stream.
+ * @param drift A drift estimator.
+ * @param ppm Receives how much faster the clock of the stream runs than the
+ *  clock of the timestamps, in parts per million. Negative if it runs slower.
+ * @param error Receives the standard error of @p ppm, in parts per million.
+ *  The true drift is within twice this value of @p ppm with 95% confidence.
+ *  May be NULL.
+ * @returns Zero on success.
+ *  -EAGAIN if too few points have been added since the last reset.
+ * @ingroup libtinyalsa-drift
+ */
+int pcm_drift_get_ppm(const struct pcm_drift *drift, double *ppm, double *error)
+{
+    if (!drift->valid)
+        return -EAGAIN;
+
+    *ppm = (drift->slope / drift->rate - 1.0) * 1e6;
+    if (error)
+        *error = drift->slope_error / drift->rate * 1e6;
+    return 0;
+}
+
+/** Gets the number of points that a drift estimator rejected as outliers.
+ * @param drift A drift estimator.
+ * @returns The number of outliers since the estimator was created.
+ * @ingroup libtinyalsa-drift
+ */
+unsigned int pcm_drift_get_outliers(const struct pcm_drift *drift)
+{
+    return drift->outliers;
+}
+
@@ -0,0 +1,388 @@
+/* engine.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include <tinyalsa/engine.h>
+
+#include "thread.h"
+
+/* A PCM that is streamed by an engine */
+struct pcm_engine_stream {
+    struct pcm *pcm;
+    pcm_engine_callback callback;
+    void *user_data;
+    unsigned int period_size;
+    unsigned int buffer_size;
+    int capture;
+};
+
+/** A thread that streams a group of PCMs.
+ * @ingroup libtinyalsa-engine
+ */
+struct pcm_engine {
+    /** The options given to @ref pcm_engine_open */
+    struct pcm_engine_config config;
+    /** The streams of the group */
+    struct pcm_engine_stream *streams;
+    /** The number of streams */
+    unsigned int count;
+    /** The PCM file descriptors, followed by @ref event_fd */
+    struct pollfd *pfds;
+    /** Signaled to wake the thread up when the engine is stopped */
+    int event_fd;
+    /** The engine thread */
+    pthread_t thread;
+    /** Whether @ref thread has been created */
+    int started;
+    /** Set when the thread must exit */
+    atomic_int stopping;
+    /** The reason why the thread exited, zero if it was stopped */
+    int error;
+    /** The number of xruns that have been recovered from */
+    atomic_uint xruns;
+};
+
+/** Creates an engine.
+ * PCMs are added with @ref pcm_engine_add and streamed once
+ * @ref pcm_engine_start is called.
+ * @param config The engine options, may be NULL for the defaults.
+ * @returns An engine on success, NULL on failure.
+ * @ingroup libtinyalsa-engine
+ */
+struct pcm_engine *pcm_engine_open(const struct pcm_engine_config *config)
+{
+    struct pcm_engine *engine;
+
+    engine = calloc(1, sizeof(*engine));
+    if (!engine)
+        return NULL;
+
+    if (config)
+        engine->config = *config;
+    atomic_init(&engine->stopping, 0);
+    atomic_init(&engine->xruns, 0);
+
+    engine->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (engine->event_fd < 0) {
+        free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+/** Closes an engine, stopping it first if it is running.
+ * The PCMs of the engine are stopped but not closed.
+ * @param engine An engine, may be NULL.
+ * @ingroup libtinyalsa-engine
+ */
+void pcm_engine_close(struct pcm_engine *engine)
+{
+    if (!engine)
+        return;
+
+    pcm_engine_stop(engine);
+    close(engine->event_fd);
+    free(engine->pfds);
+    free(engine->streams);
+    free(engine);
+}
+
+/** Adds a PCM to an engine.
+ * The PCM must have been opened with @ref PCM_MMAP, without
+ * @ref PCM_NONINTERLEAVED, and must not be
+ * used by the application while the engine is running.
+ * All PCMs of an engine are serviced by the same thread.
+ * @param engine An engine that is not running.
+ * @param pcm A PCM handle.
+ * @param callback Called for every period of the PCM.
+ * @param user_data Passed to @p callback.
+ * @returns On success, zero.
+ *  On failure, a negative errno value.
+ * @ingroup libtinyalsa-engine
+ */
+int pcm_engine_add(struct pcm_engine *engine, struct pcm *pcm,
+                   pcm_engine_callback callback, void *user_data)
+{
+    struct pcm_engine_stream *streams;
+    struct pcm_engine_stream *stream;
+    const struct pcm_config *config;
+
+    if (!engine || !callback || !pcm_is_ready(pcm))
+        return -EINVAL;
+    if (engine->started)
+        return -EBUSY;
+    if ((pcm_get_flags(pcm) & (PCM_MMAP | PCM_NONINTERLEAVED)) != PCM_MMAP)
+        return -EINVAL;
+
+    streams = realloc(engine->streams, (engine->count + 1) * sizeof(*streams));
+    if (!streams)
+        return -ENOMEM;
+    engine->streams = streams;
+
+    config = pcm_get_config(pcm);
+    stream = &engine->streams[engine->count];
+    stream->pcm = pcm;
+    stream->callback = callback;
+    stream->user_data = user_data;
+    stream->period_size = config->period_size;
+    stream->buffer_size = pcm_get_buffer_size(pcm);
+    stream->capture = !!(pcm_get_flags(pcm) & PCM_IN);
+
+    /* only wake up for whole periods */
+    if (pcm_set_avail_min(pcm, stream->period_size) < 0)
+        return -EINVAL;
+
+    engine->count++;
+    return 0;
+}
+
+/* Calls the callback for every whole period that is available */
+static int pcm_engine_service(struct pcm_engine *engine,
+                              struct pcm_engine_stream *stream)
+{
+    struct pcm *pcm = stream->pcm;
+    unsigned int offset;
+    unsigned int frames;
+    void *areas;
+    int ret;
+
+    for (;;) {
+        frames = stream->period_size;
+        if (pcm_mmap_begin(pcm, &areas, &offset, &frames) < 0)
+            return -EIO;
+
+        /* a shorter area is only serviced if it ends at the wrap point */
+        if (frames == 0)
+            return 0;
+        if ((frames < stream->period_size) &&
+            (offset + frames < stream->buffer_size))
+            return 0;
+
+        ret = stream->callback(pcm, (char *)areas + pcm_frames_to_bytes(pcm, offset),
+                               frames, stream->user_data);
+        if (ret != 0) {
+            engine->error = ret;
+            atomic_store_explicit(&engine->stopping, 1, memory_order_relaxed);
+            return 0;
+        }
+
+        if (pcm_mmap_commit(pcm, offset, frames) < 0)
+            return -EIO;
+    }
+}
+
+/* Prepares and starts a stream, filling the whole buffer for playback */
+static int pcm_engine_stream_start(struct pcm_engine *engine,
+                                   struct pcm_engine_stream *stream)
+{
+    int ret;
+
+    if (!stream->capture) {
+        ret = pcm_engine_service(engine, stream);
+        if (ret < 0 || atomic_load_explicit(&engine->stopping, memory_order_relaxed))
+            return ret;
+    }
+
+    if (pcm_start(stream->pcm) < 0)
+        return -EIO;
+
+    return 0;
+}
+
+/* Restarts a stream after an xrun or a suspend */
+static int pcm_engine_recover(struct pcm_engine *engine,
+                              struct pcm_engine_stream *stream)
+{
+    switch (pcm_state(stream->pcm)) {
+    case PCM_STATE_XRUN:
+    case PCM_STATE_SUSPENDED:
+        break;
+    case PCM_STATE_DISCONNECTED:
+        return -ENODEV;
+    default:
+        return -EIO;
+    }
+
+    atomic_fetch_add_explicit(&engine->xruns, 1, memory_order_relaxed);
+
+    /* dropping the stream lets it be prepared again */
+    pcm_stop(stream->pcm);
+    return pcm_engine_stream_start(engine, stream);
+}
+
+static void *pcm_engine_thread(void *arg)
+{
+    struct pcm_engine *engine = arg;
+    unsigned int n;
+    int ret = 0;
+
+    for (n = 0; n < engine->count && !atomic_load_explicit(&engine->stopping, memory_order_relaxed); n++) {
+        ret = pcm_engine_stream_start(engine, &engine->streams[n]);
+        if (ret < 0)
+            goto done;
+    }
+
+    while (!atomic_load_explicit(&engine->stopping, memory_order_relaxed)) {
+        ret = poll(engine->pfds, engine->count + 1, -1);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = -errno;
+            goto done;
+        }
+
+        /* stop requested */
+        if (engine->pfds[engine->count].revents)
+            break;
+
+        for (n = 0; n < engine->count && !atomic_load_explicit(&engine->stopping, memory_order_relaxed); n++) {
+            struct pcm_engine_stream *stream = &engine->streams[n];
+            short revents = engine->pfds[n].revents;
+
+            if (!revents)
+                continue;
+
+            if (revents & (POLLERR | POLLNVAL))
+                ret = pcm_engine_recover(engine, stream);
+            else
+                ret = pcm_engine_service(engine, stream);
+            if (ret < 0)
+                goto done;
+        }
+    }
+    ret = 0;
+
+done:
+    if (ret < 0)
+        engine->error = ret;
+    for (n = 0; n < engine->count; n++)
+        pcm_stop(engine->streams[n].pcm);
+    return NULL;
+}
+
+/** Starts streaming all PCMs of an engine on a new thread.
+ * Playback buffers are filled by the callbacks before the PCMs are started.
+ * After an xrun, a PCM is prepared, filled and started again.
+ * @param engine An engine with at least one PCM.
+ * @returns On success, zero.
+ *  On failure, a negative errno value.
+ *  -EPERM is returned if the requested priority or memory locking is not permitted.
+ * @ingroup libtinyalsa-engine
+ */
+int pcm_engine_start(struct pcm_engine *engine)
+{
+    pthread_attr_t attr;
+    unsigned int n;
+    uint64_t value;
+    int ret;
+
+    if (!engine || !engine->count)
+        return -EINVAL;
+    if (engine->started)
+        return -EBUSY;
+
+    if (engine->config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        return -errno;
+
+    free(engine->pfds);
+    engine->pfds = calloc(engine->count + 1, sizeof(*engine->pfds));
+    if (!engine->pfds)
+        return -ENOMEM;
+    for (n = 0; n < engine->count; n++) {
+        engine->pfds[n].fd = pcm_get_file_descriptor(engine->streams[n].pcm);
+        engine->pfds[n].events = engine->streams[n].capture ? POLLIN : POLLOUT;
+    }
+    engine->pfds[n].fd = engine->event_fd;
+    engine->pfds[n].events = POLLIN;
+
+    /* drain a stop request left over from a previous run, the eventfd is
+     * non-blocking so an empty one fails with EAGAIN */
+    while (read(engine->event_fd, &value, sizeof(value)) < 0 && errno == EINTR)
+        ;
+    atomic_store_explicit(&engine->stopping, 0, memory_order_relaxed);
+    engine->error = 0;
+    atomic_store_explicit(&engine->xruns, 0, memory_order_relaxed);
+
+    pcm_thread_attr_init(&attr, engine->config.priority);
+    ret = pthread_create(&engine->thread, &attr, pcm_engine_thread, engine);
+    pthread_attr_destroy(&attr);
+    if (ret != 0)
+        return -ret;
+
+    engine->started = 1;
+    return 0;
+}
+
+/** Stops an engine and waits for its thread to exit.
+ * The PCMs of the engine are stopped.
+ * @param engine An engine.
+ * @returns Zero if the engine was running normally.
+ *  Otherwise, the value returned by a callback that stopped the engine,
+ *  or the negative errno value of an unrecoverable stream error.
+ * @ingroup libtinyalsa-engine
+ */
+int pcm_engine_stop(struct pcm_engine *engine)
+{
+    uint64_t value = 1;
+
+    if (!engine)
+        return -EINVAL;
+    if (!engine->started)
+        return 0;
+
+    atomic_store_explicit(&engine->stopping, 1, memory_order_relaxed);
+    while (write(engine->event_fd, &value, sizeof(value)) < 0 && errno == EINTR)
+        ;
+    pthread_join(engine->thread, NULL);
+    engine->started = 0;
+
+    return engine->error;
+}
+
+/** Gets the number of xruns that an engine has recovered from since it was started.
+ * @param engine An engine.
+ * @returns The number of xruns.
+ * @ingroup libtinyalsa-engine
+ */
+unsigned int pcm_engine_get_xruns(const struct pcm_engine *engine)
+{
+    return atomic_load_explicit(&engine->xruns, memory_order_relaxed);
+}
+
@@ -0,0 +1,369 @@
+/* gain.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include <tinyalsa/convert.h>
+
+#include "gain.h"
+
+/* The number of samples scaled at a time */
+#define PCM_GAIN_CHUNK 1024
+
+/* The number of frames in a block of the gain pattern */
+#define PCM_GAIN_BLOCK 8
+
+typedef float pcm_gain_vec __attribute__((vector_size(16)));
+
+#define PCM_GAIN_LANES (sizeof(pcm_gain_vec) / sizeof(float))
+
+struct pcm_gain {
+    enum pcm_format format;
+    unsigned int channels;
+    unsigned int sample_bytes;
+    /* Whether samples are native floats that can be scaled where they are */
+    int native_float;
+    /* Whether every channel is at unity gain and not ramping */
+    int unity;
+    /* The gain of each channel at the next frame */
+    float *current;
+    /* The gain that each channel is ramping to */
+    float *target;
+    /* The change in gain per frame of each channel while ramping */
+    float *step;
+    /* The number of frames left in the ramp */
+    unsigned int remaining;
+    /* Gains written by pcm_gain_set, protected by the sequence count */
+    float *pending;
+    unsigned int pending_ramp;
+    atomic_uint sequence;
+    /* The last sequence count picked up by the audio thread */
+    unsigned int applied;
+    /* The gain of each sample of a block of frames, and its change per block */
+    float *pattern;
+    float *pattern_step;
+    /* Samples converted to float */
+    float *scratch;
+};
+
+struct pcm_gain *pcm_gain_open(enum pcm_format format, unsigned int channels)
+{
+    struct pcm_gain *gain;
+    unsigned int bits, channel, pattern_size;
+
+    bits = pcm_format_to_bits(format);
+    if (channels == 0 || bits == 0)
+        return NULL;
+
+    gain = calloc(1, sizeof(*gain));
+    if (!gain)
+        return NULL;
+
+    gain->format = format;
+    gain->channels = channels;
+    gain->sample_bytes = bits / 8;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    gain->native_float = format == PCM_FORMAT_FLOAT_LE;
+#else
+    gain->native_float = format == PCM_FORMAT_FLOAT_BE;
+#endif
+    gain->unity = 1;
+
+    pattern_size = PCM_GAIN_BLOCK * channels;
+    gain->current = calloc(channels, sizeof(float));
+    gain->target = calloc(channels, sizeof(float));
+    gain->step = calloc(channels, sizeof(float));
+    gain->pending = calloc(channels, sizeof(float));
+    gain->pattern = calloc(pattern_size, sizeof(float));
+    gain->pattern_step = calloc(pattern_size, sizeof(float));
+    gain->scratch = calloc(pattern_size > PCM_GAIN_CHUNK ? pattern_size : PCM_GAIN_CHUNK,
+                           sizeof(float));
+    if (!gain->current || !gain->target || !gain->step || !gain->pending ||
+        !gain->pattern || !gain->pattern_step || !gain->scratch) {
+        pcm_gain_close(gain);
+        return NULL;
+    }
+
+    for (channel = 0; channel < channels; channel++)
+        gain->current[channel] = gain->target[channel] = 1.0f;
+    atomic_init(&gain->sequence, 0);
+
+    return gain;
+}
+
+void pcm_gain_close(struct pcm_gain *gain)
+{
+    if (!gain)
+        return;
+
+    free(gain->current);
+    free(gain->target);
+    free(gain->step);
+    free(gain->pending);
+    free(gain->pattern);
+    free(gain->pattern_step);
+    free(gain->scratch);
+    free(gain);
+}
+
+int pcm_gain_set(struct pcm_gain *gain, const float *gains, float value,
+                 unsigned int ramp_frames)
+{
+    unsigned int sequence, channel;
+
+    if (!gain)
+        return -EINVAL;
+    for (channel = 0; channel < gain->channels; channel++) {
+        float g = gains ? gains[channel] : value;
+        if (!(g >= 0.0f && g < 1e6f))
+            return -EINVAL;
+    }
+
+    /* an odd count tells the audio thread that an update is in progress */
+    sequence = atomic_load_explicit(&gain->sequence, memory_order_relaxed);
+    atomic_store_explicit(&gain->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (channel = 0; channel < gain->channels; channel++)
+        gain->pending[channel] = gains ? gains[channel] : value;
+    gain->pending_ramp = ramp_frames;
+
+    atomic_store_explicit(&gain->sequence, sequence + 2, memory_order_release);
+    return 0;
+}
+
+static void pcm_gain_check_unity(struct pcm_gain *gain)
+{
+    unsigned int channel;
+
+    gain->unity = gain->remaining == 0;
+    for (channel = 0; channel < gain->channels && gain->unity; channel++)
+        gain->unity = gain->current[channel] == 1.0f;
+}
+
+/* Picks up gains set since the last application. Nothing is waited for, an
+ * update that is in progress is picked up by the next application. */
+static void pcm_gain_update(struct pcm_gain *gain)
+{
+    unsigned int sequence, ramp, channel;
+
+    sequence = atomic_load_explicit(&gain->sequence, memory_order_acquire);
+    if (sequence == gain->applied || (sequence & 1))
+        return;
+
+    /* the targets are only committed once the copy is known to be whole */
+    for (channel = 0; channel < gain->channels; channel++)
+        gain->scratch[channel] = gain->pending[channel];
+    ramp = gain->pending_ramp;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&gain->sequence, memory_order_relaxed) != sequence)
+        return;
+    gain->applied = sequence;
+
+    for (channel = 0; channel < gain->channels; channel++) {
+        gain->target[channel] = gain->scratch[channel];
+        if (ramp) {
+            gain->step[channel] = (gain->target[channel] - gain->current[channel]) / ramp;
+        } else {
+            gain->current[channel] = gain->target[channel];
+            gain->step[channel] = 0.0f;
+        }
+    }
+    gain->remaining = ramp;
+    pcm_gain_check_unity(gain);
+}
+
+/* Multiplies frames of samples by the pattern, a block of frames at a time.
+ * While ramping the pattern moves on by one block after each block, so that
+ * every sample gets the gain of its own frame. */
+static void pcm_gain_multiply(float *samples, unsigned int frames, unsigned int channels,
+                              float *pattern, const float *pattern_step, int ramping)
+{
+    unsigned int block_size = PCM_GAIN_BLOCK * channels;
+    unsigned int blocks = frames / PCM_GAIN_BLOCK;
+    unsigned int tail = (frames % PCM_GAIN_BLOCK) * channels;
+    pcm_gain_vec x, g, s;
+    unsigned int i;
+
+    while (blocks--) {
+        for (i = 0; i < block_size; i += PCM_GAIN_LANES) {
+            memcpy(&x, samples + i, sizeof(x));
+            memcpy(&g, pattern + i, sizeof(g));
+            x *= g;
+            memcpy(samples + i, &x, sizeof(x));
+            if (ramping) {
+                memcpy(&s, pattern_step + i, sizeof(s));
+                g += s;
+                memcpy(pattern + i, &g, sizeof(g));
+            }
+        }
+        samples += block_size;
+    }
+
+    for (i = 0; i < tail; i++)
+        samples[i] *= pattern[i];
+}
+
+/* Scales frames of one or more channels with the gains and steps given for
+ * those channels, metering them before they leave the scratch buffer. */
+static void pcm_gain_segment(struct pcm_gain *gain, struct pcm_meter *meter,
+                             char *dst, const char *src, unsigned int frames,
+                             unsigned int channels, unsigned int first_channel,
+                             const float *current, const float *step, int ramping)
+{
+    unsigned int frame_bytes = gain->sample_bytes * channels;
+    unsigned int chunk_frames, frame, channel, n;
+    float *samples;
+
+    /* the step is applied before each frame, so that a ramp ends on its target */
+    for (frame = 0; frame < PCM_GAIN_BLOCK; frame++) {
+        for (channel = 0; channel < channels; channel++) {
+            unsigned int i = frame * channels + channel;
+            gain->pattern[i] = current[channel];
+            if (ramping) {
+                gain->pattern[i] += step[channel] * (frame + 1);
+                gain->pattern_step[i] = step[channel] * PCM_GAIN_BLOCK;
+            }
+        }
+    }
+
+    /* whole blocks, so that the pattern carries on from one chunk to the next */
+    chunk_frames = PCM_GAIN_CHUNK / channels / PCM_GAIN_BLOCK * PCM_GAIN_BLOCK;
+    if (chunk_frames == 0)
+        chunk_frames = PCM_GAIN_BLOCK;
+
+    while (frames > 0) {
+        n = frames < chunk_frames ? frames : chunk_frames;
+
+        if (gain->native_float) {
+            if (dst != src)
+                memcpy(dst, src, n * frame_bytes);
+            samples = (float *)dst;
+        } else {
+            pcm_convert_to_float(gain->scratch, src, gain->format, n * channels);
+            samples = gain->scratch;
+        }
+
+        pcm_gain_multiply(samples, n, channels, gain->pattern, gain->pattern_step,
+                          ramping);
+        if (meter)
+            pcm_meter_float(meter, samples, n, channels, first_channel);
+
+        if (!gain->native_float)
+            pcm_convert_from_float(dst, gain->format, gain->scratch, n * channels);
+
+        dst += n * frame_bytes;
+        src += n * frame_bytes;
+        frames -= n;
+    }
+}
+
+/* Moves the gains on by a number of frames that does not go past the end of
+ * the ramp. */
+static void pcm_gain_advance(struct pcm_gain *gain, unsigned int frames)
+{
+    unsigned int channel;
+
+    if (gain->remaining == 0)
+        return;
+
+    gain->remaining -= frames;
+    for (channel = 0; channel < gain->channels; channel++) {
+        if (gain->remaining == 0)
+            gain->current[channel] = gain->target[channel];
+        else
+            gain->current[channel] += gain->step[channel] * frames;
+    }
+    if (gain->remaining == 0)
+        pcm_gain_check_unity(gain);
+}
+
+static int pcm_gain_run(struct pcm_gain *gain, struct pcm_meter *meter,
+                        void *const *dst, unsigned int dst_offset,
+                        const void *const *src, unsigned int src_offset,
+                        unsigned int frames, int planar)
+{
+    unsigned int done = 0, n, channel, bytes;
+    int ramping;
+
+    pcm_gain_update(gain);
+    if (gain->unity)
+        return 0;
+
+    if (meter)
+        pcm_meter_begin(meter);
+
+    bytes = gain->sample_bytes * (planar ? 1 : gain->channels);
+    while (done < frames) {
+        /* a ramp that ends part way through is done in two segments */
+        ramping = gain->remaining > 0;
+        n = frames - done;
+        if (ramping && n > gain->remaining)
+            n = gain->remaining;
+
+        if (planar) {
+            for (channel = 0; channel < gain->channels; channel++)
+                pcm_gain_segment(gain, meter,
+                                 (char *)dst[channel] + (dst_offset + done) * bytes,
+                                 (const char *)src[channel] + (src_offset + done) * bytes,
+                                 n, 1, channel, gain->current + channel,
+                                 gain->step + channel, ramping);
+        } else {
+            pcm_gain_segment(gain, meter, (char *)dst[0] + (dst_offset + done) * bytes,
+                             (const char *)src[0] + (src_offset + done) * bytes,
+                             n, gain->channels, 0, gain->current, gain->step, ramping);
+        }
+
+        pcm_gain_advance(gain, n);
+        done += n;
+    }
+
+    if (meter)
+        pcm_meter_end(meter, frames);
+    return 1;
+}
+
+int pcm_gain_apply(struct pcm_gain *gain, struct pcm_meter *meter, void *dst,
+                   const void *src, unsigned int frames)
+{
+    return pcm_gain_run(gain, meter, &dst, 0, &src, 0, frames, 0);
+}
+
+int pcm_gain_apply_planar(struct pcm_gain *gain, struct pcm_meter *meter,
+                          void *const *dst, unsigned int dst_offset,
+                          const void *const *src, unsigned int src_offset,
+                          unsigned int frames)
+{
+    return pcm_gain_run(gain, meter, dst, dst_offset, src, src_offset, frames, 1);
+}
+
@@ -0,0 +1,65 @@
+/* gain.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#ifndef TINYALSA_SRC_GAIN_H
+#define TINYALSA_SRC_GAIN_H
+
+#include <tinyalsa/pcm.h>
+
+#include "meter.h"
+
+/* A software gain stage for one stream, with a gain per channel.
+ * The gains are set from any thread and picked up by the next application,
+ * which moves to them in a linear ramp if one was asked for. */
+struct pcm_gain;
+
+struct pcm_gain *pcm_gain_open(enum pcm_format format, unsigned int channels);
+
+void pcm_gain_close(struct pcm_gain *gain);
+
+/* Sets the gain of every channel, or only value if gains is NULL.
+ * The change is spread over ramp_frames frames, zero applies it at once. */
+int pcm_gain_set(struct pcm_gain *gain, const float *gains, float value,
+                 unsigned int ramp_frames);
+
+/* Scales interleaved frames from src into dst, which may be the same buffer,
+ * and meters the scaled frames if meter is not NULL.
+ * Returns zero without touching dst if the gain is unity, in which case the
+ * caller has to copy and meter the frames itself, and one otherwise. */
+int pcm_gain_apply(struct pcm_gain *gain, struct pcm_meter *meter, void *dst,
+                   const void *src, unsigned int frames);
+
+/* The same for non-interleaved frames, with one buffer per channel and the
+ * first frame of each given by an offset in frames. */
+int pcm_gain_apply_planar(struct pcm_gain *gain, struct pcm_meter *meter,
+                          void *const *dst, unsigned int dst_offset,
+                          const void *const *src, unsigned int src_offset,
+                          unsigned int frames);
+
+#endif /* TINYALSA_SRC_GAIN_H */
+
@@ -0,0 +1,341 @@
+/* meter.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include <tinyalsa/convert.h>
+
+#include "meter.h"
+
+/* The number of samples converted to float at a time */
+#define PCM_METER_CHUNK 1024
+
+/* The number of frames in a block of accumulators */
+#define PCM_METER_BLOCK 8
+
+typedef float pcm_meter_vec __attribute__((vector_size(16)));
+typedef int32_t pcm_meter_mask __attribute__((vector_size(16)));
+
+#define PCM_METER_LANES (sizeof(pcm_meter_vec) / sizeof(float))
+
+/* The levels accumulated since the last reset */
+struct pcm_meter_bank {
+    /* The largest square of a sample of each channel */
+    float *peak;
+    /* The sum of the squares of the samples of each channel */
+    double *sum;
+    unsigned long frames;
+};
+
+struct pcm_meter {
+    enum pcm_format format;
+    unsigned int channels;
+    unsigned int sample_bytes;
+    /* Whether samples are native floats that can be metered where they are */
+    int native_float;
+    /* The audio thread accumulates into one bank while the other is read
+     * and cleared by a reset */
+    struct pcm_meter_bank banks[2];
+    atomic_uint active;
+    /* Odd while the audio thread is accumulating */
+    atomic_uint sequence;
+    /* The bank picked by pcm_meter_begin */
+    struct pcm_meter_bank *bank;
+    /* Accumulators for each sample of a block of frames */
+    float *block_peak;
+    float *block_sum;
+    /* Samples converted to float */
+    float *scratch;
+};
+
+struct pcm_meter *pcm_meter_open(enum pcm_format format, unsigned int channels)
+{
+    struct pcm_meter *meter;
+    unsigned int bits, n, block_size;
+
+    bits = pcm_format_to_bits(format);
+    if (channels == 0 || bits == 0)
+        return NULL;
+
+    meter = calloc(1, sizeof(*meter));
+    if (!meter)
+        return NULL;
+
+    meter->format = format;
+    meter->channels = channels;
+    meter->sample_bytes = bits / 8;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    meter->native_float = format == PCM_FORMAT_FLOAT_LE;
+#else
+    meter->native_float = format == PCM_FORMAT_FLOAT_BE;
+#endif
+
+    block_size = PCM_METER_BLOCK * channels;
+    for (n = 0; n < 2; n++) {
+        meter->banks[n].peak = calloc(channels, sizeof(float));
+        meter->banks[n].sum = calloc(channels, sizeof(double));
+        if (!meter->banks[n].peak || !meter->banks[n].sum) {
+            pcm_meter_close(meter);
+            return NULL;
+        }
+    }
+    meter->block_peak = calloc(block_size, sizeof(float));
+    meter->block_sum = calloc(block_size, sizeof(float));
+    meter->scratch = calloc(block_size > PCM_METER_CHUNK ? block_size : PCM_METER_CHUNK,
+                            sizeof(float));
+    if (!meter->block_peak || !meter->block_sum || !meter->scratch) {
+        pcm_meter_close(meter);
+        return NULL;
+    }
+
+    atomic_init(&meter->active, 0);
+    atomic_init(&meter->sequence, 0);
+    meter->bank = &meter->banks[0];
+
+    return meter;
+}
+
+void pcm_meter_close(struct pcm_meter *meter)
+{
+    unsigned int n;
+
+    if (!meter)
+        return;
+
+    for (n = 0; n < 2; n++) {
+        free(meter->banks[n].peak);
+        free(meter->banks[n].sum);
+    }
+    free(meter->block_peak);
+    free(meter->block_sum);
+    free(meter->scratch);
+    free(meter);
+}
+
+void pcm_meter_begin(struct pcm_meter *meter)
+{
+    unsigned int sequence = atomic_load_explicit(&meter->sequence, memory_order_relaxed);
+
+    /* the bank is picked after the sequence is made odd, so that a reader
+     * that swaps the banks either sees the odd count or is seen here */
+    atomic_store_explicit(&meter->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    meter->bank = &meter->banks[atomic_load_explicit(&meter->active, memory_order_acquire)];
+}
+
+void pcm_meter_end(struct pcm_meter *meter, unsigned int frames)
+{
+    unsigned int sequence = atomic_load_explicit(&meter->sequence, memory_order_relaxed);
+
+    meter->bank->frames += frames;
+    atomic_store_explicit(&meter->sequence, sequence + 1, memory_order_release);
+}
+
+/* Accumulates at most a chunk of samples into the block accumulators, then
+ * folds those into the channels of the bank. */
+static void pcm_meter_chunk(struct pcm_meter *meter, const float *samples, unsigned int frames,
+                            unsigned int channels, unsigned int first_channel)
+{
+    struct pcm_meter_bank *bank = meter->bank;
+    unsigned int block_size = PCM_METER_BLOCK * channels;
+    unsigned int blocks = frames / PCM_METER_BLOCK;
+    unsigned int tail = (frames % PCM_METER_BLOCK) * channels;
+    pcm_meter_vec x, peak, sum;
+    pcm_meter_mask above;
+    unsigned int i;
+
+    memset(meter->block_peak, 0, block_size * sizeof(float));
+    memset(meter->block_sum, 0, block_size * sizeof(float));
+
+    while (blocks--) {
+        for (i = 0; i < block_size; i += PCM_METER_LANES) {
+            memcpy(&x, samples + i, sizeof(x));
+            memcpy(&peak, meter->block_peak + i, sizeof(peak));
+            memcpy(&sum, meter->block_sum + i, sizeof(sum));
+            x *= x;
+            sum += x;
+            above = x > peak;
+            peak = (pcm_meter_vec)(((pcm_meter_mask)x & above) |
+                                   ((pcm_meter_mask)peak & ~above));
+            memcpy(meter->block_peak + i, &peak, sizeof(peak));
+            memcpy(meter->block_sum + i, &sum, sizeof(sum));
+        }
+        samples += block_size;
+    }
+
+    for (i = 0; i < tail; i++) {
+        float square = samples[i] * samples[i];
+        meter->block_sum[i] += square;
+        if (square > meter->block_peak[i])
+            meter->block_peak[i] = square;
+    }
+
+    for (i = 0; i < block_size; i++) {
+        unsigned int channel = first_channel + i % channels;
+        bank->sum[channel] += meter->block_sum[i];
+        if (meter->block_peak[i] > bank->peak[channel])
+            bank->peak[channel] = meter->block_peak[i];
+    }
+}
+
+void pcm_meter_float(struct pcm_meter *meter, const float *samples, unsigned int frames,
+                     unsigned int channels, unsigned int first_channel)
+{
+    unsigned int chunk_frames, n;
+
+    /* the block sums are single precision, so they are kept short */
+    chunk_frames = PCM_METER_CHUNK / channels;
+    if (chunk_frames == 0)
+        chunk_frames = 1;
+
+    while (frames > 0) {
+        n = frames < chunk_frames ? frames : chunk_frames;
+        pcm_meter_chunk(meter, samples, n, channels, first_channel);
+        samples += n * channels;
+        frames -= n;
+    }
+}
+
+/* Meters frames of one or more channels, copying each chunk while it is
+ * still in the cache. */
+static void pcm_meter_segment(struct pcm_meter *meter, char *dst, const char *src,
+                              unsigned int frames, unsigned int channels,
+                              unsigned int first_channel)
+{
+    unsigned int frame_bytes = meter->sample_bytes * channels;
+    unsigned int chunk_frames, n;
+
+    chunk_frames = PCM_METER_CHUNK / channels;
+    if (chunk_frames == 0)
+        chunk_frames = 1;
+
+    while (frames > 0) {
+        n = frames < chunk_frames ? frames : chunk_frames;
+
+        if (meter->native_float) {
+            pcm_meter_chunk(meter, (const float *)src, n, channels, first_channel);
+        } else {
+            pcm_convert_to_float(meter->scratch, src, meter->format, n * channels);
+            pcm_meter_chunk(meter, meter->scratch, n, channels, first_channel);
+        }
+        if (dst && dst != src)
+            memcpy(dst, src, n * frame_bytes);
+
+        if (dst)
+            dst += n * frame_bytes;
+        src += n * frame_bytes;
+        frames -= n;
+    }
+}
+
+void pcm_meter_copy(struct pcm_meter *meter, void *dst, const void *src,
+                    unsigned int frames)
+{
+    pcm_meter_begin(meter);
+    pcm_meter_segment(meter, dst, src, frames, meter->channels, 0);
+    pcm_meter_end(meter, frames);
+}
+
+void pcm_meter_copy_planar(struct pcm_meter *meter, void *const *dst,
+                           unsigned int dst_offset, const void *const *src,
+                           unsigned int src_offset, unsigned int frames)
+{
+    unsigned int channel;
+
+    pcm_meter_begin(meter);
+    for (channel = 0; channel < meter->channels; channel++)
+        pcm_meter_segment(meter,
+                          dst ? (char *)dst[channel] + dst_offset * meter->sample_bytes : NULL,
+                          (const char *)src[channel] + src_offset * meter->sample_bytes,
+                          frames, 1, channel);
+    pcm_meter_end(meter, frames);
+}
+
+static void pcm_meter_levels(const struct pcm_meter_bank *bank, float *peak, float *rms,
+                             unsigned int channels)
+{
+    unsigned int channel;
+
+    for (channel = 0; channel < channels; channel++) {
+        if (peak)
+            peak[channel] = sqrtf(bank->peak[channel]);
+        if (rms)
+            rms[channel] = bank->frames ? sqrt(bank->sum[channel] / bank->frames) : 0.0f;
+    }
+}
+
+int pcm_meter_read(struct pcm_meter *meter, float *peak, float *rms,
+                   unsigned int channels, int reset)
+{
+    struct pcm_meter_bank *bank;
+    unsigned int sequence, active;
+
+    if (channels > meter->channels)
+        channels = meter->channels;
+
+    if (!reset) {
+        /* retry if the audio thread accumulated while the levels were read */
+        for (;;) {
+            sequence = atomic_load_explicit(&meter->sequence, memory_order_acquire);
+            if (sequence & 1) {
+                sched_yield();
+                continue;
+            }
+            active = atomic_load_explicit(&meter->active, memory_order_relaxed);
+            pcm_meter_levels(&meter->banks[active], peak, rms, channels);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&meter->sequence, memory_order_relaxed) == sequence)
+                return 0;
+        }
+    }
+
+    /* swap the banks, then wait for the audio thread to let go of the old one */
+    active = atomic_load_explicit(&meter->active, memory_order_relaxed);
+    atomic_store_explicit(&meter->active, active ^ 1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    sequence = atomic_load_explicit(&meter->sequence, memory_order_relaxed);
+    if (sequence & 1) {
+        while (atomic_load_explicit(&meter->sequence, memory_order_relaxed) == sequence)
+            sched_yield();
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    bank = &meter->banks[active];
+    pcm_meter_levels(bank, peak, rms, channels);
+    memset(bank->peak, 0, meter->channels * sizeof(float));
+    memset(bank->sum, 0, meter->channels * sizeof(double));
+    bank->frames = 0;
+    return 0;
+}
+
@@ -0,0 +1,70 @@
+/* meter.h
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#ifndef TINYALSA_SRC_METER_H
+#define TINYALSA_SRC_METER_H
+
+#include <tinyalsa/pcm.h>
+
+/* Peak and RMS levels of each channel of a stream, accumulated by the thread
+ * that transfers the frames and read by any one other thread. */
+struct pcm_meter;
+
+struct pcm_meter *pcm_meter_open(enum pcm_format format, unsigned int channels);
+
+void pcm_meter_close(struct pcm_meter *meter);
+
+/* Marks the start and the end of the frames of one transfer. Everything
+ * metered in between is published at once. */
+void pcm_meter_begin(struct pcm_meter *meter);
+
+void pcm_meter_end(struct pcm_meter *meter, unsigned int frames);
+
+/* Meters frames of samples already converted to float, which are interleaved
+ * samples of the channels from first_channel on. */
+void pcm_meter_float(struct pcm_meter *meter, const float *samples, unsigned int frames,
+                     unsigned int channels, unsigned int first_channel);
+
+/* Meters interleaved frames from src while copying them to dst, unless dst
+ * is NULL or the same as src. */
+void pcm_meter_copy(struct pcm_meter *meter, void *dst, const void *src,
+                    unsigned int frames);
+
+/* The same for non-interleaved frames, with one buffer per channel and the
+ * first frame of each given by an offset in frames. */
+void pcm_meter_copy_planar(struct pcm_meter *meter, void *const *dst,
+                           unsigned int dst_offset, const void *const *src,
+                           unsigned int src_offset, unsigned int frames);
+
+/* Gets the levels of up to channels channels, as linear full scale values,
+ * and optionally starts measuring again. */
+int pcm_meter_read(struct pcm_meter *meter, float *peak, float *rms,
+                   unsigned int channels, int reset);
+
+#endif /* TINYALSA_SRC_METER_H */
+
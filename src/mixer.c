@@ -266,6 +266,17 @@ const char *mixer_get_name(const struct mixer *mixer)
     return (const char *)mixer->card_info.name;
 }
 
+/** Gets the file descriptor of the mixer's card.
+ * Useful for waiting on the mixer together with other file descriptors.
+ * @param mixer An initialized mixer handle.
+ * @returns The file descriptor of the mixer.
+ * @ingroup libtinyalsa-mixer
+ */
+int mixer_get_file_descriptor(const struct mixer *mixer)
+{
+    return mixer->fd;
+}
+
 /** Gets the number of mixer controls for a given mixer.
  * @param mixer An initialized mixer handle.
  * @returns The number of mixer controls for the given mixer.
@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
+#include <stdatomic.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -50,6 +51,9 @@
 #include <tinyalsa/pcm.h>
 #include <tinyalsa/limits.h>
 
+#include "gain.h"
+#include "meter.h"
+
 #define PARAM_MAX SNDRV_PCM_HW_PARAM_LAST_INTERVAL
 #define SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP (1<<2)
 
@@ -124,10 +128,29 @@ static void param_set_int(struct snd_pcm_hw_params *p, int n, unsigned int val)
         struct snd_interval *i = param_to_interval(p, n);
         i->min = val;
         i->max = val;
+        i->openmin = 0;
+        i->openmax = 0;
         i->integer = 1;
     }
 }
 
+/* Narrows an interval to [min, max], keeping whatever part of it is already narrower. */
+static void param_set_range(struct snd_pcm_hw_params *p, int n,
+                            unsigned int min, unsigned int max)
+{
+    if (param_is_interval(n)) {
+        struct snd_interval *i = param_to_interval(p, n);
+        if (min > i->min) {
+            i->min = min;
+            i->openmin = 0;
+        }
+        if (max < i->max) {
+            i->max = max;
+            i->openmax = 0;
+        }
+    }
+}
+
 static unsigned int param_get_int(struct snd_pcm_hw_params *p, int n)
 {
     if (param_is_interval(n)) {
@@ -187,11 +210,94 @@ static unsigned int pcm_format_to_alsa(enum pcm_format format)
         return SNDRV_PCM_FORMAT_S32_LE;
     case PCM_FORMAT_S32_BE:
         return SNDRV_PCM_FORMAT_S32_BE;
+
+    case PCM_FORMAT_U8:
+        return SNDRV_PCM_FORMAT_U8;
+
+    case PCM_FORMAT_U16_LE:
+        return SNDRV_PCM_FORMAT_U16_LE;
+    case PCM_FORMAT_U16_BE:
+        return SNDRV_PCM_FORMAT_U16_BE;
+
+    case PCM_FORMAT_U24_LE:
+        return SNDRV_PCM_FORMAT_U24_LE;
+    case PCM_FORMAT_U24_BE:
+        return SNDRV_PCM_FORMAT_U24_BE;
+
+    case PCM_FORMAT_U32_LE:
+        return SNDRV_PCM_FORMAT_U32_LE;
+    case PCM_FORMAT_U32_BE:
+        return SNDRV_PCM_FORMAT_U32_BE;
+
+    case PCM_FORMAT_FLOAT_LE:
+        return SNDRV_PCM_FORMAT_FLOAT_LE;
+    case PCM_FORMAT_FLOAT_BE:
+        return SNDRV_PCM_FORMAT_FLOAT_BE;
+
+    case PCM_FORMAT_FLOAT64_LE:
+        return SNDRV_PCM_FORMAT_FLOAT64_LE;
+    case PCM_FORMAT_FLOAT64_BE:
+        return SNDRV_PCM_FORMAT_FLOAT64_BE;
+
+    case PCM_FORMAT_S20_3LE:
+        return SNDRV_PCM_FORMAT_S20_3LE;
+    case PCM_FORMAT_S20_3BE:
+        return SNDRV_PCM_FORMAT_S20_3BE;
+
+    case PCM_FORMAT_S18_3LE:
+        return SNDRV_PCM_FORMAT_S18_3LE;
+    case PCM_FORMAT_S18_3BE:
+        return SNDRV_PCM_FORMAT_S18_3BE;
     };
 }
 
 #define PCM_ERROR_MAX 128
 
+/* The number of seconds that an output with adaptive latency has to play
+ * without an underrun before its target is lowered */
+#define PCM_ADAPTIVE_CLEAN_SECONDS 10
+
+/** The state of the adaptive latency of an output, see @ref pcm_set_adaptive_latency */
+struct pcm_adaptive {
+    /** Whether adaptive latency is enabled */
+    int enabled;
+    /** The number of frames kept queued */
+    unsigned int target;
+    /** The lowest value of @ref target */
+    unsigned int min;
+    /** The highest value of @ref target */
+    unsigned int max;
+    /** The frames written since the last underrun or change of @ref target */
+    unsigned long clean_frames;
+    /** The start threshold to restore when adaptive latency is disabled */
+    unsigned int start_threshold;
+    /** The avail_min to restore when adaptive latency is disabled */
+    unsigned int avail_min;
+    /** Called when @ref target changes */
+    pcm_latency_callback callback;
+    /** The user data passed to @ref callback */
+    void *data;
+};
+
+/** The counters behind @ref pcm_stats.
+ * They are updated with relaxed atomics so that another thread can read them
+ * while the PCM is streaming.
+ */
+struct pcm_counters {
+    atomic_ulong ioctls[PCM_IOCTL_MAX];
+    atomic_ulong underruns;
+    atomic_ulong overruns;
+    atomic_ulong wakeups;
+    atomic_ullong frames;
+    atomic_ullong poll_time_ns;
+    atomic_ullong copy_time_ns;
+    atomic_ulong lateness_count;
+    atomic_ullong lateness_total_ns;
+    atomic_ullong lateness_min_ns;
+    atomic_ullong lateness_max_ns;
+    atomic_ulong lateness_histogram[PCM_STATS_LATENESS_BUCKETS];
+};
+
 /** A PCM handle.
  * @ingroup libtinyalsa-pcm
  */
@@ -204,12 +310,18 @@ struct pcm {
     int running:1;
     /** Whether or not the PCM has been prepared */
     int prepared:1;
+    /** Whether appl_ptr has been moved without telling the kernel (sync_ptr mode only) */
+    int appl_ptr_pending:1;
+    /** Whether the kernel lacks SNDRV_PCM_IOCTL_STATUS_EXT */
+    int no_status_ext:1;
     /** The number of underruns that have occured */
     int underruns;
     /** Size of the buffer */
     unsigned int buffer_size;
     /** The boundary for ring buffer pointers */
     unsigned int boundary;
+    /** The avail_min sent to the kernel, see @ref pcm_set_avail_min */
+    unsigned int avail_min;
     /** Description of the last error that occured */
     char error[PCM_ERROR_MAX];
     /** Configuration that was passed to @ref pcm_open */
@@ -218,11 +330,21 @@ struct pcm {
     struct snd_pcm_mmap_control *mmap_control;
     struct snd_pcm_sync_ptr *sync_ptr;
     void *mmap_buffer;
+    /** The first sample of each channel in the mmap buffer, for @ref PCM_NONINTERLEAVED */
+    void **mmap_channels;
     unsigned int noirq_frames_per_msec;
     /** The delay of the PCM, in terms of frames */
     long pcm_delay;
     /** The subdevice corresponding to the PCM */
     unsigned int subdevice;
+    /** Runtime statistics, see @ref pcm_get_stats */
+    struct pcm_counters stats;
+    /** The software gain of an mmap playback PCM, see @ref pcm_set_gain */
+    struct pcm_gain *gain;
+    /** The level meter, see @ref pcm_set_metering */
+    struct pcm_meter *meter;
+    /** The adaptive latency of an output, see @ref pcm_set_adaptive_latency */
+    struct pcm_adaptive adaptive;
 };
 
 static int oops(struct pcm *pcm, int e, const char *fmt, ...)
@@ -241,6 +363,101 @@ static int oops(struct pcm *pcm, int e, const char *fmt, ...)
     return -1;
 }
 
+static enum pcm_ioctl pcm_ioctl_type(unsigned long request)
+{
+    switch (request) {
+    case SNDRV_PCM_IOCTL_INFO:
+        return PCM_IOCTL_INFO;
+    case SNDRV_PCM_IOCTL_HW_PARAMS:
+        return PCM_IOCTL_HW_PARAMS;
+    case SNDRV_PCM_IOCTL_SW_PARAMS:
+        return PCM_IOCTL_SW_PARAMS;
+    case SNDRV_PCM_IOCTL_SYNC_PTR:
+        return PCM_IOCTL_SYNC_PTR;
+    case SNDRV_PCM_IOCTL_HWSYNC:
+        return PCM_IOCTL_HWSYNC;
+    case SNDRV_PCM_IOCTL_DELAY:
+        return PCM_IOCTL_DELAY;
+    case SNDRV_PCM_IOCTL_PREPARE:
+        return PCM_IOCTL_PREPARE;
+    case SNDRV_PCM_IOCTL_START:
+        return PCM_IOCTL_START;
+    case SNDRV_PCM_IOCTL_DROP:
+        return PCM_IOCTL_DROP;
+    case SNDRV_PCM_IOCTL_WRITEI_FRAMES:
+        return PCM_IOCTL_WRITEI_FRAMES;
+    case SNDRV_PCM_IOCTL_READI_FRAMES:
+        return PCM_IOCTL_READI_FRAMES;
+    case SNDRV_PCM_IOCTL_WRITEN_FRAMES:
+        return PCM_IOCTL_WRITEN_FRAMES;
+    case SNDRV_PCM_IOCTL_READN_FRAMES:
+        return PCM_IOCTL_READN_FRAMES;
+    case SNDRV_PCM_IOCTL_STATUS:
+#ifdef SNDRV_PCM_IOCTL_STATUS_EXT
+    case SNDRV_PCM_IOCTL_STATUS_EXT:
+#endif
+        return PCM_IOCTL_STATUS;
+    default:
+        return PCM_IOCTL_OTHER;
+    }
+}
+
+#define pcm_stats_add(counter, n) \
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed)
+
+/* Reads the monotonic clock that durations are measured with, in nanoseconds. */
+static unsigned long long pcm_stats_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Reads the clock that the kernel timestamps the PCM with, in nanoseconds. */
+static unsigned long long pcm_stats_clock(const struct pcm *pcm)
+{
+    struct timespec now;
+
+    clock_gettime((pcm->flags & PCM_MONOTONIC) ? CLOCK_MONOTONIC : CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Records how late a wakeup was, in nanoseconds. */
+static void pcm_stats_lateness(struct pcm *pcm, unsigned long long lateness)
+{
+    unsigned long long us = lateness / 1000, value;
+    unsigned int bucket = 0;
+
+    while (us && bucket < PCM_STATS_LATENESS_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    pcm_stats_add(&pcm->stats.lateness_histogram[bucket], 1);
+    pcm_stats_add(&pcm->stats.lateness_count, 1);
+    pcm_stats_add(&pcm->stats.lateness_total_ns, lateness);
+
+    /* a reader may reset the extremes at any time, so they are only
+     * replaced if they did not change in between */
+    value = atomic_load_explicit(&pcm->stats.lateness_min_ns, memory_order_relaxed);
+    while (lateness < value &&
+           !atomic_compare_exchange_weak_explicit(&pcm->stats.lateness_min_ns, &value, lateness,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+    value = atomic_load_explicit(&pcm->stats.lateness_max_ns, memory_order_relaxed);
+    while (lateness > value &&
+           !atomic_compare_exchange_weak_explicit(&pcm->stats.lateness_max_ns, &value, lateness,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+/* all ioctls on the PCM go through here, so that they are counted */
+static int pcm_ioctl(struct pcm *pcm, unsigned long request, void *arg)
+{
+    pcm_stats_add(&pcm->stats.ioctls[pcm_ioctl_type(request)], 1);
+    return ioctl(pcm->fd, request, arg);
+}
+
 /** Gets the buffer size of the PCM.
  * @param pcm A PCM handle.
  * @return The buffer size of the PCM.
@@ -251,6 +468,31 @@ unsigned int pcm_get_buffer_size(const struct pcm *pcm)
     return pcm->buffer_size;
 }
 
+/** Gets the boundary of the PCM.
+ * The positions of the PCM, such as the hardware pointer of
+ * @ref pcm_get_status, wrap around to zero at a multiple of it.
+ * @param pcm A PCM handle.
+ * @return The boundary of the PCM, in frames.
+ * @ingroup libtinyalsa-pcm
+ */
+unsigned int pcm_get_boundary(const struct pcm *pcm)
+{
+    return pcm->boundary;
+}
+
+/** Gets the latency of the PCM.
+ * This is the time it takes to play or capture a full buffer.
+ * @param pcm A PCM handle.
+ * @return The latency of the PCM, in microseconds.
+ * @ingroup libtinyalsa-pcm
+ */
+unsigned int pcm_get_latency(const struct pcm *pcm)
+{
+    if (!pcm->config.rate)
+        return 0;
+    return (unsigned long long)pcm->buffer_size * 1000000 / pcm->config.rate;
+}
+
 /** Gets the channel count of the PCM.
  * @param pcm A PCM handle.
  * @return The channel count of the PCM.
@@ -307,6 +549,16 @@ int pcm_get_file_descriptor(const struct pcm *pcm)
     return pcm->fd;
 }
 
+/** Gets the flags that the PCM was opened with.
+ * @param pcm A PCM handle.
+ * @return The flags passed to @ref pcm_open (e.g. @ref PCM_IN, @ref PCM_MMAP).
+ * @ingroup libtinyalsa-pcm
+ */
+unsigned int pcm_get_flags(const struct pcm *pcm)
+{
+    return pcm->flags;
+}
+
 /** Gets the error message for the last error that occured.
  * If no error occured and this function is called, the results are undefined.
  * @param pcm A PCM handle.
@@ -318,31 +570,49 @@ const char* pcm_get_error(const struct pcm *pcm)
     return pcm->error;
 }
 
-/** Sets the PCM configuration.
- * @param pcm A PCM handle.
- * @param config The configuration to use for the
- *  PCM. This parameter may be NULL, in which case
- *  the default configuration is used.
- * @returns Zero on success, a negative errno value
- *  on failure.
- * @ingroup libtinyalsa-pcm
- * */
-int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
+/* Locates the samples of each channel in the mmap buffer of a
+ * non-interleaved PCM. Only layouts where the samples of a channel are
+ * contiguous are supported, which is what the kernel sets up by default. */
+static int pcm_mmap_channels(struct pcm *pcm)
 {
-    if (pcm == NULL)
-        return -EFAULT;
-    else if (config == NULL) {
-        config = &pcm->config;
-        pcm->config.channels = 2;
-        pcm->config.rate = 48000;
-        pcm->config.period_size = 1024;
-        pcm->config.period_count = 4;
-        pcm->config.format = PCM_FORMAT_S16_LE;
-        pcm->config.start_threshold = config->period_count * config->period_size;
-        pcm->config.stop_threshold = config->period_count * config->period_size;
-        pcm->config.silence_threshold = 0;
-    } else
-        pcm->config = *config;
+    struct snd_pcm_channel_info info;
+    unsigned int bits = pcm_format_to_bits(pcm->config.format);
+    unsigned int channel;
+    void **channels;
+
+    channels = realloc(pcm->mmap_channels, pcm->config.channels * sizeof(*channels));
+    if (!channels) {
+        oops(pcm, ENOMEM, "cannot allocate channel areas");
+        return -ENOMEM;
+    }
+    pcm->mmap_channels = channels;
+
+    for (channel = 0; channel < pcm->config.channels; channel++) {
+        memset(&info, 0, sizeof(info));
+        info.channel = channel;
+        if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_CHANNEL_INFO, &info) < 0) {
+            int errno_copy = errno;
+            oops(pcm, errno, "cannot get channel info");
+            return -errno_copy;
+        }
+        if ((info.step != bits) || (info.first % 8)) {
+            oops(pcm, EINVAL, "unsupported layout of channel %u", channel);
+            return -EINVAL;
+        }
+        channels[channel] = (char *)pcm->mmap_buffer + info.offset + info.first / 8;
+    }
+
+    return 0;
+}
+
+/* Sends the hardware parameters of a configuration and maps the new buffer.
+ * The kernel refuses them while the stream is running or its buffer is
+ * mapped, so the stream is stopped and the old buffer released first. */
+static int pcm_set_hw_params(struct pcm *pcm, const struct pcm_config *config)
+{
+    int layout_changed = !pcm->buffer_size ||
+                         config->format != pcm->config.format ||
+                         config->channels != pcm->config.channels;
 
     struct snd_pcm_hw_params params;
     param_init(&params);
@@ -373,12 +643,29 @@ int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
 
     if (pcm->flags & PCM_MMAP)
         param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
+                   (pcm->flags & PCM_NONINTERLEAVED) ?
+                   SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED :
                    SNDRV_PCM_ACCESS_MMAP_INTERLEAVED);
     else
         param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
+                   (pcm->flags & PCM_NONINTERLEAVED) ?
+                   SNDRV_PCM_ACCESS_RW_NONINTERLEAVED :
                    SNDRV_PCM_ACCESS_RW_INTERLEAVED);
 
-    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_HW_PARAMS, &params)) {
+    if (pcm->buffer_size) {
+        pcm_stop(pcm);
+        if (pcm->mmap_buffer) {
+            munmap(pcm->mmap_buffer, pcm_frames_to_bytes(pcm, pcm->buffer_size));
+            pcm->mmap_buffer = NULL;
+        }
+        pcm->buffer_size = 0;
+    }
+
+    pcm->config.channels = config->channels;
+    pcm->config.rate = config->rate;
+    pcm->config.format = config->format;
+
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_HW_PARAMS, &params)) {
         int errno_copy = errno;
         oops(pcm, -errno, "cannot set hw params");
         return -errno_copy;
@@ -387,47 +674,91 @@ int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
     /* get our refined hw_params */
     pcm->config.period_size = param_get_int(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
     pcm->config.period_count = param_get_int(&params, SNDRV_PCM_HW_PARAM_PERIODS);
-    pcm->buffer_size = config->period_count * config->period_size;
+    pcm->buffer_size = pcm->config.period_count * pcm->config.period_size;
 
     if (pcm->flags & PCM_MMAP) {
         pcm->mmap_buffer = mmap(NULL, pcm_frames_to_bytes(pcm, pcm->buffer_size),
                                 PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED, pcm->fd, 0);
         if (pcm->mmap_buffer == MAP_FAILED) {
             int errno_copy = errno;
+            pcm->mmap_buffer = NULL;
             oops(pcm, -errno, "failed to mmap buffer %d bytes\n",
                  pcm_frames_to_bytes(pcm, pcm->buffer_size));
             return -errno_copy;
         }
+        if (pcm->flags & PCM_NONINTERLEAVED) {
+            int ret = pcm_mmap_channels(pcm);
+            if (ret < 0)
+                return ret;
+        }
+
+        /* a new format or channel count starts again at unity gain */
+        if (!(pcm->flags & PCM_IN) && layout_changed) {
+            pcm_gain_close(pcm->gain);
+            pcm->gain = pcm_gain_open(config->format, config->channels);
+            if (!pcm->gain) {
+                oops(pcm, ENOMEM, "failed to allocate software gain");
+                return -ENOMEM;
+            }
+        }
     }
 
-    struct snd_pcm_sw_params sparams;
-    memset(&sparams, 0, sizeof(sparams));
-    sparams.tstamp_mode = SNDRV_PCM_TSTAMP_ENABLE;
-    sparams.period_step = 1;
-    sparams.avail_min = 1;
+    /* levels are measured again from the new layout */
+    if (pcm->meter && layout_changed) {
+        pcm_meter_close(pcm->meter);
+        pcm->meter = pcm_meter_open(config->format, config->channels);
+        if (!pcm->meter) {
+            oops(pcm, ENOMEM, "failed to allocate level meter");
+            return -ENOMEM;
+        }
+    }
 
-    if (!config->start_threshold) {
-        if (pcm->flags & PCM_IN)
-            pcm->config.start_threshold = sparams.start_threshold = 1;
-        else
-            pcm->config.start_threshold = sparams.start_threshold =
-                config->period_count * config->period_size / 2;
-    } else
-        sparams.start_threshold = config->start_threshold;
+    return 0;
+}
+
+/* Sends the software parameters of a configuration, unless they would not
+ * change anything. Thresholds of zero take the tinyalsa defaults, an
+ * avail_min of zero keeps the current one if it still fits the buffer. */
+static int pcm_set_sw_params(struct pcm *pcm, const struct pcm_config *config,
+                             unsigned int avail_min, int force)
+{
+    unsigned int start_threshold, stop_threshold;
+
+    if (config->start_threshold)
+        start_threshold = config->start_threshold;
+    else if (pcm->flags & PCM_IN)
+        start_threshold = 1;
+    else
+        start_threshold = pcm->buffer_size / 2;
 
     /* pick a high stop threshold - todo: does this need further tuning */
-    if (!config->stop_threshold) {
-        if (pcm->flags & PCM_IN)
-            pcm->config.stop_threshold = sparams.stop_threshold =
-                config->period_count * config->period_size * 10;
-        else
-            pcm->config.stop_threshold = sparams.stop_threshold =
-                config->period_count * config->period_size;
-    }
+    if (config->stop_threshold)
+        stop_threshold = config->stop_threshold;
+    else if (pcm->flags & PCM_IN)
+        stop_threshold = pcm->buffer_size * 10;
     else
-        sparams.stop_threshold = config->stop_threshold;
+        stop_threshold = pcm->buffer_size;
+
+    if (!avail_min)
+        avail_min = pcm->avail_min;
+    if (!avail_min || avail_min > pcm->buffer_size)
+        avail_min = 1;
+
+    if (!force &&
+        start_threshold == pcm->config.start_threshold &&
+        stop_threshold == pcm->config.stop_threshold &&
+        config->silence_threshold == pcm->config.silence_threshold &&
+        avail_min == pcm->avail_min)
+        return 0;
 
-    sparams.xfer_align = config->period_size / 2; /* needed for old kernels */
+    struct snd_pcm_sw_params sparams;
+    memset(&sparams, 0, sizeof(sparams));
+    sparams.tstamp_mode = SNDRV_PCM_TSTAMP_ENABLE;
+    sparams.period_step = 1;
+    sparams.avail_min = avail_min;
+    sparams.start_threshold = start_threshold;
+    sparams.stop_threshold = stop_threshold;
+    sparams.xfer_align = pcm->config.period_size / 2; /* needed for old kernels */
     sparams.silence_size = 0;
     sparams.silence_threshold = config->silence_threshold;
     pcm->boundary = sparams.boundary = pcm->buffer_size;
@@ -435,15 +766,86 @@ int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
     while (pcm->boundary * 2 <= INT_MAX - pcm->buffer_size)
         pcm->boundary *= 2;
 
-    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_SW_PARAMS, &sparams)) {
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_SW_PARAMS, &sparams)) {
         int errno_copy = errno;
         oops(pcm, -errno, "cannot set sw params");
         return -errno_copy;
     }
 
+    pcm->config.start_threshold = start_threshold;
+    pcm->config.stop_threshold = stop_threshold;
+    pcm->config.silence_threshold = config->silence_threshold;
+    pcm->avail_min = avail_min;
+
+    /* in sync_ptr mode our copy of the control page is sent back with
+     * every sync, so it has to follow */
+    if (pcm->mmap_control)
+        pcm->mmap_control->avail_min = avail_min;
+
     return 0;
 }
 
+/** Sets the PCM configuration.
+ * If the PCM is already configured, only what changed is sent to the kernel:
+ * nothing at all if the configuration is the same, only the software
+ * parameters if only the thresholds differ. The value set with
+ * @ref pcm_set_avail_min is kept while it fits the buffer.
+ * Otherwise the stream is stopped and its buffer is mapped again.
+ * @param pcm A PCM handle.
+ * @param config The configuration to use for the
+ *  PCM. This parameter may be NULL, in which case
+ *  the default configuration is used.
+ * @returns Zero on success, a negative errno value
+ *  on failure.
+ * @ingroup libtinyalsa-pcm
+ * */
+int pcm_set_config(struct pcm *pcm, const struct pcm_config *config)
+{
+    struct pcm_config default_config;
+    int hw_changed, adaptive;
+
+    if (pcm == NULL)
+        return -EFAULT;
+
+    /* the new thresholds replace those of adaptive latency. The kernel still
+     * has the adaptive ones, so the thresholds it had before are restored
+     * and the software parameters are sent whatever they are. */
+    adaptive = pcm->adaptive.enabled;
+    if (adaptive) {
+        pcm->adaptive.enabled = 0;
+        pcm->config.start_threshold = pcm->adaptive.start_threshold;
+        pcm->avail_min = pcm->adaptive.avail_min;
+    }
+
+    if (config == NULL) {
+        memset(&default_config, 0, sizeof(default_config));
+        default_config.channels = 2;
+        default_config.rate = 48000;
+        default_config.period_size = 1024;
+        default_config.period_count = 4;
+        default_config.format = PCM_FORMAT_S16_LE;
+        default_config.start_threshold = default_config.period_count * default_config.period_size;
+        default_config.stop_threshold = default_config.period_count * default_config.period_size;
+        default_config.silence_threshold = 0;
+        config = &default_config;
+    }
+
+    hw_changed = !pcm->buffer_size ||
+                 config->channels != pcm->config.channels ||
+                 config->rate != pcm->config.rate ||
+                 config->format != pcm->config.format ||
+                 config->period_size != pcm->config.period_size ||
+                 config->period_count != pcm->config.period_count;
+
+    if (hw_changed) {
+        int ret = pcm_set_hw_params(pcm, config);
+        if (ret < 0)
+            return ret;
+    }
+
+    return pcm_set_sw_params(pcm, config, 0, hw_changed || adaptive);
+}
+
 /** Gets the subdevice on which the pcm has been opened.
  * @param pcm A PCM handle.
  * @return The subdevice on which the pcm has been opened */
@@ -460,23 +862,78 @@ unsigned int pcm_get_subdevice(const struct pcm *pcm)
 unsigned int pcm_format_to_bits(enum pcm_format format)
 {
     switch (format) {
+    case PCM_FORMAT_FLOAT64_LE:
+    case PCM_FORMAT_FLOAT64_BE:
+        return 64;
     case PCM_FORMAT_S32_LE:
     case PCM_FORMAT_S32_BE:
     case PCM_FORMAT_S24_LE:
     case PCM_FORMAT_S24_BE:
+    case PCM_FORMAT_U32_LE:
+    case PCM_FORMAT_U32_BE:
+    case PCM_FORMAT_U24_LE:
+    case PCM_FORMAT_U24_BE:
+    case PCM_FORMAT_FLOAT_LE:
+    case PCM_FORMAT_FLOAT_BE:
         return 32;
     case PCM_FORMAT_S24_3LE:
     case PCM_FORMAT_S24_3BE:
+    case PCM_FORMAT_S20_3LE:
+    case PCM_FORMAT_S20_3BE:
+    case PCM_FORMAT_S18_3LE:
+    case PCM_FORMAT_S18_3BE:
         return 24;
     default:
     case PCM_FORMAT_S16_LE:
     case PCM_FORMAT_S16_BE:
+    case PCM_FORMAT_U16_LE:
+    case PCM_FORMAT_U16_BE:
         return 16;
     case PCM_FORMAT_S8:
+    case PCM_FORMAT_U8:
         return 8;
     };
 }
 
+/** Fills a buffer with silence.
+ * Silence is zero, except for unsigned formats, where it is half of the range.
+ * @param format The format of @p data.
+ * @param data The buffer to fill.
+ * @param samples The number of samples to fill.
+ * @ingroup libtinyalsa-pcm
+ */
+void pcm_format_set_silence(enum pcm_format format, void *data, unsigned int samples)
+{
+    unsigned int bytes = pcm_format_to_bits(format) / 8;
+    unsigned char silence[4] = { 0, 0, 0, 0 };
+    unsigned int n;
+
+    /* Set the most significant bit */
+    switch (format) {
+    case PCM_FORMAT_U8:
+    case PCM_FORMAT_U16_BE:
+    case PCM_FORMAT_U32_BE:
+        silence[0] = 0x80;
+        break;
+    case PCM_FORMAT_U16_LE:
+    case PCM_FORMAT_U24_BE:
+        silence[1] = 0x80;
+        break;
+    case PCM_FORMAT_U24_LE:
+        silence[2] = 0x80;
+        break;
+    case PCM_FORMAT_U32_LE:
+        silence[3] = 0x80;
+        break;
+    default:
+        memset(data, 0, samples * bytes);
+        return;
+    }
+
+    for (n = 0; n < samples; n++)
+        memcpy((char *)data + n * bytes, silence, bytes);
+}
+
 /** Determines how many frames of a PCM can fit into a number of bytes.
  * @param pcm A PCM handle.
  * @param bytes The number of bytes.
@@ -505,13 +962,27 @@ static int pcm_sync_ptr(struct pcm *pcm, int flags)
 {
     if (pcm->sync_ptr) {
         pcm->sync_ptr->flags = flags;
-        if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_SYNC_PTR, pcm->sync_ptr) < 0) {
+        if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_SYNC_PTR, pcm->sync_ptr) < 0) {
             oops(pcm, errno, "failed to sync mmap ptr");
             return -1;
         }
+        pcm->appl_ptr_pending = 0;
         return 0;
     }
-    return -1;
+
+    if (!pcm->mmap_status || !pcm->mmap_control)
+        return -1;
+
+    /* status and control are mapped, so they are already shared with the
+     * kernel. Only a stream without period interrupts needs to ask for
+     * hw_ptr to be updated. */
+    if ((flags & SNDRV_PCM_SYNC_PTR_HWSYNC) && (pcm->flags & PCM_NOIRQ)) {
+        if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_HWSYNC, NULL) < 0) {
+            oops(pcm, errno, "failed to sync hw ptr");
+            return -1;
+        }
+    }
+    return 0;
 }
 
 static int pcm_hw_mmap_status(struct pcm *pcm)
@@ -536,7 +1007,7 @@ static int pcm_hw_mmap_status(struct pcm *pcm)
         pcm->mmap_status = NULL;
         goto mmap_error;
     }
-    pcm->mmap_control->avail_min = 1;
+    pcm->mmap_control->avail_min = pcm->avail_min;
 
     return 0;
 
@@ -547,7 +1018,7 @@ mmap_error:
         return -ENOMEM;
     pcm->mmap_status = &pcm->sync_ptr->s.status;
     pcm->mmap_control = &pcm->sync_ptr->c.control;
-    pcm->mmap_control->avail_min = 1;
+    pcm->mmap_control->avail_min = pcm->avail_min;
     pcm_sync_ptr(pcm, 0);
 
     return 0;
@@ -568,47 +1039,125 @@ static void pcm_hw_munmap_status(struct pcm *pcm) {
     pcm->mmap_control = NULL;
 }
 
+/* Copies frames between the buffer and the application while scaling playback
+ * by the software gain and metering either direction, so that the samples are
+ * only touched once. For a non-interleaved PCM, dst and src are arrays of one
+ * buffer per channel, otherwise they point to a single buffer.
+ * Returns zero if there is nothing to do but copy, which is left to the caller. */
+static int pcm_process_copy(struct pcm *pcm, void *const *dst, unsigned int dst_offset,
+                            const void *const *src, unsigned int src_offset,
+                            unsigned int frames)
+{
+    char *dst_frames, *src_frames;
+
+    if (pcm->flags & PCM_NONINTERLEAVED) {
+        if (!(pcm->flags & PCM_IN) && pcm->gain &&
+            pcm_gain_apply_planar(pcm->gain, pcm->meter, dst, dst_offset,
+                                  src, src_offset, frames))
+            return 1;
+        if (!pcm->meter)
+            return 0;
+        pcm_meter_copy_planar(pcm->meter, dst, dst_offset, src, src_offset, frames);
+        return 1;
+    }
+
+    dst_frames = (char *)dst[0] + pcm_frames_to_bytes(pcm, dst_offset);
+    src_frames = (char *)src[0] + pcm_frames_to_bytes(pcm, src_offset);
+    if (!(pcm->flags & PCM_IN) && pcm->gain &&
+        pcm_gain_apply(pcm->gain, pcm->meter, dst_frames, src_frames, frames))
+        return 1;
+    if (!pcm->meter)
+        return 0;
+    pcm_meter_copy(pcm->meter, dst_frames, src_frames, frames);
+    return 1;
+}
+
+/* For a non-interleaved PCM, buf is an array of one buffer per channel */
 static int pcm_areas_copy(struct pcm *pcm, unsigned int pcm_offset,
-                          char *buf, unsigned int src_offset,
+                          void *buf, unsigned int src_offset,
                           unsigned int frames)
 {
     int size_bytes = pcm_frames_to_bytes(pcm, frames);
     int pcm_offset_bytes = pcm_frames_to_bytes(pcm, pcm_offset);
     int src_offset_bytes = pcm_frames_to_bytes(pcm, src_offset);
+    void *areas = pcm->mmap_buffer;
+
+    if (pcm->gain || pcm->meter) {
+        void *const *pcm_areas = (pcm->flags & PCM_NONINTERLEAVED) ?
+                                 pcm->mmap_channels : &areas;
+        void *const *bufs = (pcm->flags & PCM_NONINTERLEAVED) ? buf : &buf;
+        int processed;
+
+        if (pcm->flags & PCM_IN)
+            processed = pcm_process_copy(pcm, bufs, src_offset,
+                                         (const void *const *)pcm_areas, pcm_offset, frames);
+        else
+            processed = pcm_process_copy(pcm, pcm_areas, pcm_offset,
+                                         (const void *const *)bufs, src_offset, frames);
+        if (processed)
+            return 0;
+    }
+
+    if (pcm->flags & PCM_NONINTERLEAVED) {
+        unsigned int sample_bytes = pcm_format_to_bits(pcm->config.format) >> 3;
+        char **bufs = buf;
+        unsigned int channel;
+        char *area;
+
+        for (channel = 0; channel < pcm->config.channels; channel++) {
+            area = (char *)pcm->mmap_channels[channel] + pcm_offset * sample_bytes;
+            if (pcm->flags & PCM_IN)
+                memcpy(bufs[channel] + src_offset * sample_bytes, area,
+                       frames * sample_bytes);
+            else
+                memcpy(area, bufs[channel] + src_offset * sample_bytes,
+                       frames * sample_bytes);
+        }
+        return 0;
+    }
 
-    /* interleaved only atm */
     if (pcm->flags & PCM_IN)
-        memcpy(buf + src_offset_bytes,
+        memcpy((char*)buf + src_offset_bytes,
                (char*)pcm->mmap_buffer + pcm_offset_bytes,
                size_bytes);
     else
         memcpy((char*)pcm->mmap_buffer + pcm_offset_bytes,
-               buf + src_offset_bytes,
+               (char*)buf + src_offset_bytes,
                size_bytes);
     return 0;
 }
 
-static int pcm_mmap_transfer_areas(struct pcm *pcm, char *buf,
+static void pcm_mmap_appl_forward(struct pcm *pcm, int frames);
+
+/* Copies frames that are known to be available, which means that the copy
+ * wraps around the end of the buffer at most once. The pointers are not
+ * synced here, the new appl_ptr is left pending until the next sync. */
+static int pcm_mmap_transfer_areas(struct pcm *pcm, void *buf,
                                 unsigned int offset, unsigned int size)
 {
-    void *pcm_areas;
-    int commit;
-    unsigned int pcm_offset, frames, count = 0;
+    unsigned int pcm_offset, frames, continuous, count = 0;
+    unsigned long long start;
 
     while (size > 0) {
+        pcm_offset = pcm->mmap_control->appl_ptr % pcm->buffer_size;
+        continuous = pcm->buffer_size - pcm_offset;
         frames = size;
-        pcm_mmap_begin(pcm, &pcm_areas, &pcm_offset, &frames);
+        if (frames > continuous)
+            frames = continuous;
+
+        start = pcm_stats_time();
         pcm_areas_copy(pcm, pcm_offset, buf, offset, frames);
-        commit = pcm_mmap_commit(pcm, pcm_offset, frames);
-        if (commit < 0) {
-            oops(pcm, commit, "failed to commit %d frames\n", frames);
-            return commit;
-        }
+        pcm_stats_add(&pcm->stats.copy_time_ns, pcm_stats_time() - start);
+        pcm_mmap_appl_forward(pcm, frames);
 
-        offset += commit;
-        count += commit;
-        size -= commit;
+        offset += frames;
+        count += frames;
+        size -= frames;
     }
+
+    if (pcm->sync_ptr)
+        pcm->appl_ptr_pending = 1;
+
     return count;
 }
 
@@ -659,77 +1208,268 @@ int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail,
     return 0;
 }
 
-/** Writes audio samples to PCM.
- * If the PCM has not been started, it is started in this function.
- * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
- * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
- * @param pcm A PCM handle.
- * @param data The audio sample array
- * @param frame_count The number of frames occupied by the sample array.
- *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
- *  or INT_MAX.
- * @return On success, this function returns the number of frames written; otherwise, a negative number.
- * @ingroup libtinyalsa-pcm
- */
-int pcm_writei(struct pcm *pcm, const void *data, unsigned int frame_count)
+static inline int pcm_mmap_playback_avail(struct pcm *pcm);
+
+/* Sends the thresholds that keep the target of an adaptive output queued,
+ * and announces the new target. */
+static int pcm_adaptive_apply(struct pcm *pcm)
 {
-    struct snd_xferi x;
+    struct pcm_config config = pcm->config;
+    int ret;
+
+    /* the stream starts once the target is queued, and a waiting writer
+     * wakes up as soon as less than the target is queued */
+    config.start_threshold = pcm->adaptive.target;
+    ret = pcm_set_sw_params(pcm, &config,
+                            pcm->buffer_size - pcm->adaptive.target + 1, 0);
+    if (ret < 0)
+        return ret;
+
+    pcm->adaptive.clean_frames = 0;
+    if (pcm->adaptive.callback)
+        pcm->adaptive.callback(pcm, pcm->adaptive.target, pcm->adaptive.data);
+    return 0;
+}
 
+/* Counts an xrun. An adaptive output raises its target by a period. */
+static void pcm_xrun(struct pcm *pcm)
+{
+    pcm->underruns++;
     if (pcm->flags & PCM_IN)
-        return -EINVAL;
-#if UINT_MAX > TINYALSA_FRAMES_MAX
-    if (frame_count > TINYALSA_FRAMES_MAX)
-        return -EINVAL;
-#endif
-    if (frame_count > INT_MAX)
-        return -EINVAL;
+        pcm_stats_add(&pcm->stats.overruns, 1);
+    else
+        pcm_stats_add(&pcm->stats.underruns, 1);
 
-    x.buf = (void*)data;
-    x.frames = frame_count;
-    x.result = 0;
+    if (!pcm->adaptive.enabled)
+        return;
+    pcm->adaptive.clean_frames = 0;
+    if (pcm->adaptive.target >= pcm->adaptive.max)
+        return;
+
+    pcm->adaptive.target += pcm->config.period_size;
+    if (pcm->adaptive.target > pcm->adaptive.max)
+        pcm->adaptive.target = pcm->adaptive.max;
+    pcm_adaptive_apply(pcm);
+}
+
+/* Counts frames written to an adaptive output, which lowers its target by
+ * half a period after each PCM_ADAPTIVE_CLEAN_SECONDS without an underrun. */
+static void pcm_adaptive_written(struct pcm *pcm, unsigned int frames)
+{
+    unsigned int step;
+
+    if (!pcm->adaptive.enabled)
+        return;
+    pcm->adaptive.clean_frames += frames;
+    if (pcm->adaptive.clean_frames <
+        (unsigned long)pcm->config.rate * PCM_ADAPTIVE_CLEAN_SECONDS)
+        return;
+    pcm->adaptive.clean_frames = 0;
+    if (pcm->adaptive.target <= pcm->adaptive.min)
+        return;
+
+    step = pcm->config.period_size / 2;
+    if (!step)
+        step = 1;
+    if (pcm->adaptive.target - pcm->adaptive.min < step)
+        pcm->adaptive.target = pcm->adaptive.min;
+    else
+        pcm->adaptive.target -= step;
+    pcm_adaptive_apply(pcm);
+}
+
+/* Waits until an adaptive output has less than its target queued, and
+ * returns the number of frames that can be written without exceeding it. */
+static int pcm_adaptive_room(struct pcm *pcm)
+{
+    for (;;) {
+        unsigned int avail;
+        int ret;
+
+        /* a stream that is not running is prepared again, and so empty, by the next write */
+        if (!pcm->running)
+            return pcm->adaptive.target;
+
+        /* the kernel moves appl_ptr on writes, so it is read back with hw_ptr */
+        if (pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC | SNDRV_PCM_SYNC_PTR_APPL) < 0)
+            return -errno;
+        avail = pcm_mmap_playback_avail(pcm);
+        if (avail + pcm->adaptive.target > pcm->buffer_size)
+            return avail + pcm->adaptive.target - pcm->buffer_size;
+
+        if (pcm->flags & PCM_NONBLOCK)
+            return -EAGAIN;
+        ret = pcm_wait(pcm, -1);
+        /* an xrun is reported, and recovered from, by the write */
+        if (ret == -EPIPE)
+            return pcm->adaptive.target;
+        if (ret < 0)
+            return ret;
+    }
+}
+
+/* Issues a WRITEI or WRITEN ioctl, preparing the PCM first if it is not
+ * running and restarting it after an underrun */
+static int pcm_write_transfer(struct pcm *pcm, unsigned long request, void *xfer,
+                              const snd_pcm_sframes_t *result)
+{
     for (;;) {
         if (!pcm->running) {
-            int prepare_error = pcm_prepare(pcm);
-            if (prepare_error)
-                return prepare_error;
-            if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x))
-                return oops(pcm, errno, "cannot write initial data");
+            if (pcm_prepare(pcm) < 0)
+                return -errno;
+            if (pcm_ioctl(pcm, request, xfer)) {
+                int errno_copy = errno;
+                if (errno_copy == EAGAIN)
+                    return -EAGAIN;
+                oops(pcm, errno_copy, "cannot write initial data");
+                return -errno_copy;
+            }
             pcm->running = 1;
-            return 0;
+            pcm_stats_add(&pcm->stats.frames, *result);
+            pcm_adaptive_written(pcm, *result);
+            return *result;
         }
-        if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x)) {
+        if (pcm_ioctl(pcm, request, xfer)) {
+            int errno_copy = errno;
+            if (errno_copy == EAGAIN)
+                return -EAGAIN;
             pcm->prepared = 0;
             pcm->running = 0;
-            if (errno == EPIPE) {
+            if (errno_copy == EPIPE) {
                 /* we failed to make our window -- try to restart if we are
                  * allowed to do so.  Otherwise, simply allow the EPIPE error to
                  * propagate up to the app level */
-                pcm->underruns++;
+                pcm_xrun(pcm);
                 if (pcm->flags & PCM_NORESTART)
                     return -EPIPE;
                 continue;
             }
-            return oops(pcm, errno, "cannot write stream data");
+            oops(pcm, errno_copy, "cannot write stream data");
+            return -errno_copy;
         }
-        return x.result;
+        pcm_stats_add(&pcm->stats.frames, *result);
+        pcm_adaptive_written(pcm, *result);
+        return *result;
     }
 }
 
-/** Reads audio samples from PCM.
- * If the PCM has not been started, it is started in this function.
- * This function is only valid for PCMs opened with the @ref PCM_IN flag.
- * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
- * @param pcm A PCM handle.
- * @param data The audio sample array
- * @param frame_count The number of frames occupied by the sample array.
- *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
- *  or INT_MAX.
- * @return On success, this function returns the number of frames written; otherwise, a negative number.
+/* Issues a READI or READN ioctl, starting the PCM first if it is not
+ * running and restarting it after an overrun */
+static int pcm_read_transfer(struct pcm *pcm, unsigned long request, void *xfer,
+                             const snd_pcm_sframes_t *result)
+{
+    for (;;) {
+        if ((!pcm->running) && (pcm_start(pcm) < 0))
+            return -errno;
+        else if (pcm_ioctl(pcm, request, xfer)) {
+            int errno_copy = errno;
+            if (errno_copy == EAGAIN)
+                return -EAGAIN;
+            pcm->prepared = 0;
+            pcm->running = 0;
+            if (errno_copy == EPIPE) {
+                    /* we failed to make our window -- try to restart */
+                pcm_xrun(pcm);
+                continue;
+            }
+            oops(pcm, errno_copy, "cannot read stream data");
+            return -errno_copy;
+        }
+        pcm_stats_add(&pcm->stats.frames, *result);
+        return *result;
+    }
+}
+
+/* Writes to an adaptive output in pieces that never queue more than its target. */
+static int pcm_adaptive_writei(struct pcm *pcm, const void *data, unsigned int frame_count)
+{
+    unsigned int written = 0;
+    struct snd_xferi x;
+    int room, ret;
+
+    while (written < frame_count) {
+        room = pcm_adaptive_room(pcm);
+        if (room < 0)
+            return written ? (int)written : room;
+
+        x.buf = (char *)data + pcm_frames_to_bytes(pcm, written);
+        x.frames = frame_count - written;
+        if (x.frames > (unsigned int)room)
+            x.frames = room;
+        x.result = 0;
+        ret = pcm_write_transfer(pcm, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x, &x.result);
+        if (ret < 0)
+            return written ? (int)written : ret;
+        if (ret > 0 && pcm->meter)
+            pcm_meter_copy(pcm->meter, NULL, x.buf, ret);
+        written += ret;
+        if ((pcm->flags & PCM_NONBLOCK) && (unsigned int)ret < x.frames)
+            break;
+    }
+    return written;
+}
+
+/** Writes audio samples to PCM.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
+ * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
+ * If the PCM was opened with @ref PCM_NONBLOCK, fewer frames than requested
+ * may be written, and -EAGAIN is returned if there is no room for any frame.
+ * An underrun is recovered from in the same way as in blocking mode,
+ * since preparing the PCM does not block.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param frame_count The number of frames occupied by the sample array.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames written; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_writei(struct pcm *pcm, const void *data, unsigned int frame_count)
+{
+    struct snd_xferi x;
+    int ret;
+
+    if (pcm->flags & PCM_IN)
+        return -EINVAL;
+#if UINT_MAX > TINYALSA_FRAMES_MAX
+    if (frame_count > TINYALSA_FRAMES_MAX)
+        return -EINVAL;
+#endif
+    if (frame_count > INT_MAX)
+        return -EINVAL;
+
+    if (pcm->adaptive.enabled)
+        return pcm_adaptive_writei(pcm, data, frame_count);
+
+    x.buf = (void*)data;
+    x.frames = frame_count;
+    x.result = 0;
+    ret = pcm_write_transfer(pcm, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x, &x.result);
+    /* the frames are metered while the copy made by the kernel is still in the cache */
+    if (ret > 0 && pcm->meter)
+        pcm_meter_copy(pcm->meter, NULL, data, ret);
+    return ret;
+}
+
+/** Reads audio samples from PCM.
+ * If the PCM has not been started, it is started in this function.
+ * This function is only valid for PCMs opened with the @ref PCM_IN flag.
+ * This function is not valid for PCMs opened with the @ref PCM_MMAP flag.
+ * If the PCM was opened with @ref PCM_NONBLOCK, fewer frames than requested
+ * may be read, and -EAGAIN is returned if no frame has been captured yet.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param frame_count The number of frames occupied by the sample array.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames written; otherwise, a negative number.
  * @ingroup libtinyalsa-pcm
  */
 int pcm_readi(struct pcm *pcm, void *data, unsigned int frame_count)
 {
     struct snd_xferi x;
+    int ret;
 
     if (!(pcm->flags & PCM_IN))
         return -EINVAL;
@@ -743,21 +1483,96 @@ int pcm_readi(struct pcm *pcm, void *data, unsigned int frame_count)
     x.buf = data;
     x.frames = frame_count;
     x.result = 0;
-    for (;;) {
-        if ((!pcm->running) && (pcm_start(pcm) < 0))
-            return -errno;
-        else if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_READI_FRAMES, &x)) {
-            pcm->prepared = 0;
-            pcm->running = 0;
-            if (errno == EPIPE) {
-                    /* we failed to make our window -- try to restart */
-                pcm->underruns++;
-                continue;
-            }
-            return oops(pcm, errno, "cannot read stream data");
-        }
-        return x.result;
+    ret = pcm_read_transfer(pcm, SNDRV_PCM_IOCTL_READI_FRAMES, &x, &x.result);
+    if (ret > 0 && pcm->meter)
+        pcm_meter_copy(pcm->meter, NULL, data, ret);
+    return ret;
+}
+
+static int pcm_mmap_transfer_frames(struct pcm *pcm, void *buffer, unsigned int count);
+
+/** Writes non-interleaved audio samples to PCM.
+ * This function is only valid for PCMs opened with the
+ * @ref PCM_OUT and @ref PCM_NONINTERLEAVED flags.
+ * If the PCM was opened with @ref PCM_MMAP, the samples are copied
+ * into the mmap buffer as with @ref pcm_mmap_write.
+ * Otherwise, it behaves like @ref pcm_writei.
+ * @param pcm A PCM handle.
+ * @param data An array of one sample buffer per channel.
+ * @param frame_count The number of samples in each buffer.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames written; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_writen(struct pcm *pcm, void **data, unsigned int frame_count)
+{
+    struct snd_xfern x;
+    int ret;
+
+    if ((pcm->flags & PCM_IN) || !(pcm->flags & PCM_NONINTERLEAVED))
+        return -EINVAL;
+#if UINT_MAX > TINYALSA_FRAMES_MAX
+    if (frame_count > TINYALSA_FRAMES_MAX)
+        return -EINVAL;
+#endif
+    if (frame_count > INT_MAX)
+        return -EINVAL;
+
+    if (pcm->flags & PCM_MMAP) {
+        ret = pcm_mmap_transfer_frames(pcm, data, frame_count);
+        return (ret == 0) ? (int)frame_count : ret;
     }
+
+    x.bufs = data;
+    x.frames = frame_count;
+    x.result = 0;
+    ret = pcm_write_transfer(pcm, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &x, &x.result);
+    if (ret > 0 && pcm->meter)
+        pcm_meter_copy_planar(pcm->meter, NULL, 0, (const void *const *)data, 0, ret);
+    return ret;
+}
+
+/** Reads non-interleaved audio samples from PCM.
+ * This function is only valid for PCMs opened with the
+ * @ref PCM_IN and @ref PCM_NONINTERLEAVED flags.
+ * If the PCM was opened with @ref PCM_MMAP, the samples are copied
+ * out of the mmap buffer as with @ref pcm_mmap_read.
+ * Otherwise, it behaves like @ref pcm_readi.
+ * @param pcm A PCM handle.
+ * @param data An array of one sample buffer per channel.
+ * @param frame_count The number of samples that fit in each buffer.
+ *  This value should not be greater than @ref TINYALSA_FRAMES_MAX
+ *  or INT_MAX.
+ * @return On success, this function returns the number of frames read; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_readn(struct pcm *pcm, void **data, unsigned int frame_count)
+{
+    struct snd_xfern x;
+    int ret;
+
+    if (!(pcm->flags & PCM_IN) || !(pcm->flags & PCM_NONINTERLEAVED))
+        return -EINVAL;
+#if UINT_MAX > TINYALSA_FRAMES_MAX
+    if (frame_count > TINYALSA_FRAMES_MAX)
+        return -EINVAL;
+#endif
+    if (frame_count > INT_MAX)
+        return -EINVAL;
+
+    if (pcm->flags & PCM_MMAP) {
+        ret = pcm_mmap_transfer_frames(pcm, data, frame_count);
+        return (ret == 0) ? (int)frame_count : ret;
+    }
+
+    x.bufs = data;
+    x.frames = frame_count;
+    x.result = 0;
+    ret = pcm_read_transfer(pcm, SNDRV_PCM_IOCTL_READN_FRAMES, &x, &x.result);
+    if (ret > 0 && pcm->meter)
+        pcm_meter_copy_planar(pcm->meter, NULL, 0, (const void *const *)data, 0, ret);
+    return ret;
 }
 
 /** Writes audio samples to PCM.
@@ -995,6 +1810,9 @@ int pcm_close(struct pcm *pcm)
         pcm_stop(pcm);
         munmap(pcm->mmap_buffer, pcm_frames_to_bytes(pcm, pcm->buffer_size));
     }
+    free(pcm->mmap_channels);
+    pcm_gain_close(pcm->gain);
+    pcm_meter_close(pcm->meter);
 
     if (pcm->fd >= 0)
         close(pcm->fd);
@@ -1016,6 +1834,8 @@ int pcm_close(struct pcm *pcm)
  *   - @ref PCM_MMAP
  *   - @ref PCM_NOIRQ
  *   - @ref PCM_MONOTONIC
+ *   - @ref PCM_NONBLOCK
+ *   - @ref PCM_NONINTERLEAVED
  * @param config The hardware and software parameters to open the PCM with.
  * @returns A PCM structure.
  *  If an error occurs allocating memory for the PCM, NULL is returned.
@@ -1038,53 +1858,45 @@ struct pcm *pcm_open_by_name(const char *name,
   return pcm_open(card, device, flags, config);
 }
 
-/** Opens a PCM.
- * @param card The card that the pcm belongs to.
- *  The default card is zero.
- * @param device The device that the pcm belongs to.
- *  The default device is zero.
- * @param flags Specify characteristics and functionality about the pcm.
- *  May be a bitwise AND of the following:
- *   - @ref PCM_IN
- *   - @ref PCM_OUT
- *   - @ref PCM_MMAP
- *   - @ref PCM_NOIRQ
- *   - @ref PCM_MONOTONIC
- * @param config The hardware and software parameters to open the PCM with.
- * @returns A PCM structure.
- *  If an error occurs allocating memory for the PCM, NULL is returned.
- *  Otherwise, client code should check that the PCM opened properly by calling @ref pcm_is_ready.
- *  If @ref pcm_is_ready, check @ref pcm_get_error for more information.
- * @ingroup libtinyalsa-pcm
- */
-struct pcm *pcm_open(unsigned int card, unsigned int device,
-                     unsigned int flags, const struct pcm_config *config)
+/* Opens the device of a PCM, without configuring it. */
+static struct pcm *pcm_open_device(unsigned int card, unsigned int device,
+                                   unsigned int flags)
 {
     struct pcm *pcm;
     struct snd_pcm_info info;
     char fn[256];
-    int rc;
 
     pcm = calloc(1, sizeof(struct pcm));
     if (!pcm)
         return &bad_pcm;
+    pcm_reset_stats(pcm);
 
     snprintf(fn, sizeof(fn), "/dev/snd/pcmC%uD%u%c", card, device,
              flags & PCM_IN ? 'c' : 'p');
 
     pcm->flags = flags;
-    pcm->fd = open(fn, O_RDWR);
+    pcm->fd = open(fn, (flags & PCM_NONBLOCK) ? (O_RDWR | O_NONBLOCK) : O_RDWR);
     if (pcm->fd < 0) {
         oops(pcm, errno, "cannot open device '%s'", fn);
         return pcm;
     }
 
-    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_INFO, &info)) {
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_INFO, &info)) {
         oops(pcm, errno, "cannot get info");
-        goto fail_close;
+        close(pcm->fd);
+        pcm->fd = -1;
+        return pcm;
     }
     pcm->subdevice = info.subdevice;
 
+    return pcm;
+}
+
+/* Configures a PCM opened by pcm_open_device(), closing it on failure. */
+static struct pcm *pcm_open_config(struct pcm *pcm, const struct pcm_config *config)
+{
+    int rc;
+
     if (pcm_set_config(pcm, config) != 0)
         goto fail_close;
 
@@ -1097,7 +1909,7 @@ struct pcm *pcm_open(unsigned int card, unsigned int device,
 #ifdef SNDRV_PCM_IOCTL_TTSTAMP
     if (pcm->flags & PCM_MONOTONIC) {
         int arg = SNDRV_PCM_TSTAMP_TYPE_MONOTONIC;
-        rc = ioctl(pcm->fd, SNDRV_PCM_IOCTL_TTSTAMP, &arg);
+        rc = pcm_ioctl(pcm, SNDRV_PCM_IOCTL_TTSTAMP, &arg);
         if (rc < 0) {
             oops(pcm, rc, "cannot set timestamp type");
             goto fail;
@@ -1109,7 +1921,7 @@ struct pcm *pcm_open(unsigned int card, unsigned int device,
     return pcm;
 
 fail:
-    if (flags & PCM_MMAP)
+    if (pcm->flags & PCM_MMAP)
         munmap(pcm->mmap_buffer, pcm_frames_to_bytes(pcm, pcm->buffer_size));
 fail_close:
     close(pcm->fd);
@@ -1117,6 +1929,284 @@ fail_close:
     return pcm;
 }
 
+/** Opens a PCM.
+ * @param card The card that the pcm belongs to.
+ *  The default card is zero.
+ * @param device The device that the pcm belongs to.
+ *  The default device is zero.
+ * @param flags Specify characteristics and functionality about the pcm.
+ *  May be a bitwise AND of the following:
+ *   - @ref PCM_IN
+ *   - @ref PCM_OUT
+ *   - @ref PCM_MMAP
+ *   - @ref PCM_NOIRQ
+ *   - @ref PCM_MONOTONIC
+ *   - @ref PCM_NONBLOCK
+ *   - @ref PCM_NONINTERLEAVED
+ * @param config The hardware and software parameters to open the PCM with.
+ * @returns A PCM structure.
+ *  If an error occurs allocating memory for the PCM, NULL is returned.
+ *  Otherwise, client code should check that the PCM opened properly by calling @ref pcm_is_ready.
+ *  If @ref pcm_is_ready, check @ref pcm_get_error for more information.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm *pcm_open(unsigned int card, unsigned int device,
+                     unsigned int flags, const struct pcm_config *config)
+{
+    struct pcm *pcm;
+
+    pcm = pcm_open_device(card, device, flags);
+    if (!pcm_is_ready(pcm))
+        return pcm;
+
+    return pcm_open_config(pcm, config);
+}
+
+/* Refines the parameters against the hardware, constraining all of them again. */
+static int pcm_hw_refine(struct pcm *pcm, struct snd_pcm_hw_params *params)
+{
+    params->rmask = ~0U;
+    params->cmask = 0;
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_HW_REFINE, params))
+        return -errno;
+    return 0;
+}
+
+/* Narrows an interval to the supported value nearest to the one given, like
+ * snd_pcm_hw_param_set_near() in alsa-lib. If the value itself is not
+ * supported, the nearest ones above and below it are found and the closer one
+ * is taken. */
+static int pcm_refine_near(struct pcm *pcm, struct snd_pcm_hw_params *params,
+                           int n, unsigned int value)
+{
+    struct snd_pcm_hw_params pinned = *params;
+    struct snd_pcm_hw_params above = *params;
+    struct snd_pcm_hw_params below = *params;
+    const struct snd_interval *i;
+    unsigned int above_value = 0, below_value = 0;
+    int have_above, have_below;
+
+    param_set_range(&pinned, n, value, value);
+    if (!pcm_hw_refine(pcm, &pinned)) {
+        *params = pinned;
+        return 0;
+    }
+
+    param_set_range(&above, n, value, UINT_MAX);
+    have_above = !pcm_hw_refine(pcm, &above);
+    if (have_above) {
+        i = param_get_interval(&above, n);
+        above_value = i->min + i->openmin;
+    }
+    param_set_range(&below, n, 0, value);
+    have_below = !pcm_hw_refine(pcm, &below);
+    if (have_below) {
+        i = param_get_interval(&below, n);
+        below_value = i->max - i->openmax;
+    }
+    if (!have_above && !have_below)
+        return -EINVAL;
+
+    if (have_above && (!have_below || above_value - value <= value - below_value)) {
+        *params = above;
+        value = above_value;
+    } else {
+        *params = below;
+        value = below_value;
+    }
+
+    /* a rule of the driver may still leave a range that cannot be pinned
+     * to a single value, in which case the refined range is kept */
+    pinned = *params;
+    param_set_range(&pinned, n, value, value);
+    if (!pcm_hw_refine(pcm, &pinned))
+        *params = pinned;
+    return 0;
+}
+
+/* Narrows the format of refined parameters to the acceptable one that the
+ * hardware supports and that is nearest to the preferred one: the preferred
+ * format itself, then formats of the same width, then wider formats, then
+ * narrower ones.
+ * Returns the format chosen, or a negative errno value. */
+static int pcm_refine_format(struct pcm *pcm, struct snd_pcm_hw_params *params,
+                             enum pcm_format preferred, unsigned int formats)
+{
+    const struct snd_mask *mask = param_to_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+    unsigned int bits = pcm_format_to_bits(preferred);
+    unsigned int best_score = UINT_MAX;
+    int format, best = -1;
+    int ret;
+
+    formats |= 1U << preferred;
+    for (format = 0; format < PCM_FORMAT_MAX; format++) {
+        unsigned int alsa_format = pcm_format_to_alsa(format);
+        unsigned int format_bits = pcm_format_to_bits(format);
+        unsigned int score;
+
+        if (!(formats & (1U << format)) ||
+            !(mask->bits[alsa_format >> 5] & (1U << (alsa_format & 31))))
+            continue;
+
+        if (format == (int)preferred)
+            score = 0;
+        else if (format_bits >= bits)
+            score = 2 * (format_bits - bits) + 1;
+        else
+            score = 2 * (bits - format_bits) + 2;
+        if (score < best_score) {
+            best_score = score;
+            best = format;
+        }
+    }
+    if (best < 0)
+        return -EINVAL;
+
+    param_set_mask(params, SNDRV_PCM_HW_PARAM_FORMAT, pcm_format_to_alsa(best));
+    ret = pcm_hw_refine(pcm, params);
+    if (ret < 0)
+        return ret;
+    return best;
+}
+
+/* Narrows an interval to the acceptable range of a pcm_constraints,
+ * where a bound of zero is open. */
+static void pcm_constrain(struct snd_pcm_hw_params *params, int n,
+                          unsigned int min, unsigned int max)
+{
+    param_set_range(params, n, min, max ? max : UINT_MAX);
+}
+
+/** Opens a PCM, negotiating its configuration with the hardware.
+ * Rather than failing when the hardware does not support a configuration
+ * exactly, the closest one within the acceptable ranges is chosen, by
+ * refining the hardware parameters of the PCM one at a time: the format,
+ * the channel count, the rate, the period count and then the period size.
+ * The PCM is only opened once.
+ * The configuration that was chosen is returned by @ref pcm_get_config,
+ * and the latency it achieves by @ref pcm_get_latency.
+ * @param card The card that the pcm belongs to.
+ * @param device The device that the pcm belongs to.
+ * @param flags Specify characteristics and functionality about the pcm,
+ *  as in @ref pcm_open.
+ * @param constraints The preferred configuration, the acceptable ranges
+ *  around it, and the latency to aim for.
+ * @returns A PCM structure.
+ *  If an error occurs allocating memory for the PCM, NULL is returned.
+ *  Otherwise, client code should check that the PCM opened properly by calling @ref pcm_is_ready.
+ *  If @ref pcm_is_ready, check @ref pcm_get_error for more information.
+ * @ingroup libtinyalsa-pcm
+ */
+struct pcm *pcm_open_negotiated(unsigned int card, unsigned int device,
+                                unsigned int flags,
+                                const struct pcm_constraints *constraints)
+{
+    const struct pcm_config *preferred = &constraints->preferred;
+    struct snd_pcm_hw_params params;
+    struct pcm_config config;
+    struct pcm *pcm;
+    unsigned long long period_size;
+    unsigned int period_count;
+    enum pcm_format format;
+    int ret;
+
+    pcm = pcm_open_device(card, device, flags);
+    if (!pcm_is_ready(pcm))
+        return pcm;
+
+    param_init(&params);
+    param_set_mask(&params, SNDRV_PCM_HW_PARAM_SUBFORMAT, SNDRV_PCM_SUBFORMAT_STD);
+    if (flags & PCM_MMAP)
+        param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
+                   (flags & PCM_NONINTERLEAVED) ?
+                   SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED :
+                   SNDRV_PCM_ACCESS_MMAP_INTERLEAVED);
+    else
+        param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
+                   (flags & PCM_NONINTERLEAVED) ?
+                   SNDRV_PCM_ACCESS_RW_NONINTERLEAVED :
+                   SNDRV_PCM_ACCESS_RW_INTERLEAVED);
+    if (flags & PCM_NOIRQ)
+        params.flags |= SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP;
+
+    pcm_constrain(&params, SNDRV_PCM_HW_PARAM_CHANNELS,
+                  constraints->min_channels, constraints->max_channels);
+    pcm_constrain(&params, SNDRV_PCM_HW_PARAM_RATE,
+                  constraints->min_rate, constraints->max_rate);
+    pcm_constrain(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+                  constraints->min_period_size, constraints->max_period_size);
+    pcm_constrain(&params, SNDRV_PCM_HW_PARAM_PERIODS,
+                  constraints->min_period_count, constraints->max_period_count);
+
+    ret = pcm_hw_refine(pcm, &params);
+    if (ret < 0) {
+        oops(pcm, -ret, "no configuration within the constraints");
+        goto fail_close;
+    }
+
+    ret = pcm_refine_format(pcm, &params, preferred->format, constraints->formats);
+    if (ret < 0) {
+        oops(pcm, -ret, "no acceptable format");
+        goto fail_close;
+    }
+    format = ret;
+
+    ret = pcm_refine_near(pcm, &params, SNDRV_PCM_HW_PARAM_CHANNELS, preferred->channels);
+    if (ret < 0) {
+        oops(pcm, -ret, "no acceptable channel count");
+        goto fail_close;
+    }
+
+    ret = pcm_refine_near(pcm, &params, SNDRV_PCM_HW_PARAM_RATE, preferred->rate);
+    if (ret < 0) {
+        oops(pcm, -ret, "no acceptable rate");
+        goto fail_close;
+    }
+
+    period_count = preferred->period_count;
+    if (!period_count)
+        period_count = constraints->latency_us ? 2 : 4;
+    ret = pcm_refine_near(pcm, &params, SNDRV_PCM_HW_PARAM_PERIODS, period_count);
+    if (ret < 0) {
+        oops(pcm, -ret, "no acceptable period count");
+        goto fail_close;
+    }
+    period_count = param_get_min(&params, SNDRV_PCM_HW_PARAM_PERIODS);
+
+    if (constraints->latency_us) {
+        period_size = (unsigned long long)constraints->latency_us *
+                      param_get_min(&params, SNDRV_PCM_HW_PARAM_RATE) /
+                      1000000 / period_count;
+        if (!period_size)
+            period_size = 1;
+        else if (period_size > UINT_MAX)
+            period_size = UINT_MAX;
+    } else {
+        period_size = preferred->period_size ? preferred->period_size : 1024;
+    }
+    ret = pcm_refine_near(pcm, &params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, period_size);
+    if (ret < 0) {
+        oops(pcm, -ret, "no acceptable period size");
+        goto fail_close;
+    }
+
+    config = *preferred;
+    config.format = format;
+    config.channels = param_get_min(&params, SNDRV_PCM_HW_PARAM_CHANNELS);
+    config.rate = param_get_min(&params, SNDRV_PCM_HW_PARAM_RATE);
+    config.period_count = param_get_min(&params, SNDRV_PCM_HW_PARAM_PERIODS);
+    config.period_size = param_get_min(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
+    if (config.start_threshold > config.period_size * config.period_count)
+        config.start_threshold = 0;
+
+    return pcm_open_config(pcm, &config);
+
+fail_close:
+    close(pcm->fd);
+    pcm->fd = -1;
+    return pcm;
+}
+
 /** Checks if a PCM file has been opened without error.
  * @param pcm A PCM handle.
  *  May be NULL.
@@ -1142,7 +2232,7 @@ int pcm_is_ready(const struct pcm *pcm)
  */
 int pcm_link(struct pcm *pcm1, struct pcm *pcm2)
 {
-    int err = ioctl(pcm1->fd, SNDRV_PCM_IOCTL_LINK, pcm2->fd);
+    int err = pcm_ioctl(pcm1, SNDRV_PCM_IOCTL_LINK, (void *)(long)pcm2->fd);
     if (err == -1) {
         return oops(pcm1, errno, "cannot link PCM");
     }
@@ -1157,7 +2247,7 @@ int pcm_link(struct pcm *pcm1, struct pcm *pcm2)
  */
 int pcm_unlink(struct pcm *pcm)
 {
-    int err = ioctl(pcm->fd, SNDRV_PCM_IOCTL_UNLINK);
+    int err = pcm_ioctl(pcm, SNDRV_PCM_IOCTL_UNLINK, NULL);
     if (err == -1) {
         return oops(pcm, errno, "cannot unlink PCM");
     }
@@ -1174,9 +2264,13 @@ int pcm_prepare(struct pcm *pcm)
     if (pcm->prepared)
         return 0;
 
-    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_PREPARE) < 0)
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_PREPARE, NULL) < 0)
         return oops(pcm, errno, "cannot prepare channel");
 
+    /* the kernel resets the pointers on prepare, refresh our copy of them */
+    if (pcm->sync_ptr)
+        pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_APPL);
+
     pcm->prepared = 1;
     return 0;
 }
@@ -1194,10 +2288,10 @@ int pcm_start(struct pcm *pcm)
     if (prepare_error)
         return prepare_error;
 
-    if (pcm->flags & PCM_MMAP)
+    if (pcm->appl_ptr_pending)
         pcm_sync_ptr(pcm, 0);
 
-    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_START) < 0)
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_START, NULL) < 0)
         return oops(pcm, errno, "cannot start channel");
 
     pcm->running = 1;
@@ -1211,7 +2305,7 @@ int pcm_start(struct pcm *pcm)
  */
 int pcm_stop(struct pcm *pcm)
 {
-    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_DROP) < 0)
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_DROP, NULL) < 0)
         return oops(pcm, errno, "cannot stop channel");
 
     pcm->prepared = 0;
@@ -1241,9 +2335,9 @@ static inline int pcm_mmap_capture_avail(struct pcm *pcm)
     return avail;
 }
 
+/* computed from the last known pointers, without syncing them */
 static inline int pcm_mmap_avail(struct pcm *pcm)
 {
-    pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC);
     if (pcm->flags & PCM_IN)
         return pcm_mmap_capture_avail(pcm);
     else
@@ -1254,32 +2348,60 @@ static void pcm_mmap_appl_forward(struct pcm *pcm, int frames)
 {
     unsigned int appl_ptr = pcm->mmap_control->appl_ptr;
     appl_ptr += frames;
+    pcm_stats_add(&pcm->stats.frames, frames);
 
     /* check for boundary wrap */
-    if (appl_ptr > pcm->boundary)
+    if (appl_ptr >= pcm->boundary)
          appl_ptr -= pcm->boundary;
     pcm->mmap_control->appl_ptr = appl_ptr;
 }
 
+int pcm_avail_update(struct pcm *pcm);
+
+/** Gets the next region of the mmap buffer that can be accessed in place.
+ * The region is released with @ref pcm_mmap_commit.
+ * Only available for PCMs opened with the @ref PCM_MMAP flag.
+ * @param pcm A PCM handle.
+ * @param areas Receives the start of the mmap buffer.
+ *  If the PCM was opened with @ref PCM_NONINTERLEAVED, it receives an array
+ *  of one pointer per channel instead, each to the first sample of that channel.
+ * @param offset Receives the offset of the region in the buffer, in frames.
+ * @param frames The number of frames wanted.
+ *  Receives the number of frames in the region,
+ *  which does not wrap around the end of the buffer.
+ * @return On success, zero; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
 int pcm_mmap_begin(struct pcm *pcm, void **areas, unsigned int *offset,
                    unsigned int *frames)
 {
-    unsigned int continuous, copy_frames, avail;
+    unsigned int continuous, copy_frames;
+    int avail;
+
+    /* preparing resets the pointers, so it must happen before any frames are
+     * copied into the buffer */
+    if (!pcm->prepared && pcm_prepare(pcm) < 0)
+        return -1;
 
-    /* return the mmap buffer */
-    *areas = pcm->mmap_buffer;
+    /* return the mmap buffer, or the first sample of each channel */
+    if (pcm->flags & PCM_NONINTERLEAVED)
+        *areas = pcm->mmap_channels;
+    else
+        *areas = pcm->mmap_buffer;
 
     /* and the application offset in frames */
     *offset = pcm->mmap_control->appl_ptr % pcm->buffer_size;
 
-    avail = pcm_mmap_avail(pcm);
-    if (avail > pcm->buffer_size)
+    avail = pcm_avail_update(pcm);
+    if (avail < 0)
+        avail = 0;
+    else if ((unsigned int)avail > pcm->buffer_size)
         avail = pcm->buffer_size;
     continuous = pcm->buffer_size - *offset;
 
     /* we can only copy frames if the are availabale and continuos */
     copy_frames = *frames;
-    if (copy_frames > avail)
+    if (copy_frames > (unsigned int)avail)
         copy_frames = avail;
     if (copy_frames > continuous)
         copy_frames = continuous;
@@ -1292,8 +2414,18 @@ int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames)
 {
     int ret;
 
-    /* not used */
-    (void) offset;
+    /* frames accessed in place are scaled and metered as they are handed
+     * over, before the kernel can play them */
+    if (pcm->gain || pcm->meter) {
+        void *areas = pcm->mmap_buffer;
+        void *const *pcm_areas = (pcm->flags & PCM_NONINTERLEAVED) ?
+                                 pcm->mmap_channels : &areas;
+        unsigned long long start = pcm_stats_time();
+
+        pcm_process_copy(pcm, pcm_areas, offset, (const void *const *)pcm_areas,
+                         offset, frames);
+        pcm_stats_add(&pcm->stats.copy_time_ns, pcm_stats_time() - start);
+    }
 
     /* update the application pointer in userspace and kernel */
     pcm_mmap_appl_forward(pcm, frames);
@@ -1306,12 +2438,21 @@ int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames)
     return frames;
 }
 
+/* Publishes any pending appl_ptr and fetches hw_ptr, with at most one
+ * SYNC_PTR ioctl. No ioctl is needed when status and control are mapped. */
 int pcm_avail_update(struct pcm *pcm)
 {
-    pcm_sync_ptr(pcm, 0);
+    if (pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC) < 0)
+        return -1;
     return pcm_mmap_avail(pcm);
 }
 
+/** Gets the state of a PCM.
+ * @param pcm A PCM handle.
+ * @returns On success, the state of the PCM (e.g. @ref PCM_STATE_RUNNING).
+ *  On failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
 int pcm_state(struct pcm *pcm)
 {
     int err = pcm_sync_ptr(pcm, 0);
@@ -1321,6 +2462,210 @@ int pcm_state(struct pcm *pcm)
     return pcm->mmap_status->state;
 }
 
+/** Sets the minimum number of frames that must be available
+ * before @ref pcm_wait (or a poll on the PCM) returns.
+ * The default is one frame.
+ * @param pcm A PCM handle.
+ * @param avail_min The minimum number of available frames.
+ * @returns On success, zero; on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_avail_min(struct pcm *pcm, unsigned int avail_min)
+{
+    if (!pcm->mmap_control)
+        return -ENODEV;
+    if (avail_min == 0 || avail_min > pcm->buffer_size)
+        return -EINVAL;
+
+    /* the control page is read by the kernel, in sync_ptr mode it is sent
+     * with the next sync */
+    pcm->mmap_control->avail_min = avail_min;
+    pcm->avail_min = avail_min;
+    if (pcm->sync_ptr && pcm_sync_ptr(pcm, 0) < 0)
+        return -1;
+
+    return 0;
+}
+
+/** Sets the software gain of every channel of a PCM.
+ * The gain is applied as frames are copied into the buffer by @ref pcm_mmap_write,
+ * @ref pcm_writen and @ref pcm_writev, and in place as frames written directly into the
+ * buffer are released by @ref pcm_mmap_commit.
+ * Only available for playback PCMs opened with the @ref PCM_MMAP flag.
+ * The gain goes back to unity when the format or channel count changes.
+ * @param pcm A PCM handle.
+ * @param gain The linear gain, where one leaves the samples as they are.
+ * @param ramp_frames The number of frames over which the gain moves linearly
+ *  from its current value to the new one. Zero changes it at once.
+ * @returns On success, zero; on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_gain(struct pcm *pcm, float gain, unsigned int ramp_frames)
+{
+    if (!pcm->gain)
+        return -EINVAL;
+    return pcm_gain_set(pcm->gain, NULL, gain, ramp_frames);
+}
+
+/** Sets the software gain of each channel of a PCM.
+ * This is the same as @ref pcm_set_gain, with a gain for each channel.
+ * @param pcm A PCM handle.
+ * @param gains The linear gain of each channel.
+ * @param ramp_frames The number of frames over which the gains move linearly
+ *  from their current values to the new ones. Zero changes them at once.
+ * @returns On success, zero; on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_channel_gains(struct pcm *pcm, const float *gains, unsigned int ramp_frames)
+{
+    if (!pcm->gain || !gains)
+        return -EINVAL;
+    return pcm_gain_set(pcm->gain, gains, 0.0f, ramp_frames);
+}
+
+/** Turns the level meter of a PCM on or off.
+ * While it is on, the peak and RMS level of each channel are measured as
+ * frames are transferred by @ref pcm_writei, @ref pcm_readi and the other
+ * read and write functions, and as they are released by @ref pcm_mmap_commit.
+ * Playback levels are measured after the software gain.
+ * This must not be called while another thread is transferring frames.
+ * @param pcm A PCM handle.
+ * @param enable Non-zero to turn the meter on, zero to turn it off.
+ * @returns On success, zero; on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_metering(struct pcm *pcm, int enable)
+{
+    if (!enable) {
+        pcm_meter_close(pcm->meter);
+        pcm->meter = NULL;
+        return 0;
+    }
+
+    if (!pcm->meter) {
+        pcm->meter = pcm_meter_open(pcm->config.format, pcm->config.channels);
+        if (!pcm->meter)
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+/** Gets the levels measured on a PCM since the meter was turned on or last reset.
+ * The levels are linear, where one is full scale.
+ * This may be called from any one thread while another transfers frames;
+ * the transferring thread never waits for it.
+ * @param pcm A PCM handle.
+ * @param peak Receives the peak level of each channel, or NULL.
+ * @param rms Receives the RMS level of each channel, or NULL.
+ * @param channels The number of elements in @p peak and @p rms.
+ *  Levels are only stored for the channels of the PCM.
+ * @param reset Non-zero to start measuring again after the levels are read.
+ *  No frame is missed or counted twice across a reset.
+ * @returns On success, zero; on failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_levels(struct pcm *pcm, float *peak, float *rms, unsigned int channels,
+                   int reset)
+{
+    if (!pcm->meter)
+        return -EINVAL;
+    return pcm_meter_read(pcm->meter, peak, rms, channels, reset);
+}
+
+/** Enables or disables adaptive latency on an output.
+ * With adaptive latency, the PCM keeps a target number of frames queued:
+ * the stream starts once the target is queued, @ref pcm_writei and the mmap
+ * write functions never queue more, and @ref pcm_wait wakes up as soon as less
+ * is queued. Every underrun raises the target by a period, and every ten
+ * seconds without an underrun lower it by half a period, so the latency
+ * settles at the lowest value that the system can sustain.
+ * @ref pcm_writen without @ref PCM_MMAP only follows the start threshold.
+ * The target starts from the start threshold of the PCM.
+ * Reconfiguring the PCM with @ref pcm_set_config disables adaptive latency.
+ * @param pcm A PCM handle, opened with @ref PCM_OUT and configured.
+ * @param enable Non-zero to enable adaptive latency, zero to disable it and
+ *  restore the start threshold and avail_min of the configuration.
+ * @param min_frames The lowest target, at least a period.
+ *  Zero for two periods.
+ * @param max_frames The highest target, at most the buffer size.
+ *  Zero for the buffer size.
+ * @param callback Called with the target every time it changes, may be NULL.
+ * @param data User data passed to @p callback.
+ * @returns Zero on success, a negative errno value on failure.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_set_adaptive_latency(struct pcm *pcm, int enable, unsigned int min_frames,
+                             unsigned int max_frames, pcm_latency_callback callback,
+                             void *data)
+{
+    struct pcm_adaptive *adaptive = &pcm->adaptive;
+
+    if ((pcm->flags & PCM_IN) || !pcm->buffer_size)
+        return -EINVAL;
+
+    if (!enable) {
+        struct pcm_config config = pcm->config;
+
+        if (!adaptive->enabled)
+            return 0;
+        adaptive->enabled = 0;
+        config.start_threshold = adaptive->start_threshold;
+        return pcm_set_sw_params(pcm, &config, adaptive->avail_min, 0);
+    }
+
+    if (!adaptive->enabled) {
+        adaptive->start_threshold = pcm->config.start_threshold;
+        adaptive->avail_min = pcm->avail_min;
+        adaptive->target = pcm->config.start_threshold;
+    }
+
+    /* the limits are what the hardware allows within the configured buffer */
+    if (!min_frames)
+        min_frames = pcm->config.period_size * 2;
+    if (min_frames < pcm->config.period_size)
+        min_frames = pcm->config.period_size;
+    if (min_frames > pcm->buffer_size)
+        min_frames = pcm->buffer_size;
+    if (!max_frames || max_frames > pcm->buffer_size)
+        max_frames = pcm->buffer_size;
+    if (max_frames < min_frames)
+        max_frames = min_frames;
+
+    adaptive->min = min_frames;
+    adaptive->max = max_frames;
+    if (adaptive->target < min_frames)
+        adaptive->target = min_frames;
+    if (adaptive->target > max_frames)
+        adaptive->target = max_frames;
+    adaptive->callback = callback;
+    adaptive->data = data;
+    adaptive->enabled = 1;
+
+    return pcm_adaptive_apply(pcm);
+}
+
+/* Measures the lateness of a wakeup of pcm_wait() that started waiting at
+ * start, on the clock of the PCM. Only wakeups caused by the hardware
+ * pointer moving while waiting are measured: the kernel timestamps every
+ * update of the pointer, normally at the end of a period. The timestamp is
+ * only read when the status page is mapped, in sync_ptr mode it would cost
+ * an ioctl per wakeup. */
+static void pcm_stats_wakeup(struct pcm *pcm, unsigned long long start)
+{
+    unsigned long long tstamp, now;
+
+    if ((pcm->flags & PCM_NOIRQ) || !pcm->mmap_status || pcm->sync_ptr)
+        return;
+
+    now = pcm_stats_clock(pcm);
+    tstamp = pcm->mmap_status->tstamp.tv_sec * 1000000000ULL +
+             pcm->mmap_status->tstamp.tv_nsec;
+    if (tstamp < start || tstamp > now)
+        return;
+
+    pcm_stats_lateness(pcm, now - tstamp);
+}
+
 /** Waits for frames to be available for read or write operations.
  * @param pcm A PCM handle.
  * @param timeout The maximum amount of time to wait for, in terms of milliseconds.
@@ -1332,14 +2677,18 @@ int pcm_state(struct pcm *pcm)
 int pcm_wait(struct pcm *pcm, int timeout)
 {
     struct pollfd pfd;
+    unsigned long long start, poll_start;
     int err;
 
     pfd.fd = pcm->fd;
     pfd.events = POLLIN | POLLOUT | POLLERR | POLLNVAL;
+    start = pcm_stats_clock(pcm);
 
     do {
         /* let's wait for avail or timeout */
+        poll_start = pcm_stats_time();
         err = poll(&pfd, 1, timeout);
+        pcm_stats_add(&pcm->stats.poll_time_ns, pcm_stats_time() - poll_start);
         if (err < 0)
             return -errno;
 
@@ -1367,18 +2716,28 @@ int pcm_wait(struct pcm *pcm, int timeout)
     /* poll again if fd not ready for IO */
     } while (!(pfd.revents & (POLLIN | POLLOUT)));
 
+    pcm_stats_add(&pcm->stats.wakeups, 1);
+    pcm_stats_wakeup(pcm, start);
     return 1;
 }
 
-int pcm_mmap_transfer(struct pcm *pcm, const void *buffer, unsigned int bytes)
+/* Copies the frames of all segments through the mmap buffer, with at most
+ * one pointer update per wakeup, however many segments there are */
+static int pcm_mmap_transfer_segments(struct pcm *pcm, const struct pcm_iovec *segments,
+                                      unsigned int segment_count)
 {
     int err = 0, frames, avail;
-    unsigned int offset = 0, count;
+    unsigned int offset = 0, count = 0, transferred = 0, n, chunk;
 
-    if (bytes == 0)
+    for (n = 0; n < segment_count; n++)
+        count += segments[n].frames;
+    if (count == 0)
         return 0;
 
-    count = pcm_bytes_to_frames(pcm, bytes);
+    /* preparing resets the pointers, so it must happen before any frames are
+     * copied into the buffer */
+    if (!pcm->prepared && pcm_prepare(pcm) < 0)
+        return -errno;
 
     while (count > 0) {
 
@@ -1389,6 +2748,15 @@ int pcm_mmap_transfer(struct pcm *pcm, const void *buffer, unsigned int bytes)
             return err;
         }
 
+        /* without pcm_wait() to report it, an xrun is noticed here */
+        if ((pcm->flags & PCM_NONBLOCK) &&
+            (pcm->mmap_status->state == PCM_STATE_XRUN)) {
+            pcm->prepared = 0;
+            pcm->running = 0;
+            pcm_xrun(pcm);
+            return -EPIPE;
+        }
+
         /* start the audio if we reach the threshold */
         if (!pcm->running &&
             (pcm->buffer_size - avail) >= pcm->config.start_threshold) {
@@ -1406,6 +2774,12 @@ int pcm_mmap_transfer(struct pcm *pcm, const void *buffer, unsigned int bytes)
             (unsigned int)avail < pcm->mmap_control->avail_min) {
             int time = -1;
 
+            if (pcm->flags & PCM_NONBLOCK) {
+                if (pcm->appl_ptr_pending && pcm_sync_ptr(pcm, 0) < 0)
+                    return -errno;
+                return transferred ? (int)transferred : -EAGAIN;
+            }
+
             if (pcm->flags & PCM_NOIRQ)
                 time = (pcm->buffer_size - avail - pcm->mmap_control->avail_min)
                         / pcm->noirq_frames_per_msec;
@@ -1419,6 +2793,8 @@ int pcm_mmap_transfer(struct pcm *pcm, const void *buffer, unsigned int bytes)
                     (unsigned int)pcm->mmap_control->appl_ptr,
                     avail);
                 pcm->mmap_control->appl_ptr = 0;
+                if (err == -EPIPE)
+                    pcm_xrun(pcm);
                 return err;
             }
             continue;
@@ -1428,43 +2804,201 @@ int pcm_mmap_transfer(struct pcm *pcm, const void *buffer, unsigned int bytes)
         if (frames > avail)
             frames = avail;
 
+        /* an adaptive output never queues more than its target */
+        if (pcm->adaptive.enabled) {
+            int room = avail + (int)pcm->adaptive.target - (int)pcm->buffer_size;
+            if (frames > room)
+                frames = (room > 0) ? room : 0;
+        }
+
         if (!frames)
             break;
 
-        /* copy frames from buffer */
-        frames = pcm_mmap_transfer_areas(pcm, (void *)buffer, offset, frames);
-        if (frames < 0) {
-            fprintf(stderr, "write error: hw 0x%x app 0x%x avail 0x%x\n",
-                    (unsigned int)pcm->mmap_status->hw_ptr,
-                    (unsigned int)pcm->mmap_control->appl_ptr,
-                    avail);
-            return frames;
-        }
-
-        offset += frames;
+        /* copy frames from the segments, moving to the next one when
+         * the current one is done */
         count -= frames;
+        transferred += frames;
+        while (frames > 0) {
+            chunk = segments->frames - offset;
+            if (chunk > (unsigned int)frames)
+                chunk = frames;
+            pcm_mmap_transfer_areas(pcm, segments->base, offset, chunk);
+            offset += chunk;
+            frames -= chunk;
+            if (offset == segments->frames) {
+                segments++;
+                offset = 0;
+            }
+        }
     }
 
+    /* let the kernel know about the last chunk */
+    if (pcm->appl_ptr_pending && pcm_sync_ptr(pcm, 0) < 0)
+        return -errno;
+
+    pcm_adaptive_written(pcm, transferred);
+
+    if (pcm->flags & PCM_NONBLOCK)
+        return transferred ? (int)transferred : -EAGAIN;
+
     return 0;
 }
 
+/* For a non-interleaved PCM, buffer is an array of one buffer per channel */
+static int pcm_mmap_transfer_frames(struct pcm *pcm, void *buffer, unsigned int count)
+{
+    struct pcm_iovec segment;
+
+    segment.base = buffer;
+    segment.frames = count;
+    return pcm_mmap_transfer_segments(pcm, &segment, 1);
+}
+
+int pcm_mmap_transfer(struct pcm *pcm, const void *buffer, unsigned int bytes)
+{
+    return pcm_mmap_transfer_frames(pcm, (void *)buffer, pcm_bytes_to_frames(pcm, bytes));
+}
+
+/* Transfers segments with one read or write call each on a RW PCM,
+ * or through the mmap buffer on a mmap PCM */
+static int pcm_transferv(struct pcm *pcm, const struct pcm_iovec *segments,
+                         unsigned int count)
+{
+    unsigned int n, total = 0;
+    int ret;
+
+    for (n = 0; n < count; n++) {
+        if (segments[n].frames > (unsigned int)INT_MAX - total)
+            return -EINVAL;
+        total += segments[n].frames;
+    }
+
+    if (pcm->flags & PCM_MMAP) {
+        ret = pcm_mmap_transfer_segments(pcm, segments, count);
+        if (ret < 0 || (pcm->flags & PCM_NONBLOCK))
+            return ret;
+        return total;
+    }
+
+    total = 0;
+    for (n = 0; n < count; n++) {
+        if (segments[n].frames == 0)
+            continue;
+
+        if (pcm->flags & PCM_NONINTERLEAVED) {
+            if (pcm->flags & PCM_IN)
+                ret = pcm_readn(pcm, segments[n].base, segments[n].frames);
+            else
+                ret = pcm_writen(pcm, segments[n].base, segments[n].frames);
+        } else {
+            if (pcm->flags & PCM_IN)
+                ret = pcm_readi(pcm, segments[n].base, segments[n].frames);
+            else
+                ret = pcm_writei(pcm, segments[n].base, segments[n].frames);
+        }
+
+        if (ret < 0) {
+            if (ret == -EAGAIN && total > 0)
+                break;
+            return ret;
+        }
+        total += ret;
+        if ((unsigned int)ret < segments[n].frames)
+            break;
+    }
+
+    return total;
+}
+
+/** Writes audio samples to PCM from several buffers at once.
+ * This avoids concatenating a period that is split across buffers.
+ * If the PCM was opened with @ref PCM_MMAP, all segments are copied
+ * straight into the mmap buffer.
+ * Otherwise, the segments are written with one @ref pcm_writei call each
+ * (or @ref pcm_writen for a @ref PCM_NONINTERLEAVED PCM),
+ * without an intermediate buffer.
+ * This function is only valid for PCMs opened with the @ref PCM_OUT flag.
+ * @param pcm A PCM handle.
+ * @param segments The buffers to write, in order.
+ * @param count The number of elements in @p segments.
+ * @return On success, the number of frames written.
+ *  This is less than the total of the segments only if the PCM was
+ *  opened with @ref PCM_NONBLOCK, or if the write was interrupted.
+ *  On failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_writev(struct pcm *pcm, const struct pcm_iovec *segments, unsigned int count)
+{
+    if (pcm->flags & PCM_IN)
+        return -EINVAL;
+
+    return pcm_transferv(pcm, segments, count);
+}
+
+/** Reads audio samples from PCM into several buffers at once.
+ * This function behaves like @ref pcm_writev, in the capture direction.
+ * This function is only valid for PCMs opened with the @ref PCM_IN flag.
+ * @param pcm A PCM handle.
+ * @param segments The buffers to fill, in order.
+ * @param count The number of elements in @p segments.
+ * @return On success, the number of frames read; otherwise, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_readv(struct pcm *pcm, const struct pcm_iovec *segments, unsigned int count)
+{
+    if (!(pcm->flags & PCM_IN))
+        return -EINVAL;
+
+    return pcm_transferv(pcm, segments, count);
+}
+
+/** Writes audio samples to a PCM opened with @ref PCM_MMAP.
+ * The PCM is started once the start threshold has been written.
+ * In blocking mode, this function waits until all samples have been copied
+ * into the buffer, and returns zero.
+ * If the PCM was opened with @ref PCM_NONBLOCK, only the frames that fit are
+ * copied and their number is returned, or -EAGAIN if none fit.
+ * After an underrun, -EPIPE is returned and the next call prepares
+ * the PCM again.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param count The number of bytes occupied by the sample array.
+ * @return See above; a negative number on failure.
+ * @ingroup libtinyalsa-pcm
+ */
 int pcm_mmap_write(struct pcm *pcm, const void *data, unsigned int count)
 {
     if ((~pcm->flags) & (PCM_OUT | PCM_MMAP))
         return -ENOSYS;
+    if (pcm->flags & PCM_NONINTERLEAVED)
+        return -EINVAL;
 
     return pcm_mmap_transfer(pcm, (void *)data, count);
 }
 
+/** Reads audio samples from a PCM opened with @ref PCM_MMAP.
+ * This function behaves like @ref pcm_mmap_write, in the
+ * capture direction.
+ * @param pcm A PCM handle.
+ * @param data The audio sample array
+ * @param count The number of bytes occupied by the sample array.
+ * @return See @ref pcm_mmap_write.
+ * @ingroup libtinyalsa-pcm
+ */
 int pcm_mmap_read(struct pcm *pcm, void *data, unsigned int count)
 {
     if ((~pcm->flags) & (PCM_IN | PCM_MMAP))
         return -ENOSYS;
+    if (pcm->flags & PCM_NONINTERLEAVED)
+        return -EINVAL;
 
     return pcm_mmap_transfer(pcm, data, count);
 }
 
 /** Gets the delay of the PCM, in terms of frames.
+ * If the status and control of the PCM are mapped into memory, the delay is
+ * computed from the last known hardware pointer, without a system call.
+ * In that case it does not include any additional delay reported by the driver.
  * @param pcm A PCM handle.
  * @returns On success, the delay of the PCM.
  *  On failure, a negative number.
@@ -1472,9 +3006,166 @@ int pcm_mmap_read(struct pcm *pcm, void *data, unsigned int count)
  */
 long pcm_get_delay(struct pcm *pcm)
 {
-    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_DELAY, &pcm->pcm_delay) < 0)
+    /* with status and control mapped, the delay is read from shared memory */
+    if (!pcm->sync_ptr && pcm->mmap_status && pcm->mmap_control) {
+        switch (pcm->mmap_status->state) {
+        case SNDRV_PCM_STATE_PREPARED:
+        case SNDRV_PCM_STATE_RUNNING:
+        case SNDRV_PCM_STATE_DRAINING:
+            if (pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC) < 0)
+                return -1;
+            if (pcm->flags & PCM_IN)
+                pcm->pcm_delay = pcm_mmap_capture_avail(pcm);
+            else
+                pcm->pcm_delay = pcm->buffer_size - pcm_mmap_playback_avail(pcm);
+            return pcm->pcm_delay;
+        default:
+            /* let the kernel report the error */
+            break;
+        }
+    }
+
+    if (pcm_ioctl(pcm, SNDRV_PCM_IOCTL_DELAY, &pcm->pcm_delay) < 0)
         return -1;
 
     return pcm->pcm_delay;
 }
 
+/** Gets the status of a PCM with a single system call.
+ * The state, the pointers, the delay and the timestamps are all sampled
+ * by the kernel at the same time, so they are consistent with each other.
+ * Unlike @ref pcm_get_htimestamp, this works for any PCM, memory mapped or not.
+ * @param pcm A PCM handle.
+ * @param type The clock to take the audio timestamp from.
+ *  If the driver does not support it, the audio timestamp is taken from
+ *  its default clock, and @ref pcm_status.audio_tstamp_type says which.
+ *  On kernels without typed audio timestamps, it is always
+ *  @ref PCM_AUDIO_TSTAMP_TYPE_COMPAT.
+ * @param status Receives the status.
+ * @returns On success, zero.
+ *  On failure, a negative errno value.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_status(struct pcm *pcm, enum pcm_audio_tstamp_type type,
+                   struct pcm_status *status)
+{
+    struct snd_pcm_status kstatus;
+    int ret = -1;
+
+    if ((pcm == NULL) || (status == NULL))
+        return -EINVAL;
+
+    memset(&kstatus, 0, sizeof(kstatus));
+
+#ifdef SNDRV_PCM_IOCTL_STATUS_EXT
+    if (!pcm->no_status_ext) {
+        /* the requested type goes in the low bits, the kernel reports the
+         * valid bit, the actual type and the accuracy bit in the high half */
+        kstatus.audio_tstamp_data = type & 0xf;
+        ret = pcm_ioctl(pcm, SNDRV_PCM_IOCTL_STATUS_EXT, &kstatus);
+        if (ret < 0 && (errno == ENOTTY || errno == EINVAL)) {
+            pcm->no_status_ext = 1;
+            memset(&kstatus, 0, sizeof(kstatus));
+        }
+    }
+#endif
+    if (ret < 0 && pcm_ioctl(pcm, SNDRV_PCM_IOCTL_STATUS, &kstatus) < 0) {
+        int errno_copy = errno;
+        oops(pcm, errno, "cannot get status");
+        return -errno_copy;
+    }
+
+    status->state = kstatus.state;
+    status->avail = kstatus.avail;
+    status->delay = kstatus.delay;
+    status->hw_ptr = kstatus.hw_ptr;
+    status->appl_ptr = kstatus.appl_ptr;
+    status->trigger_tstamp = kstatus.trigger_tstamp;
+    status->tstamp = kstatus.tstamp;
+    status->audio_tstamp = kstatus.audio_tstamp;
+    status->audio_tstamp_type = PCM_AUDIO_TSTAMP_TYPE_COMPAT;
+    status->audio_tstamp_accuracy = 0;
+    if (ret == 0 && (kstatus.audio_tstamp_data & (1 << 16))) {
+        status->audio_tstamp_type = (kstatus.audio_tstamp_data >> 17) & 0xf;
+        if (kstatus.audio_tstamp_data & (1 << 21))
+            status->audio_tstamp_accuracy = kstatus.audio_tstamp_accuracy;
+    }
+
+    return 0;
+}
+
+/** Gets the runtime statistics of a PCM.
+ * @param pcm A PCM handle.
+ * @param stats Receives the statistics.
+ * @returns On success, zero.
+ *  On failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_get_stats(const struct pcm *pcm, struct pcm_stats *stats)
+{
+    const struct pcm_counters *counters;
+    unsigned int n;
+
+    if ((pcm == NULL) || (stats == NULL))
+        return -EINVAL;
+
+    /* each counter is consistent on its own, they may be sampled a few
+     * frames apart from each other */
+    counters = &pcm->stats;
+    for (n = 0; n < PCM_IOCTL_MAX; n++)
+        stats->ioctls[n] = atomic_load_explicit(&counters->ioctls[n], memory_order_relaxed);
+    stats->underruns = atomic_load_explicit(&counters->underruns, memory_order_relaxed);
+    stats->overruns = atomic_load_explicit(&counters->overruns, memory_order_relaxed);
+    stats->wakeups = atomic_load_explicit(&counters->wakeups, memory_order_relaxed);
+    stats->frames = atomic_load_explicit(&counters->frames, memory_order_relaxed);
+    stats->poll_time_ns = atomic_load_explicit(&counters->poll_time_ns, memory_order_relaxed);
+    stats->copy_time_ns = atomic_load_explicit(&counters->copy_time_ns, memory_order_relaxed);
+    stats->lateness_count = atomic_load_explicit(&counters->lateness_count, memory_order_relaxed);
+    stats->lateness_min_ns = atomic_load_explicit(&counters->lateness_min_ns, memory_order_relaxed);
+    stats->lateness_max_ns = atomic_load_explicit(&counters->lateness_max_ns, memory_order_relaxed);
+    stats->lateness_avg_ns = 0;
+    if (stats->lateness_count)
+        stats->lateness_avg_ns =
+            atomic_load_explicit(&counters->lateness_total_ns, memory_order_relaxed) /
+            stats->lateness_count;
+    else
+        stats->lateness_min_ns = 0;
+    for (n = 0; n < PCM_STATS_LATENESS_BUCKETS; n++)
+        stats->lateness_histogram[n] =
+            atomic_load_explicit(&counters->lateness_histogram[n], memory_order_relaxed);
+    return 0;
+}
+
+/** Clears the runtime statistics of a PCM.
+ * This may be called from another thread while the PCM is streaming.
+ * @param pcm A PCM handle.
+ * @returns On success, zero.
+ *  On failure, a negative number.
+ * @ingroup libtinyalsa-pcm
+ */
+int pcm_reset_stats(struct pcm *pcm)
+{
+    struct pcm_counters *counters;
+    unsigned int n;
+
+    if (pcm == NULL)
+        return -EINVAL;
+
+    counters = &pcm->stats;
+    for (n = 0; n < PCM_IOCTL_MAX; n++)
+        atomic_store_explicit(&counters->ioctls[n], 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->underruns, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->overruns, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->wakeups, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->frames, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->poll_time_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->copy_time_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->lateness_count, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->lateness_total_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->lateness_min_ns, ULLONG_MAX, memory_order_relaxed);
+    atomic_store_explicit(&counters->lateness_max_ns, 0, memory_order_relaxed);
+    for (n = 0; n < PCM_STATS_LATENESS_BUCKETS; n++)
+        atomic_store_explicit(&counters->lateness_histogram[n], 0, memory_order_relaxed);
+    return 0;
+}
+
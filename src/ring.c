@@ -0,0 +1,640 @@
+/* ring.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <tinyalsa/ring.h>
+
+#include "thread.h"
+
+/* The indices of each side are kept on their own cache line, so that the
+ * producer and the consumer do not invalidate each other on every access */
+#define PCM_RING_CACHE_LINE 64
+
+/** A single producer, single consumer queue of frames.
+ * The read and write indices run freely and are masked with the size,
+ * which is a power of two.
+ * @ingroup libtinyalsa-ring
+ */
+struct pcm_ring {
+    /** The frames of the ring */
+    char *buffer;
+    /** The capacity of the ring, in frames */
+    unsigned int size;
+    /** @ref size minus one */
+    unsigned int mask;
+    /** The size of a frame, in bytes */
+    unsigned int frame_size;
+
+    /** The next frame to be written, stored by the producer */
+    atomic_uint write_index __attribute__((aligned(PCM_RING_CACHE_LINE)));
+    /** The last read index seen by the producer */
+    unsigned int read_cache;
+    /** The highest fill level seen by the producer */
+    atomic_uint high_water;
+    /** The number of periods dropped by a capture pump because the ring was full */
+    atomic_uint overruns;
+
+    /** The next frame to be read, stored by the consumer */
+    atomic_uint read_index __attribute__((aligned(PCM_RING_CACHE_LINE)));
+    /** The last write index seen by the consumer */
+    unsigned int write_cache;
+    /** The number of periods padded by a playback pump because the ring was short */
+    atomic_uint underruns;
+};
+
+/** Creates a ring for the frames of a PCM configuration.
+ * @param config The configuration of the PCM that the ring feeds or is fed by.
+ *  Only the channel count and the format are used.
+ * @param frames The minimum capacity of the ring, in frames.
+ *  It is rounded up to a power of two.
+ *  Zero selects the buffer size of @p config.
+ * @returns A ring on success, NULL on failure.
+ * @ingroup libtinyalsa-ring
+ */
+struct pcm_ring *pcm_ring_open(const struct pcm_config *config, unsigned int frames)
+{
+    struct pcm_ring *ring;
+    unsigned int frame_size, size;
+    void *ptr;
+
+    if (!config)
+        return NULL;
+
+    frame_size = pcm_format_to_bits(config->format) * config->channels / 8;
+    if (frame_size == 0)
+        return NULL;
+
+    if (frames == 0)
+        frames = config->period_size * config->period_count;
+    if (frames == 0 || frames > (1u << 31))
+        return NULL;
+
+    size = 1;
+    while (size < frames)
+        size <<= 1;
+
+    if (posix_memalign(&ptr, PCM_RING_CACHE_LINE, sizeof(*ring)) != 0)
+        return NULL;
+    ring = ptr;
+    memset(ring, 0, sizeof(*ring));
+
+    if (posix_memalign(&ptr, PCM_RING_CACHE_LINE, (size_t)size * frame_size) != 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->buffer = ptr;
+    ring->size = size;
+    ring->mask = size - 1;
+    ring->frame_size = frame_size;
+
+    atomic_init(&ring->write_index, 0);
+    atomic_init(&ring->high_water, 0);
+    atomic_init(&ring->overruns, 0);
+    atomic_init(&ring->read_index, 0);
+    atomic_init(&ring->underruns, 0);
+
+    return ring;
+}
+
+/** Frees a ring.
+ * @param ring A ring, may be NULL.
+ *  It must not be used by a pump or any other thread.
+ * @ingroup libtinyalsa-ring
+ */
+void pcm_ring_close(struct pcm_ring *ring)
+{
+    if (!ring)
+        return;
+
+    free(ring->buffer);
+    free(ring);
+}
+
+/** Gets the capacity of a ring.
+ * @param ring A ring.
+ * @returns The capacity, in frames.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_get_size(const struct pcm_ring *ring)
+{
+    return ring->size;
+}
+
+/** Gets the size of a frame in a ring.
+ * @param ring A ring.
+ * @returns The size of a frame, in bytes.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_get_frame_size(const struct pcm_ring *ring)
+{
+    return ring->frame_size;
+}
+
+/** Gets the number of frames queued in a ring.
+ * This function may be called from any thread.
+ * @param ring A ring.
+ * @returns The number of frames that can be read.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_get_fill(const struct pcm_ring *ring)
+{
+    unsigned int read_index, write_index;
+
+    read_index = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    write_index = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+    return write_index - read_index;
+}
+
+/** Gets the number of free frames in a ring.
+ * This function may be called from any thread.
+ * @param ring A ring.
+ * @returns The number of frames that can be written.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_get_space(const struct pcm_ring *ring)
+{
+    return ring->size - pcm_ring_get_fill(ring);
+}
+
+/** Gets the highest number of frames that were queued in a ring.
+ * This function may be called from any thread.
+ * @param ring A ring.
+ * @param reset If non-zero, the high-water mark is cleared.
+ * @returns The high-water mark, in frames, since the ring was created
+ *  or the mark was last reset.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_get_high_water(struct pcm_ring *ring, int reset)
+{
+    if (reset)
+        return atomic_exchange_explicit(&ring->high_water, 0, memory_order_relaxed);
+
+    return atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+}
+
+/** Gets the number of periods that a playback pump padded with silence
+ * because the ring held less than a period.
+ * @param ring A ring.
+ * @returns The number of underruns.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_get_underruns(const struct pcm_ring *ring)
+{
+    return atomic_load_explicit(&ring->underruns, memory_order_relaxed);
+}
+
+/** Gets the number of periods that a capture pump dropped
+ * because the ring had no room for them.
+ * @param ring A ring.
+ * @returns The number of overruns.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_get_overruns(const struct pcm_ring *ring)
+{
+    return atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
+
+/* The number of frames that the consumer may read at @p read_index.
+ * The write index is only loaded again if the cached one does not
+ * cover the @p frames that are wanted. */
+static unsigned int pcm_ring_readable(struct pcm_ring *ring, unsigned int read_index,
+                                      unsigned int frames)
+{
+    if (ring->write_cache - read_index < frames)
+        ring->write_cache = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+
+    return ring->write_cache - read_index;
+}
+
+/* The number of frames that the producer may write at @p write_index */
+static unsigned int pcm_ring_writable(struct pcm_ring *ring, unsigned int write_index,
+                                      unsigned int frames)
+{
+    if (ring->size - (write_index - ring->read_cache) < frames)
+        ring->read_cache = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+
+    return ring->size - (write_index - ring->read_cache);
+}
+
+/* The number of frames that can be accessed at @p index without wrapping */
+static unsigned int pcm_ring_contiguous(const struct pcm_ring *ring, unsigned int index,
+                                        unsigned int frames)
+{
+    unsigned int continuous = ring->size - (index & ring->mask);
+
+    return frames < continuous ? frames : continuous;
+}
+
+static void pcm_ring_update_high_water(struct pcm_ring *ring, unsigned int write_index)
+{
+    unsigned int fill, high_water;
+
+    fill = write_index - atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    high_water = atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+    if (fill > high_water)
+        atomic_store_explicit(&ring->high_water, fill, memory_order_relaxed);
+}
+
+/** Writes frames into a ring.
+ * Only one thread may write into a ring.
+ * @param ring A ring.
+ * @param data The frames to write.
+ * @param frames The number of frames at @p data.
+ * @returns The number of frames written,
+ *  which is less than @p frames if the ring is full.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_write(struct pcm_ring *ring, const void *data, unsigned int frames)
+{
+    unsigned int write_index, space, first;
+    const char *src = data;
+
+    write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    space = pcm_ring_writable(ring, write_index, frames);
+    if (frames > space)
+        frames = space;
+    if (frames == 0)
+        return 0;
+
+    first = pcm_ring_contiguous(ring, write_index, frames);
+    memcpy(ring->buffer + (size_t)(write_index & ring->mask) * ring->frame_size,
+           src, (size_t)first * ring->frame_size);
+    memcpy(ring->buffer, src + (size_t)first * ring->frame_size,
+           (size_t)(frames - first) * ring->frame_size);
+
+    pcm_ring_write_commit(ring, frames);
+    return frames;
+}
+
+/** Reads frames from a ring.
+ * Only one thread may read from a ring.
+ * @param ring A ring.
+ * @param data Receives the frames.
+ * @param frames The number of frames that fit at @p data.
+ * @returns The number of frames read,
+ *  which is less than @p frames if the ring runs empty.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_read(struct pcm_ring *ring, void *data, unsigned int frames)
+{
+    unsigned int read_index, fill, first;
+    char *dst = data;
+
+    read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    fill = pcm_ring_readable(ring, read_index, frames);
+    if (frames > fill)
+        frames = fill;
+    if (frames == 0)
+        return 0;
+
+    first = pcm_ring_contiguous(ring, read_index, frames);
+    memcpy(dst, ring->buffer + (size_t)(read_index & ring->mask) * ring->frame_size,
+           (size_t)first * ring->frame_size);
+    memcpy(dst + (size_t)first * ring->frame_size, ring->buffer,
+           (size_t)(frames - first) * ring->frame_size);
+
+    pcm_ring_read_commit(ring, frames);
+    return frames;
+}
+
+/** Gets a contiguous free region of a ring, so that frames can be
+ * produced in place.
+ * The region is published with @ref pcm_ring_write_commit.
+ * Only one thread may write into a ring.
+ * @param ring A ring.
+ * @param data Receives the address of the region.
+ * @param frames The number of frames wanted.
+ * @returns The number of frames in the region.
+ *  This is less than @p frames if the ring is nearly full,
+ *  or if the region ends at the end of the ring.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_write_begin(struct pcm_ring *ring, void **data, unsigned int frames)
+{
+    unsigned int write_index, space;
+
+    write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    space = pcm_ring_writable(ring, write_index, frames);
+    if (frames > space)
+        frames = space;
+
+    *data = ring->buffer + (size_t)(write_index & ring->mask) * ring->frame_size;
+    return pcm_ring_contiguous(ring, write_index, frames);
+}
+
+/** Publishes frames that were written into a ring.
+ * @param ring A ring.
+ * @param frames The number of frames written,
+ *  at most the number returned by @ref pcm_ring_write_begin.
+ * @ingroup libtinyalsa-ring
+ */
+void pcm_ring_write_commit(struct pcm_ring *ring, unsigned int frames)
+{
+    unsigned int write_index;
+
+    write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed) + frames;
+    atomic_store_explicit(&ring->write_index, write_index, memory_order_release);
+    pcm_ring_update_high_water(ring, write_index);
+}
+
+/** Gets a contiguous region of queued frames, so that they can be
+ * consumed in place.
+ * The region is released with @ref pcm_ring_read_commit.
+ * Only one thread may read from a ring.
+ * @param ring A ring.
+ * @param data Receives the address of the region.
+ * @param frames The number of frames wanted.
+ * @returns The number of frames in the region.
+ *  This is less than @p frames if the ring is nearly empty,
+ *  or if the region ends at the end of the ring.
+ * @ingroup libtinyalsa-ring
+ */
+unsigned int pcm_ring_read_begin(struct pcm_ring *ring, void **data, unsigned int frames)
+{
+    unsigned int read_index, fill;
+
+    read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    fill = pcm_ring_readable(ring, read_index, frames);
+    if (frames > fill)
+        frames = fill;
+
+    *data = ring->buffer + (size_t)(read_index & ring->mask) * ring->frame_size;
+    return pcm_ring_contiguous(ring, read_index, frames);
+}
+
+/** Releases frames that were read from a ring.
+ * @param ring A ring.
+ * @param frames The number of frames consumed,
+ *  at most the number returned by @ref pcm_ring_read_begin.
+ * @ingroup libtinyalsa-ring
+ */
+void pcm_ring_read_commit(struct pcm_ring *ring, unsigned int frames)
+{
+    unsigned int read_index;
+
+    read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed) + frames;
+    atomic_store_explicit(&ring->read_index, read_index, memory_order_release);
+}
+
+/** A thread that moves frames between a ring and a PCM.
+ * @ingroup libtinyalsa-ring
+ */
+struct pcm_ring_pump {
+    /** The ring that is drained or filled */
+    struct pcm_ring *ring;
+    /** The PCM that is fed or read */
+    struct pcm *pcm;
+    /** The number of frames moved at a time */
+    unsigned int period_size;
+    /** Whether @ref pcm is a capture PCM */
+    int capture;
+    /** A period of silence for playback, or of discarded frames for capture */
+    void *scratch;
+    /** The pump thread */
+    pthread_t thread;
+    /** Set when the thread must exit */
+    atomic_int stopping;
+    /** The reason why the thread exited, zero if it was stopped */
+    atomic_int error;
+};
+
+/* Describes frames of the ring starting at @p index,
+ * as one or two segments split by the end of the ring */
+static unsigned int pcm_ring_segments(const struct pcm_ring *ring, unsigned int index,
+                                      unsigned int frames, struct pcm_iovec *segments)
+{
+    unsigned int first = pcm_ring_contiguous(ring, index, frames);
+
+    segments[0].base = ring->buffer + (size_t)(index & ring->mask) * ring->frame_size;
+    segments[0].frames = first;
+    if (first == frames)
+        return 1;
+
+    segments[1].base = ring->buffer;
+    segments[1].frames = frames - first;
+    return 2;
+}
+
+/* Moves the segments to or from the PCM in one call */
+static int pcm_ring_pump_transfer(struct pcm_ring_pump *pump,
+                                  const struct pcm_iovec *segments, unsigned int count)
+{
+    if (pump->capture)
+        return pcm_readv(pump->pcm, segments, count);
+    return pcm_writev(pump->pcm, segments, count);
+}
+
+/* Plays a period from the ring, padded with silence if the ring is short */
+static int pcm_ring_pump_playback(struct pcm_ring_pump *pump)
+{
+    struct pcm_ring *ring = pump->ring;
+    struct pcm_iovec segments[3];
+    unsigned int read_index, frames, count = 0;
+    int ret;
+
+    read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    frames = pcm_ring_readable(ring, read_index, pump->period_size);
+    if (frames > pump->period_size)
+        frames = pump->period_size;
+
+    if (frames > 0)
+        count = pcm_ring_segments(ring, read_index, frames, segments);
+    if (frames < pump->period_size) {
+        atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+        segments[count].base = pump->scratch;
+        segments[count].frames = pump->period_size - frames;
+        count++;
+    }
+
+    /* the frames are released even if the write failed,
+     * there is no point in playing them late after an xrun */
+    ret = pcm_ring_pump_transfer(pump, segments, count);
+    pcm_ring_read_commit(ring, frames);
+
+    return ret < 0 ? ret : 0;
+}
+
+/* Captures a period into the ring, dropping it if the ring is full */
+static int pcm_ring_pump_capture(struct pcm_ring_pump *pump)
+{
+    struct pcm_ring *ring = pump->ring;
+    struct pcm_iovec segments[2];
+    unsigned int write_index, count;
+    int ret;
+
+    write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    if (pcm_ring_writable(ring, write_index, pump->period_size) < pump->period_size) {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        segments[0].base = pump->scratch;
+        segments[0].frames = pump->period_size;
+        ret = pcm_ring_pump_transfer(pump, segments, 1);
+        return ret < 0 ? ret : 0;
+    }
+
+    count = pcm_ring_segments(ring, write_index, pump->period_size, segments);
+    ret = pcm_ring_pump_transfer(pump, segments, count);
+    if (ret < 0)
+        return ret;
+
+    pcm_ring_write_commit(ring, ret);
+    return 0;
+}
+
+static void *pcm_ring_pump_thread(void *arg)
+{
+    struct pcm_ring_pump *pump = arg;
+    int ret;
+
+    while (!atomic_load_explicit(&pump->stopping, memory_order_relaxed)) {
+        if (pump->capture)
+            ret = pcm_ring_pump_capture(pump);
+        else
+            ret = pcm_ring_pump_playback(pump);
+
+        /* the next transfer prepares the PCM again after an xrun */
+        if (ret < 0 && ret != -EPIPE) {
+            atomic_store_explicit(&pump->error, ret, memory_order_relaxed);
+            break;
+        }
+    }
+
+    pcm_stop(pump->pcm);
+    return NULL;
+}
+
+/** Starts a thread that plays the frames of a ring through a playback PCM,
+ * or that captures the frames of a capture PCM into a ring.
+ * The thread moves a period at a time with one @ref pcm_writev or
+ * @ref pcm_readv call, so frames go straight between the ring and the PCM
+ * without an intermediate buffer, even where they wrap around the ring.
+ * For playback, the ring should be filled before the pump is started,
+ * and kept at least a period ahead; a short period is padded with silence.
+ * For capture, a period that does not fit into the ring is dropped.
+ * Xruns of the PCM are recovered from.
+ * @param ring A ring with the frame size of @p pcm.
+ *  The pump is its consumer for playback, and its producer for capture.
+ * @param pcm A PCM that was not opened with @ref PCM_NONBLOCK
+ *  or @ref PCM_NONINTERLEAVED.
+ *  It must not be used by the application while the pump is running.
+ * @param priority The SCHED_FIFO priority of the pump thread.
+ *  Zero leaves the thread with the default scheduling policy.
+ * @returns A running pump on success, NULL on failure.
+ * @ingroup libtinyalsa-ring
+ */
+struct pcm_ring_pump *pcm_ring_pump_start(struct pcm_ring *ring, struct pcm *pcm, int priority)
+{
+    const struct pcm_config *config;
+    struct pcm_ring_pump *pump;
+    pthread_attr_t attr;
+    int ret;
+
+    if (!ring || !pcm || !pcm_is_ready(pcm))
+        return NULL;
+    if (pcm_get_flags(pcm) & (PCM_NONBLOCK | PCM_NONINTERLEAVED))
+        return NULL;
+    if (pcm_frames_to_bytes(pcm, 1) != ring->frame_size)
+        return NULL;
+
+    config = pcm_get_config(pcm);
+    if (!config || config->period_size == 0)
+        return NULL;
+
+    pump = calloc(1, sizeof(*pump));
+    if (!pump)
+        return NULL;
+
+    pump->ring = ring;
+    pump->pcm = pcm;
+    pump->period_size = config->period_size;
+    pump->capture = (pcm_get_flags(pcm) & PCM_IN) ? 1 : 0;
+    atomic_init(&pump->stopping, 0);
+    atomic_init(&pump->error, 0);
+
+    pump->scratch = calloc(pump->period_size, ring->frame_size);
+    if (!pump->scratch) {
+        free(pump);
+        return NULL;
+    }
+    if (!pump->capture)
+        pcm_format_set_silence(pcm_get_format(pcm), pump->scratch,
+                               pump->period_size * pcm_get_channels(pcm));
+
+    pcm_thread_attr_init(&attr, priority);
+    ret = pthread_create(&pump->thread, &attr, pcm_ring_pump_thread, pump);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        free(pump->scratch);
+        free(pump);
+        return NULL;
+    }
+
+    return pump;
+}
+
+/** Gets the error that made the thread of a pump exit.
+ * The thread exits on errors it cannot recover from, such as the device
+ * being unplugged. After that, the ring is no longer drained or filled,
+ * so the application should stop the pump.
+ * @param pump A pump.
+ * @returns Zero while the thread is running,
+ *  otherwise the negative errno value of the error that stopped it.
+ * @ingroup libtinyalsa-ring
+ */
+int pcm_ring_pump_get_error(const struct pcm_ring_pump *pump)
+{
+    return atomic_load_explicit(&pump->error, memory_order_relaxed);
+}
+
+/** Stops a pump, waits for its thread to exit and frees it.
+ * The PCM is stopped, frames left in the ring are kept.
+ * @param pump A pump, may be NULL.
+ * @returns Zero if the pump was running normally,
+ *  otherwise the negative errno value of the error that stopped it.
+ * @ingroup libtinyalsa-ring
+ */
+int pcm_ring_pump_stop(struct pcm_ring_pump *pump)
+{
+    int error;
+
+    if (!pump)
+        return 0;
+
+    atomic_store_explicit(&pump->stopping, 1, memory_order_relaxed);
+    pthread_join(pump->thread, NULL);
+
+    error = atomic_load_explicit(&pump->error, memory_order_relaxed);
+    free(pump->scratch);
+    free(pump);
+    return error;
+}
+
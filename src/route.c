@@ -0,0 +1,830 @@
+/* route.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <tinyalsa/route.h>
+
+/* Shuffles only need the baseline vector instructions of each
+ * architecture, so the kernels are picked at build time */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_ROUTE_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON) && \
+    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#include <arm_neon.h>
+#define PCM_ROUTE_NEON 1
+#endif
+
+/* The most channels that the vector kernels handle */
+#define PCM_ROUTE_VECTOR_CHANNELS 64
+
+/* The size of the planar buffer that @ref pcm_route_apply goes through */
+#define PCM_ROUTE_CHUNK_BYTES 4096
+
+/** A channel map, applied to frames of a sample format.
+ * @ingroup libtinyalsa-route
+ */
+struct pcm_route {
+    unsigned int in_channels;
+    unsigned int out_channels;
+    /** The size of a sample, in bytes */
+    unsigned int sample_size;
+    /** The input channel of each output channel, or -1 for silence */
+    int *map;
+    /** The output channel of each input channel, if @ref map is a permutation */
+    int *inverse;
+    /** Whether each input channel goes to exactly one output channel */
+    int is_permutation;
+    /** Whether each output channel is the input channel of the same index */
+    int is_identity;
+    /** A silent sample */
+    unsigned char silence[8];
+};
+
+/** Creates a channel map.
+ * @param format The format of the samples, which are moved but not changed.
+ * @param in_channels The number of channels of the input frames.
+ * @param out_channels The number of channels of the output frames.
+ * @param map For each output channel, the input channel that it is taken
+ *  from, or -1 to make it silent. An input channel may feed several output
+ *  channels, or none. NULL maps each output channel to the input channel
+ *  of the same index, if there is one.
+ * @returns A channel map on success, NULL on failure.
+ * @ingroup libtinyalsa-route
+ */
+struct pcm_route *pcm_route_open(enum pcm_format format, unsigned int in_channels,
+                                 unsigned int out_channels, const int *map)
+{
+    struct pcm_route *route;
+    unsigned int ch;
+    int in;
+
+    if ((unsigned int) format >= PCM_FORMAT_MAX || !in_channels || !out_channels)
+        return NULL;
+
+    route = calloc(1, sizeof(*route));
+    if (!route)
+        return NULL;
+
+    route->in_channels = in_channels;
+    route->out_channels = out_channels;
+    route->sample_size = pcm_format_to_bits(format) / 8;
+    pcm_format_set_silence(format, route->silence, 1);
+
+    route->map = calloc(out_channels, sizeof(*route->map));
+    route->inverse = calloc(in_channels, sizeof(*route->inverse));
+    if (!route->map || !route->inverse) {
+        pcm_route_close(route);
+        return NULL;
+    }
+
+    for (ch = 0; ch < in_channels; ch++)
+        route->inverse[ch] = -1;
+
+    route->is_identity = in_channels == out_channels;
+    route->is_permutation = in_channels == out_channels;
+    for (ch = 0; ch < out_channels; ch++) {
+        if (map)
+            in = map[ch];
+        else
+            in = ch < in_channels ? (int) ch : -1;
+        if (in >= (int) in_channels) {
+            pcm_route_close(route);
+            return NULL;
+        }
+        route->map[ch] = in;
+
+        if (in != (int) ch)
+            route->is_identity = 0;
+        if (in < 0 || route->inverse[in] >= 0)
+            route->is_permutation = 0;
+        else
+            route->inverse[in] = ch;
+    }
+
+    return route;
+}
+
+/** Frees a channel map.
+ * @param route A channel map.
+ * @ingroup libtinyalsa-route
+ */
+void pcm_route_close(struct pcm_route *route)
+{
+    if (!route)
+        return;
+
+    free(route->map);
+    free(route->inverse);
+    free(route);
+}
+
+/* The scalar kernels, from frame @p first on. They are inlined with a
+ * constant sample size, so that each copy is a single move. */
+
+static inline void pcm_route_apply_scalar(const struct pcm_route *route, uint8_t *dst,
+                                          const uint8_t *src, unsigned int first,
+                                          unsigned int frames, unsigned int size)
+{
+    unsigned int in_frame = route->in_channels * size;
+    unsigned int out_frame = route->out_channels * size;
+    unsigned int n, ch;
+    int in;
+
+    src += first * in_frame;
+    dst += first * out_frame;
+    for (n = first; n < frames; n++) {
+        for (ch = 0; ch < route->out_channels; ch++) {
+            in = route->map[ch];
+            memcpy(dst + ch * size, in < 0 ? route->silence : src + in * size, size);
+        }
+        src += in_frame;
+        dst += out_frame;
+    }
+}
+
+static inline void pcm_route_deinterleave_scalar(const struct pcm_route *route,
+                                                 void *const *dst, const uint8_t *src,
+                                                 unsigned int first, unsigned int frames,
+                                                 unsigned int size)
+{
+    unsigned int in_frame = route->in_channels * size;
+    unsigned int n, ch;
+    uint8_t *plane;
+    int in;
+
+    for (ch = 0; ch < route->out_channels; ch++) {
+        plane = dst[ch];
+        in = route->map[ch];
+        for (n = first; n < frames; n++)
+            memcpy(plane + n * size, in < 0 ? route->silence : src + n * in_frame + in * size,
+                   size);
+    }
+}
+
+static inline void pcm_route_interleave_scalar(const struct pcm_route *route, uint8_t *dst,
+                                               const void *const *src, unsigned int first,
+                                               unsigned int frames, unsigned int size)
+{
+    unsigned int out_frame = route->out_channels * size;
+    unsigned int n, ch;
+    int in;
+
+    dst += first * out_frame;
+    for (n = first; n < frames; n++) {
+        for (ch = 0; ch < route->out_channels; ch++) {
+            in = route->map[ch];
+            memcpy(dst + ch * size,
+                   in < 0 ? route->silence : (const uint8_t *) src[in] + n * size, size);
+        }
+        dst += out_frame;
+    }
+}
+
+/* The vector kernels move whole channel groups between the interleaved
+ * frames and the planes by transposing square blocks of samples. Each
+ * returns the number of frames it handled, the scalar code does the rest. */
+
+#ifdef PCM_ROUTE_SSE2
+
+static inline void pcm_route_transpose_32(__m128i *r)
+{
+    __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    __m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+    __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+    __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+    r[0] = _mm_unpacklo_epi64(t0, t1);
+    r[1] = _mm_unpackhi_epi64(t0, t1);
+    r[2] = _mm_unpacklo_epi64(t2, t3);
+    r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+static inline void pcm_route_transpose_16(__m128i *r)
+{
+    __m128i a[8], b[8];
+    unsigned int i;
+
+    for (i = 0; i < 4; i++) {
+        a[i] = _mm_unpacklo_epi16(r[2 * i], r[2 * i + 1]);
+        a[i + 4] = _mm_unpackhi_epi16(r[2 * i], r[2 * i + 1]);
+    }
+    for (i = 0; i < 2; i++) {
+        b[4 * i] = _mm_unpacklo_epi32(a[4 * i], a[4 * i + 1]);
+        b[4 * i + 1] = _mm_unpacklo_epi32(a[4 * i + 2], a[4 * i + 3]);
+        b[4 * i + 2] = _mm_unpackhi_epi32(a[4 * i], a[4 * i + 1]);
+        b[4 * i + 3] = _mm_unpackhi_epi32(a[4 * i + 2], a[4 * i + 3]);
+    }
+    for (i = 0; i < 4; i++) {
+        r[2 * i] = _mm_unpacklo_epi64(b[2 * i], b[2 * i + 1]);
+        r[2 * i + 1] = _mm_unpackhi_epi64(b[2 * i], b[2 * i + 1]);
+    }
+}
+
+/* Transposes blocks of lanes x lanes samples, lanes being the number of
+ * samples in a vector and a divisor of channels */
+static inline unsigned int pcm_route_deinterleave_blocks(uint8_t *const *planes,
+                                                         const uint8_t *src,
+                                                         unsigned int frames,
+                                                         unsigned int channels,
+                                                         unsigned int size)
+{
+    const unsigned int lanes = 16 / size;
+    __m128i r[8];
+    unsigned int n, ch, i;
+
+    for (n = 0; n + lanes <= frames; n += lanes) {
+        for (ch = 0; ch < channels; ch += lanes) {
+            for (i = 0; i < lanes; i++)
+                r[i] = _mm_loadu_si128((const __m128i *) (src + ((n + i) * channels + ch) * size));
+            if (size == 4)
+                pcm_route_transpose_32(r);
+            else
+                pcm_route_transpose_16(r);
+            for (i = 0; i < lanes; i++)
+                _mm_storeu_si128((__m128i *) (planes[ch + i] + n * size), r[i]);
+        }
+    }
+    return n;
+}
+
+static inline unsigned int pcm_route_interleave_blocks(uint8_t *dst,
+                                                       const uint8_t *const *planes,
+                                                       unsigned int frames,
+                                                       unsigned int channels,
+                                                       unsigned int size)
+{
+    const unsigned int lanes = 16 / size;
+    __m128i r[8];
+    unsigned int n, ch, i;
+
+    for (n = 0; n + lanes <= frames; n += lanes) {
+        for (ch = 0; ch < channels; ch += lanes) {
+            for (i = 0; i < lanes; i++)
+                r[i] = _mm_loadu_si128((const __m128i *) (planes[ch + i] + n * size));
+            if (size == 4)
+                pcm_route_transpose_32(r);
+            else
+                pcm_route_transpose_16(r);
+            for (i = 0; i < lanes; i++)
+                _mm_storeu_si128((__m128i *) (dst + ((n + i) * channels + ch) * size), r[i]);
+        }
+    }
+    return n;
+}
+
+/* Stereo and four channels of 16 bit samples are narrower than a block */
+static unsigned int pcm_route_deinterleave_narrow(uint8_t *const *planes,
+                                                  const uint8_t *src,
+                                                  unsigned int frames,
+                                                  unsigned int channels,
+                                                  unsigned int size)
+{
+    const __m128i *in = (const __m128i *) src;
+    __m128i a, b, c, d, t0, t1, t2, t3;
+    unsigned int n;
+
+    if (size == 4) {
+        /* channels == 2 */
+        for (n = 0; n + 4 <= frames; n += 4) {
+            __m128 x = _mm_castsi128_ps(_mm_loadu_si128(in++));
+            __m128 y = _mm_castsi128_ps(_mm_loadu_si128(in++));
+            _mm_storeu_ps((float *) (planes[0] + n * 4),
+                          _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps((float *) (planes[1] + n * 4),
+                          _mm_shuffle_ps(x, y, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        return n;
+    }
+
+    if (channels == 2) {
+        for (n = 0; n + 8 <= frames; n += 8) {
+            a = _mm_loadu_si128(in++);
+            b = _mm_loadu_si128(in++);
+            /* sign extended halves pack back without saturating */
+            _mm_storeu_si128((__m128i *) (planes[0] + n * 2),
+                             _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                                             _mm_srai_epi32(_mm_slli_epi32(b, 16), 16)));
+            _mm_storeu_si128((__m128i *) (planes[1] + n * 2),
+                             _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+        }
+        return n;
+    }
+
+    /* channels == 4 */
+    for (n = 0; n + 8 <= frames; n += 8) {
+        a = _mm_loadu_si128(in++);
+        b = _mm_loadu_si128(in++);
+        c = _mm_loadu_si128(in++);
+        d = _mm_loadu_si128(in++);
+        t0 = _mm_unpacklo_epi16(a, b);
+        t1 = _mm_unpackhi_epi16(a, b);
+        t2 = _mm_unpacklo_epi16(c, d);
+        t3 = _mm_unpackhi_epi16(c, d);
+        a = _mm_unpacklo_epi16(t0, t1);
+        b = _mm_unpackhi_epi16(t0, t1);
+        c = _mm_unpacklo_epi16(t2, t3);
+        d = _mm_unpackhi_epi16(t2, t3);
+        _mm_storeu_si128((__m128i *) (planes[0] + n * 2), _mm_unpacklo_epi64(a, c));
+        _mm_storeu_si128((__m128i *) (planes[1] + n * 2), _mm_unpackhi_epi64(a, c));
+        _mm_storeu_si128((__m128i *) (planes[2] + n * 2), _mm_unpacklo_epi64(b, d));
+        _mm_storeu_si128((__m128i *) (planes[3] + n * 2), _mm_unpackhi_epi64(b, d));
+    }
+    return n;
+}
+
+static unsigned int pcm_route_interleave_narrow(uint8_t *dst, const uint8_t *const *planes,
+                                                unsigned int frames,
+                                                unsigned int channels,
+                                                unsigned int size)
+{
+    __m128i *out = (__m128i *) dst;
+    __m128i a, b, c, d, t0, t1;
+    unsigned int n;
+
+    if (size == 4) {
+        for (n = 0; n + 4 <= frames; n += 4) {
+            a = _mm_loadu_si128((const __m128i *) (planes[0] + n * 4));
+            b = _mm_loadu_si128((const __m128i *) (planes[1] + n * 4));
+            _mm_storeu_si128(out++, _mm_unpacklo_epi32(a, b));
+            _mm_storeu_si128(out++, _mm_unpackhi_epi32(a, b));
+        }
+        return n;
+    }
+
+    if (channels == 2) {
+        for (n = 0; n + 8 <= frames; n += 8) {
+            a = _mm_loadu_si128((const __m128i *) (planes[0] + n * 2));
+            b = _mm_loadu_si128((const __m128i *) (planes[1] + n * 2));
+            _mm_storeu_si128(out++, _mm_unpacklo_epi16(a, b));
+            _mm_storeu_si128(out++, _mm_unpackhi_epi16(a, b));
+        }
+        return n;
+    }
+
+    for (n = 0; n + 8 <= frames; n += 8) {
+        a = _mm_loadu_si128((const __m128i *) (planes[0] + n * 2));
+        b = _mm_loadu_si128((const __m128i *) (planes[1] + n * 2));
+        c = _mm_loadu_si128((const __m128i *) (planes[2] + n * 2));
+        d = _mm_loadu_si128((const __m128i *) (planes[3] + n * 2));
+        t0 = _mm_unpacklo_epi16(a, b);
+        t1 = _mm_unpacklo_epi16(c, d);
+        _mm_storeu_si128(out++, _mm_unpacklo_epi32(t0, t1));
+        _mm_storeu_si128(out++, _mm_unpackhi_epi32(t0, t1));
+        t0 = _mm_unpackhi_epi16(a, b);
+        t1 = _mm_unpackhi_epi16(c, d);
+        _mm_storeu_si128(out++, _mm_unpacklo_epi32(t0, t1));
+        _mm_storeu_si128(out++, _mm_unpackhi_epi32(t0, t1));
+    }
+    return n;
+}
+
+#endif /* PCM_ROUTE_SSE2 */
+
+#ifdef PCM_ROUTE_NEON
+
+static inline void pcm_route_transpose_32(uint32x4_t *r)
+{
+    uint32x4x2_t t01 = vtrnq_u32(r[0], r[1]);
+    uint32x4x2_t t23 = vtrnq_u32(r[2], r[3]);
+
+    r[0] = vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0]));
+    r[1] = vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1]));
+    r[2] = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0]));
+    r[3] = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1]));
+}
+
+static inline void pcm_route_transpose_16(uint32x4_t *r)
+{
+    uint16x8x2_t t[4];
+    uint32x4x2_t u[4];
+    unsigned int i;
+
+    for (i = 0; i < 4; i++)
+        t[i] = vtrnq_u16(vreinterpretq_u16_u32(r[2 * i]), vreinterpretq_u16_u32(r[2 * i + 1]));
+    for (i = 0; i < 2; i++) {
+        u[2 * i] = vtrnq_u32(vreinterpretq_u32_u16(t[2 * i].val[0]),
+                             vreinterpretq_u32_u16(t[2 * i + 1].val[0]));
+        u[2 * i + 1] = vtrnq_u32(vreinterpretq_u32_u16(t[2 * i].val[1]),
+                                 vreinterpretq_u32_u16(t[2 * i + 1].val[1]));
+    }
+    /* u[0] and u[1] hold rows 0-3, u[2] and u[3] rows 4-7 */
+    r[0] = vcombine_u32(vget_low_u32(u[0].val[0]), vget_low_u32(u[2].val[0]));
+    r[1] = vcombine_u32(vget_low_u32(u[1].val[0]), vget_low_u32(u[3].val[0]));
+    r[2] = vcombine_u32(vget_low_u32(u[0].val[1]), vget_low_u32(u[2].val[1]));
+    r[3] = vcombine_u32(vget_low_u32(u[1].val[1]), vget_low_u32(u[3].val[1]));
+    r[4] = vcombine_u32(vget_high_u32(u[0].val[0]), vget_high_u32(u[2].val[0]));
+    r[5] = vcombine_u32(vget_high_u32(u[1].val[0]), vget_high_u32(u[3].val[0]));
+    r[6] = vcombine_u32(vget_high_u32(u[0].val[1]), vget_high_u32(u[2].val[1]));
+    r[7] = vcombine_u32(vget_high_u32(u[1].val[1]), vget_high_u32(u[3].val[1]));
+}
+
+static inline unsigned int pcm_route_deinterleave_blocks(uint8_t *const *planes,
+                                                         const uint8_t *src,
+                                                         unsigned int frames,
+                                                         unsigned int channels,
+                                                         unsigned int size)
+{
+    const unsigned int lanes = 16 / size;
+    uint32x4_t r[8];
+    unsigned int n, ch, i;
+
+    for (n = 0; n + lanes <= frames; n += lanes) {
+        for (ch = 0; ch < channels; ch += lanes) {
+            for (i = 0; i < lanes; i++)
+                r[i] = vreinterpretq_u32_u8(vld1q_u8(src + ((n + i) * channels + ch) * size));
+            if (size == 4)
+                pcm_route_transpose_32(r);
+            else
+                pcm_route_transpose_16(r);
+            for (i = 0; i < lanes; i++)
+                vst1q_u8(planes[ch + i] + n * size, vreinterpretq_u8_u32(r[i]));
+        }
+    }
+    return n;
+}
+
+static inline unsigned int pcm_route_interleave_blocks(uint8_t *dst,
+                                                       const uint8_t *const *planes,
+                                                       unsigned int frames,
+                                                       unsigned int channels,
+                                                       unsigned int size)
+{
+    const unsigned int lanes = 16 / size;
+    uint32x4_t r[8];
+    unsigned int n, ch, i;
+
+    for (n = 0; n + lanes <= frames; n += lanes) {
+        for (ch = 0; ch < channels; ch += lanes) {
+            for (i = 0; i < lanes; i++)
+                r[i] = vreinterpretq_u32_u8(vld1q_u8(planes[ch + i] + n * size));
+            if (size == 4)
+                pcm_route_transpose_32(r);
+            else
+                pcm_route_transpose_16(r);
+            for (i = 0; i < lanes; i++)
+                vst1q_u8(dst + ((n + i) * channels + ch) * size, vreinterpretq_u8_u32(r[i]));
+        }
+    }
+    return n;
+}
+
+/* NEON loads and stores two and four channels natively */
+static unsigned int pcm_route_deinterleave_narrow(uint8_t *const *planes,
+                                                  const uint8_t *src,
+                                                  unsigned int frames,
+                                                  unsigned int channels,
+                                                  unsigned int size)
+{
+    unsigned int n;
+
+    if (size == 4) {
+        for (n = 0; n + 4 <= frames; n += 4) {
+            uint32x4x2_t v = vld2q_u32((const uint32_t *) (src + n * 8));
+            vst1q_u32((uint32_t *) (planes[0] + n * 4), v.val[0]);
+            vst1q_u32((uint32_t *) (planes[1] + n * 4), v.val[1]);
+        }
+        return n;
+    }
+
+    if (channels == 2) {
+        for (n = 0; n + 8 <= frames; n += 8) {
+            uint16x8x2_t v = vld2q_u16((const uint16_t *) (src + n * 4));
+            vst1q_u16((uint16_t *) (planes[0] + n * 2), v.val[0]);
+            vst1q_u16((uint16_t *) (planes[1] + n * 2), v.val[1]);
+        }
+        return n;
+    }
+
+    for (n = 0; n + 8 <= frames; n += 8) {
+        uint16x8x4_t v = vld4q_u16((const uint16_t *) (src + n * 8));
+        vst1q_u16((uint16_t *) (planes[0] + n * 2), v.val[0]);
+        vst1q_u16((uint16_t *) (planes[1] + n * 2), v.val[1]);
+        vst1q_u16((uint16_t *) (planes[2] + n * 2), v.val[2]);
+        vst1q_u16((uint16_t *) (planes[3] + n * 2), v.val[3]);
+    }
+    return n;
+}
+
+static unsigned int pcm_route_interleave_narrow(uint8_t *dst, const uint8_t *const *planes,
+                                                unsigned int frames,
+                                                unsigned int channels,
+                                                unsigned int size)
+{
+    unsigned int n;
+
+    if (size == 4) {
+        for (n = 0; n + 4 <= frames; n += 4) {
+            uint32x4x2_t v;
+            v.val[0] = vld1q_u32((const uint32_t *) (planes[0] + n * 4));
+            v.val[1] = vld1q_u32((const uint32_t *) (planes[1] + n * 4));
+            vst2q_u32((uint32_t *) (dst + n * 8), v);
+        }
+        return n;
+    }
+
+    if (channels == 2) {
+        for (n = 0; n + 8 <= frames; n += 8) {
+            uint16x8x2_t v;
+            v.val[0] = vld1q_u16((const uint16_t *) (planes[0] + n * 2));
+            v.val[1] = vld1q_u16((const uint16_t *) (planes[1] + n * 2));
+            vst2q_u16((uint16_t *) (dst + n * 4), v);
+        }
+        return n;
+    }
+
+    for (n = 0; n + 8 <= frames; n += 8) {
+        uint16x8x4_t v;
+        v.val[0] = vld1q_u16((const uint16_t *) (planes[0] + n * 2));
+        v.val[1] = vld1q_u16((const uint16_t *) (planes[1] + n * 2));
+        v.val[2] = vld1q_u16((const uint16_t *) (planes[2] + n * 2));
+        v.val[3] = vld1q_u16((const uint16_t *) (planes[3] + n * 2));
+        vst4q_u16((uint16_t *) (dst + n * 8), v);
+    }
+    return n;
+}
+
+#endif /* PCM_ROUTE_NEON */
+
+#if defined(PCM_ROUTE_SSE2) || defined(PCM_ROUTE_NEON)
+
+static int pcm_route_vector_supported(unsigned int channels, unsigned int size)
+{
+    if ((size != 2 && size != 4) || channels > PCM_ROUTE_VECTOR_CHANNELS)
+        return 0;
+    return channels == 2 || (channels == 4 && size == 2) || !(channels % (16 / size));
+}
+
+/* Specializes the block kernels for the common channel counts */
+static unsigned int pcm_route_deinterleave_vector(uint8_t *const *planes,
+                                                  const uint8_t *src,
+                                                  unsigned int frames,
+                                                  unsigned int channels,
+                                                  unsigned int size)
+{
+    if (!pcm_route_vector_supported(channels, size))
+        return 0;
+    if (channels == 2 || (channels == 4 && size == 2))
+        return pcm_route_deinterleave_narrow(planes, src, frames, channels, size);
+
+    switch (channels) {
+    case 4:
+        return pcm_route_deinterleave_blocks(planes, src, frames, 4, 4);
+    case 8:
+        return size == 2 ? pcm_route_deinterleave_blocks(planes, src, frames, 8, 2) :
+                           pcm_route_deinterleave_blocks(planes, src, frames, 8, 4);
+    case 16:
+        return size == 2 ? pcm_route_deinterleave_blocks(planes, src, frames, 16, 2) :
+                           pcm_route_deinterleave_blocks(planes, src, frames, 16, 4);
+    case 32:
+        return size == 2 ? pcm_route_deinterleave_blocks(planes, src, frames, 32, 2) :
+                           pcm_route_deinterleave_blocks(planes, src, frames, 32, 4);
+    default:
+        return size == 2 ? pcm_route_deinterleave_blocks(planes, src, frames, channels, 2) :
+                           pcm_route_deinterleave_blocks(planes, src, frames, channels, 4);
+    }
+}
+
+static unsigned int pcm_route_interleave_vector(uint8_t *dst, const uint8_t *const *planes,
+                                                unsigned int frames,
+                                                unsigned int channels,
+                                                unsigned int size)
+{
+    if (!pcm_route_vector_supported(channels, size))
+        return 0;
+    if (channels == 2 || (channels == 4 && size == 2))
+        return pcm_route_interleave_narrow(dst, planes, frames, channels, size);
+
+    switch (channels) {
+    case 4:
+        return pcm_route_interleave_blocks(dst, planes, frames, 4, 4);
+    case 8:
+        return size == 2 ? pcm_route_interleave_blocks(dst, planes, frames, 8, 2) :
+                           pcm_route_interleave_blocks(dst, planes, frames, 8, 4);
+    case 16:
+        return size == 2 ? pcm_route_interleave_blocks(dst, planes, frames, 16, 2) :
+                           pcm_route_interleave_blocks(dst, planes, frames, 16, 4);
+    case 32:
+        return size == 2 ? pcm_route_interleave_blocks(dst, planes, frames, 32, 2) :
+                           pcm_route_interleave_blocks(dst, planes, frames, 32, 4);
+    default:
+        return size == 2 ? pcm_route_interleave_blocks(dst, planes, frames, channels, 2) :
+                           pcm_route_interleave_blocks(dst, planes, frames, channels, 4);
+    }
+}
+
+/* Reorders interleaved frames through a small planar buffer, which stays
+ * in the cache, so that both passes use the vector kernels */
+static unsigned int pcm_route_apply_vector(const struct pcm_route *route, uint8_t *dst,
+                                           const uint8_t *src, unsigned int frames)
+{
+    uint8_t chunk[PCM_ROUTE_CHUNK_BYTES] __attribute__((aligned(16)));
+    uint8_t *planes[PCM_ROUTE_VECTOR_CHANNELS];
+    const uint8_t *order[PCM_ROUTE_VECTOR_CHANNELS];
+    unsigned int channels = route->in_channels;
+    unsigned int size = route->sample_size;
+    unsigned int frame_size = channels * size;
+    unsigned int chunk_frames = (PCM_ROUTE_CHUNK_BYTES / frame_size) & ~7u;
+    unsigned int n = 0, count, done, ch;
+
+    if (!route->is_permutation || !pcm_route_vector_supported(channels, size))
+        return 0;
+    /* Wide frames of 32 bit samples are as fast one move at a time */
+    if (size == 4 && channels > 8)
+        return 0;
+
+    for (ch = 0; ch < channels; ch++)
+        planes[ch] = chunk + ch * chunk_frames * size;
+    for (ch = 0; ch < channels; ch++)
+        order[ch] = planes[route->map[ch]];
+
+    while (n < frames) {
+        count = frames - n < chunk_frames ? frames - n : chunk_frames;
+        done = pcm_route_deinterleave_vector(planes, src + n * frame_size, count,
+                                             channels, size);
+        pcm_route_interleave_vector(dst + n * frame_size, order, done, channels, size);
+        n += done;
+        if (done < count)
+            break;
+    }
+    return n;
+}
+
+#endif
+
+/** Moves the channels of interleaved frames to other interleaved frames.
+ * Permutations use the vector kernels of @ref pcm_route_deinterleave.
+ * @param route A channel map.
+ * @param dst Receives the output frames. Must not overlap @p src.
+ * @param src The input frames.
+ * @param frames The number of frames to move.
+ * @returns Zero on success.
+ *  -EINVAL if @p route is NULL.
+ * @ingroup libtinyalsa-route
+ */
+int pcm_route_apply(const struct pcm_route *route, void *dst, const void *src,
+                    unsigned int frames)
+{
+    unsigned int first = 0;
+
+    if (!route)
+        return -EINVAL;
+
+    if (route->is_identity) {
+        memcpy(dst, src, frames * route->in_channels * route->sample_size);
+        return 0;
+    }
+
+#if defined(PCM_ROUTE_SSE2) || defined(PCM_ROUTE_NEON)
+    first = pcm_route_apply_vector(route, dst, src, frames);
+#endif
+
+    switch (route->sample_size) {
+    case 1:
+        pcm_route_apply_scalar(route, dst, src, first, frames, 1);
+        break;
+    case 2:
+        pcm_route_apply_scalar(route, dst, src, first, frames, 2);
+        break;
+    case 3:
+        pcm_route_apply_scalar(route, dst, src, first, frames, 3);
+        break;
+    case 4:
+        pcm_route_apply_scalar(route, dst, src, first, frames, 4);
+        break;
+    default:
+        pcm_route_apply_scalar(route, dst, src, first, frames, 8);
+        break;
+    }
+    return 0;
+}
+
+/** Splits interleaved frames into one buffer per output channel.
+ * Permutations of 16 and 32 bit samples, of 2, 4, 8, 16 or 32 channels
+ * (or any multiple of the samples in a vector), use vector kernels.
+ * @param route A channel map.
+ * @param dst The buffer of each output channel.
+ * @param src The interleaved input frames.
+ * @param frames The number of frames to move.
+ * @returns Zero on success.
+ *  -EINVAL if @p route is NULL.
+ * @ingroup libtinyalsa-route
+ */
+int pcm_route_deinterleave(const struct pcm_route *route, void *const *dst,
+                           const void *src, unsigned int frames)
+{
+    unsigned int first = 0;
+
+    if (!route)
+        return -EINVAL;
+
+#if defined(PCM_ROUTE_SSE2) || defined(PCM_ROUTE_NEON)
+    if (route->is_permutation && route->in_channels <= PCM_ROUTE_VECTOR_CHANNELS) {
+        uint8_t *planes[PCM_ROUTE_VECTOR_CHANNELS];
+        unsigned int ch;
+
+        for (ch = 0; ch < route->in_channels; ch++)
+            planes[ch] = dst[route->inverse[ch]];
+        first = pcm_route_deinterleave_vector(planes, src, frames, route->in_channels,
+                                              route->sample_size);
+    }
+#endif
+
+    switch (route->sample_size) {
+    case 1:
+        pcm_route_deinterleave_scalar(route, dst, src, first, frames, 1);
+        break;
+    case 2:
+        pcm_route_deinterleave_scalar(route, dst, src, first, frames, 2);
+        break;
+    case 3:
+        pcm_route_deinterleave_scalar(route, dst, src, first, frames, 3);
+        break;
+    case 4:
+        pcm_route_deinterleave_scalar(route, dst, src, first, frames, 4);
+        break;
+    default:
+        pcm_route_deinterleave_scalar(route, dst, src, first, frames, 8);
+        break;
+    }
+    return 0;
+}
+
+/** Merges one buffer per input channel into interleaved frames.
+ * Uses vector kernels in the same cases as @ref pcm_route_deinterleave.
+ * @param route A channel map.
+ * @param dst Receives the interleaved output frames.
+ * @param src The buffer of each input channel.
+ * @param frames The number of frames to move.
+ * @returns Zero on success.
+ *  -EINVAL if @p route is NULL.
+ * @ingroup libtinyalsa-route
+ */
+int pcm_route_interleave(const struct pcm_route *route, void *dst,
+                         const void *const *src, unsigned int frames)
+{
+    unsigned int first = 0;
+
+    if (!route)
+        return -EINVAL;
+
+#if defined(PCM_ROUTE_SSE2) || defined(PCM_ROUTE_NEON)
+    if (route->is_permutation && route->out_channels <= PCM_ROUTE_VECTOR_CHANNELS) {
+        const uint8_t *planes[PCM_ROUTE_VECTOR_CHANNELS];
+        unsigned int ch;
+
+        for (ch = 0; ch < route->out_channels; ch++)
+            planes[ch] = src[route->map[ch]];
+        first = pcm_route_interleave_vector(dst, planes, frames, route->out_channels,
+                                            route->sample_size);
+    }
+#endif
+
+    switch (route->sample_size) {
+    case 1:
+        pcm_route_interleave_scalar(route, dst, src, first, frames, 1);
+        break;
+    case 2:
+        pcm_route_interleave_scalar(route, dst, src, first, frames, 2);
+        break;
+    case 3:
+        pcm_route_interleave_scalar(route, dst, src, first, frames, 3);
+        break;
+    case 4:
+        pcm_route_interleave_scalar(route, dst, src, first, frames, 4);
+        break;
+    default:
+        pcm_route_interleave_scalar(route, dst, src, first, frames, 8);
+        break;
+    }
+    return 0;
+}
@@ -0,0 +1,292 @@
+/* waitset.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include <tinyalsa/waitset.h>
+
+/** The number of epoll events fetched on the stack by @ref waitset_wait */
+#define WAITSET_EVENTS_MAX 64
+
+/* A handle registered in a wait set. A pointer to it is the epoll data. */
+struct waitset_entry {
+    enum waitset_type type;
+    void *handle;
+    void *user_data;
+    int fd;
+};
+
+/** A set of PCMs and mixers that are waited on with one epoll instance.
+ * @ingroup libtinyalsa-waitset
+ */
+struct waitset {
+    /** The epoll file descriptor */
+    int fd;
+    /** The registered handles */
+    struct waitset_entry **entries;
+    /** The number of registered handles */
+    unsigned int count;
+    /** The number of slots allocated in @ref entries */
+    unsigned int size;
+};
+
+/** Creates an empty wait set.
+ * @returns A wait set on success, NULL on failure.
+ * @ingroup libtinyalsa-waitset
+ */
+struct waitset *waitset_open(void)
+{
+    struct waitset *waitset;
+
+    waitset = calloc(1, sizeof(*waitset));
+    if (!waitset)
+        return NULL;
+
+    waitset->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (waitset->fd < 0) {
+        free(waitset);
+        return NULL;
+    }
+
+    return waitset;
+}
+
+/** Closes a wait set.
+ * The PCMs and mixers in the set are not closed.
+ * @param waitset A wait set, may be NULL.
+ * @ingroup libtinyalsa-waitset
+ */
+void waitset_close(struct waitset *waitset)
+{
+    unsigned int n;
+
+    if (!waitset)
+        return;
+
+    for (n = 0; n < waitset->count; n++)
+        free(waitset->entries[n]);
+    free(waitset->entries);
+    close(waitset->fd);
+    free(waitset);
+}
+
+static int waitset_add(struct waitset *waitset, enum waitset_type type,
+                       void *handle, int fd, void *user_data)
+{
+    struct waitset_entry *entry;
+    struct epoll_event ev;
+
+    if (!waitset || !handle || fd < 0)
+        return -EINVAL;
+
+    if (waitset->count == waitset->size) {
+        unsigned int size = waitset->size ? waitset->size * 2 : 8;
+        struct waitset_entry **entries;
+
+        entries = realloc(waitset->entries, size * sizeof(*entries));
+        if (!entries)
+            return -ENOMEM;
+        waitset->entries = entries;
+        waitset->size = size;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+        return -ENOMEM;
+    entry->type = type;
+    entry->handle = handle;
+    entry->user_data = user_data;
+    entry->fd = fd;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLERR;
+    ev.data.ptr = entry;
+    if (epoll_ctl(waitset->fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        int errno_copy = errno;
+        free(entry);
+        return -errno_copy;
+    }
+
+    waitset->entries[waitset->count++] = entry;
+    return 0;
+}
+
+static int waitset_remove(struct waitset *waitset, void *handle)
+{
+    unsigned int n;
+
+    if (!waitset || !handle)
+        return -EINVAL;
+
+    for (n = 0; n < waitset->count; n++) {
+        struct waitset_entry *entry = waitset->entries[n];
+        if (entry->handle != handle)
+            continue;
+
+        epoll_ctl(waitset->fd, EPOLL_CTL_DEL, entry->fd, NULL);
+        free(entry);
+        waitset->entries[n] = waitset->entries[--waitset->count];
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+/** Adds a PCM to a wait set.
+ * The PCM becomes ready when frames are available for read or write,
+ * the same condition that @ref pcm_wait waits for.
+ * @param waitset A wait set.
+ * @param pcm A PCM handle.
+ * @param user_data Returned with every event of the PCM.
+ * @returns On success, zero.
+ *  On failure, a negative errno value.
+ * @ingroup libtinyalsa-waitset
+ */
+int waitset_add_pcm(struct waitset *waitset, struct pcm *pcm, void *user_data)
+{
+    if (!pcm_is_ready(pcm))
+        return -EINVAL;
+
+    return waitset_add(waitset, WAITSET_PCM, pcm,
+                       pcm_get_file_descriptor(pcm), user_data);
+}
+
+/** Adds a mixer to a wait set.
+ * The mixer becomes ready when it has events to read,
+ * see @ref mixer_subscribe_events.
+ * @param waitset A wait set.
+ * @param mixer A mixer handle.
+ * @param user_data Returned with every event of the mixer.
+ * @returns On success, zero.
+ *  On failure, a negative errno value.
+ * @ingroup libtinyalsa-waitset
+ */
+int waitset_add_mixer(struct waitset *waitset, struct mixer *mixer, void *user_data)
+{
+    if (!mixer)
+        return -EINVAL;
+
+    return waitset_add(waitset, WAITSET_MIXER, mixer,
+                       mixer_get_file_descriptor(mixer), user_data);
+}
+
+/** Removes a PCM from a wait set.
+ * A PCM must be removed before it is closed.
+ * @param waitset A wait set.
+ * @param pcm A PCM handle that was added with @ref waitset_add_pcm.
+ * @returns On success, zero.
+ *  If the PCM is not in the set, -ENOENT.
+ * @ingroup libtinyalsa-waitset
+ */
+int waitset_remove_pcm(struct waitset *waitset, struct pcm *pcm)
+{
+    return waitset_remove(waitset, pcm);
+}
+
+/** Removes a mixer from a wait set.
+ * A mixer must be removed before it is closed.
+ * @param waitset A wait set.
+ * @param mixer A mixer handle that was added with @ref waitset_add_mixer.
+ * @returns On success, zero.
+ *  If the mixer is not in the set, -ENOENT.
+ * @ingroup libtinyalsa-waitset
+ */
+int waitset_remove_mixer(struct waitset *waitset, struct mixer *mixer)
+{
+    return waitset_remove(waitset, mixer);
+}
+
+static int waitset_pcm_status(struct pcm *pcm, unsigned int events)
+{
+    if (!(events & (EPOLLERR | EPOLLHUP)))
+        return 1;
+
+    switch (pcm_state(pcm)) {
+    case PCM_STATE_XRUN:
+        return -EPIPE;
+    case PCM_STATE_SUSPENDED:
+        return -ESTRPIPE;
+    case PCM_STATE_DISCONNECTED:
+        return -ENODEV;
+    default:
+        return -EIO;
+    }
+}
+
+/** Waits until at least one handle of a wait set is ready.
+ * All ready handles are returned by one epoll_wait() call.
+ * Errors of PCMs are translated in the same way as @ref pcm_wait does.
+ * @param waitset A wait set.
+ * @param events Receives the handles that are ready.
+ * @param max_events The number of elements in @p events.
+ * @param timeout The maximum amount of time to wait for, in terms of milliseconds.
+ *  A negative value waits forever.
+ * @returns The number of elements written to @p events.
+ *  If a timeout occured, zero is returned.
+ *  If an error occured, a negative errno value is returned.
+ * @ingroup libtinyalsa-waitset
+ */
+int waitset_wait(struct waitset *waitset, struct waitset_event *events,
+                 unsigned int max_events, int timeout)
+{
+    struct epoll_event ev[WAITSET_EVENTS_MAX];
+    int count;
+    int n;
+
+    if (!waitset || !events || !max_events)
+        return -EINVAL;
+
+    if (max_events > WAITSET_EVENTS_MAX)
+        max_events = WAITSET_EVENTS_MAX;
+
+    count = epoll_wait(waitset->fd, ev, max_events, timeout);
+    if (count < 0)
+        return -errno;
+
+    for (n = 0; n < count; n++) {
+        struct waitset_entry *entry = ev[n].data.ptr;
+
+        events[n].type = entry->type;
+        events[n].user_data = entry->user_data;
+        if (entry->type == WAITSET_PCM) {
+            events[n].handle.pcm = entry->handle;
+            events[n].status = waitset_pcm_status(entry->handle, ev[n].events);
+        } else {
+            events[n].handle.mixer = entry->handle;
+            events[n].status = (ev[n].events & (EPOLLERR | EPOLLHUP)) ? -EIO : 1;
+        }
+    }
+
+    return count;
+}
+
@@ -26,6 +26,7 @@
 ** DAMAGE.
 */
 
+#define _GNU_SOURCE
 #include <tinyalsa/asoundlib.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,6 +34,10 @@
 #include <signal.h>
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 #define ID_RIFF 0x46464952
 #define ID_WAVE 0x45564157
@@ -41,6 +46,13 @@
 
 #define FORMAT_PCM 1
 
+/* Frames are written to the file in blocks of this many bytes,
+ * at offsets that are multiples of it */
+#define WRITE_BLOCK (1024 * 1024)
+
+/* Space is preallocated this far ahead of the data, when there is no time limit */
+#define PREALLOCATE_AHEAD (64 * 1024 * 1024)
+
 struct wav_header {
     uint32_t riff_id;
     uint32_t riff_sz;
@@ -57,13 +69,27 @@ struct wav_header {
     uint32_t data_sz;
 };
 
-int capturing = 1;
+/* How frames are buffered between the capture thread and the file */
+struct capture_buffering {
+    /* Capacity of the ring, in seconds */
+    unsigned int ring_time;
+    /* SCHED_FIFO priority of the capture thread */
+    int priority;
+    /* Whether file space is reserved ahead of the data */
+    int preallocate;
+    /* Whether frames are written straight from the mmap buffer of the PCM,
+     * instead of going through the ring */
+    int mmap;
+};
+
+volatile sig_atomic_t capturing = 1;
 int prinfo = 1;
 
 unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
                             unsigned int channels, unsigned int rate,
                             enum pcm_format format, unsigned int period_size,
-                            unsigned int period_count, unsigned int capture_time);
+                            unsigned int period_count, unsigned int capture_time,
+                            const struct capture_buffering *buffering);
 
 void sigint_handler(int sig)
 {
@@ -87,10 +113,17 @@ int main(int argc, char **argv)
     unsigned int capture_time = UINT_MAX;
     enum pcm_format format;
     int no_header = 0;
+    struct capture_buffering buffering = {
+        .ring_time = 4,
+        .priority = 50,
+        .preallocate = 0,
+        .mmap = 0,
+    };
 
     if (argc < 2) {
         fprintf(stderr, "Usage: %s {file.wav | --} [-D card] [-d device] [-c channels] "
-                "[-r rate] [-b bits] [-p period_size] [-n n_periods] [-t time_in_seconds]\n\n"
+                "[-r rate] [-b bits] [-p period_size] [-n n_periods] [-t time_in_seconds] "
+                "[-B ring_seconds] [-P priority] [-a] [-M]\n\n"
                 "Use -- for filename to send raw PCM to stdout\n", argv[0]);
         return 1;
     }
@@ -142,6 +175,18 @@ int main(int argc, char **argv)
             argv++;
             if (*argv)
                 capture_time = atoi(*argv);
+        } else if (strcmp(*argv, "-B") == 0) {
+            argv++;
+            if (*argv)
+                buffering.ring_time = atoi(*argv);
+        } else if (strcmp(*argv, "-P") == 0) {
+            argv++;
+            if (*argv)
+                buffering.priority = atoi(*argv);
+        } else if (strcmp(*argv, "-a") == 0) {
+            buffering.preallocate = 1;
+        } else if (strcmp(*argv, "-M") == 0) {
+            buffering.mmap = 1;
         }
         if (*argv)
             argv++;
@@ -185,7 +230,7 @@ int main(int argc, char **argv)
     signal(SIGINT, sigint_handler);
     frames = capture_sample(file, card, device, header.num_channels,
                             header.sample_rate, format,
-                            period_size, period_count, capture_time);
+                            period_size, period_count, capture_time, &buffering);
     if (prinfo) {
         printf("Captured %u frames\n", frames);
     }
@@ -203,18 +248,128 @@ int main(int argc, char **argv)
     return 0;
 }
 
+/* Writes all of a buffer, retrying after a signal or a short write */
+static int write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t ret = write(fd, data, size);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+/* Reserves file space up to end, so that block allocation does not stall
+ * the writes. Returns zero if space cannot be reserved on this file. */
+static int preallocate(int fd, off_t *allocated, off_t end)
+{
+    if (end <= *allocated)
+        return 1;
+    if (fallocate(fd, 0, *allocated, end - *allocated) < 0) {
+        fprintf(stderr, "Unable to preallocate file space: %s\n", strerror(errno));
+        return 0;
+    }
+    *allocated = end;
+    return 1;
+}
+
+/* Writes the regions of the mmap buffer of a capture PCM straight to the
+ * file, so that the only copy of the frames is the one made by write() */
+static unsigned long long capture_mmap(struct pcm *pcm, FILE *file,
+                                       unsigned long long frame_limit)
+{
+    unsigned long long total_frames = 0;
+    unsigned int bytes_per_frame, overruns = 0;
+    unsigned int offset, frames;
+    void *areas;
+    int started = 0;
+    int fd, err;
+
+    fflush(file);
+    fd = fileno(file);
+    bytes_per_frame = pcm_frames_to_bytes(pcm, 1);
+
+    while (capturing && total_frames < frame_limit) {
+        frames = pcm_get_buffer_size(pcm);
+        if (frames > frame_limit - total_frames)
+            frames = frame_limit - total_frames;
+        if (pcm_mmap_begin(pcm, &areas, &offset, &frames) < 0) {
+            fprintf(stderr, "Error mapping ring buffer: %s\n", pcm_get_error(pcm));
+            break;
+        }
+
+        if (frames == 0) {
+            /* the first call prepared the PCM, nothing is captured until it starts */
+            if (!started) {
+                if (pcm_start(pcm) < 0) {
+                    fprintf(stderr, "Error starting stream: %s\n", pcm_get_error(pcm));
+                    break;
+                }
+                started = 1;
+                continue;
+            }
+            err = pcm_wait(pcm, -1);
+            if (err == -EPIPE) {
+                /* the frames that were not written out yet are lost */
+                overruns++;
+                pcm_stop(pcm);
+                if (pcm_prepare(pcm) < 0) {
+                    fprintf(stderr, "Error preparing stream: %s\n", pcm_get_error(pcm));
+                    break;
+                }
+                started = 0;
+            } else if (err < 0 && err != -EINTR) {
+                fprintf(stderr, "Error waiting for stream: %s\n", strerror(-err));
+                break;
+            }
+            continue;
+        }
+
+        /* the region ends at the wrap point of the buffer,
+         * the frames after it come with the next region */
+        if (write_all(fd, (char *)areas + pcm_frames_to_bytes(pcm, offset),
+                      (size_t)frames * bytes_per_frame) < 0) {
+            fprintf(stderr, "Error capturing sample: %s\n", strerror(errno));
+            break;
+        }
+
+        if (pcm_mmap_commit(pcm, offset, frames) < 0) {
+            fprintf(stderr, "Error committing frames: %s\n", pcm_get_error(pcm));
+            break;
+        }
+        total_frames += frames;
+    }
+
+    pcm_stop(pcm);
+
+    if (prinfo || overruns)
+        fprintf(prinfo ? stdout : stderr, "%u overruns\n", overruns);
+
+    return total_frames;
+}
+
 unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
                             unsigned int channels, unsigned int rate,
                             enum pcm_format format, unsigned int period_size,
-                            unsigned int period_count, unsigned int capture_time)
+                            unsigned int period_count, unsigned int capture_time,
+                            const struct capture_buffering *buffering)
 {
     struct pcm_config config;
     struct pcm *pcm;
-    char *buffer;
-    unsigned int size;
-    unsigned int frames_read;
-    unsigned int total_frames_read;
-    unsigned int bytes_per_frame;
+    struct pcm_ring *ring;
+    struct pcm_ring_pump *pump;
+    unsigned long long frame_limit;
+    unsigned long long total_frames = 0;
+    unsigned int bytes_per_frame, ring_frames, high_water, overruns;
+    struct pcm_stats stats;
+    struct timespec idle;
+    off_t offset, allocated;
+    int fd, preallocating, pump_stopped = 0, error = 0;
 
     memset(&config, 0, sizeof(config));
     config.channels = channels;
@@ -226,17 +381,57 @@ unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
     config.stop_threshold = 0;
     config.silence_threshold = 0;
 
-    pcm = pcm_open(card, device, PCM_IN, &config);
+    pcm = pcm_open(card, device, PCM_IN | (buffering->mmap ? PCM_MMAP : 0), &config);
     if (!pcm || !pcm_is_ready(pcm)) {
         fprintf(stderr, "Unable to open PCM device (%s)\n",
                 pcm_get_error(pcm));
         return 0;
     }
 
-    size = pcm_frames_to_bytes(pcm, pcm_get_buffer_size(pcm));
-    buffer = malloc(size);
-    if (!buffer) {
-        fprintf(stderr, "Unable to allocate %u bytes\n", size);
+    frame_limit = capture_time == UINT_MAX ? ULLONG_MAX :
+                  (unsigned long long)capture_time * rate;
+
+    if (buffering->mmap) {
+        if (prinfo) {
+            printf("Capturing sample: %u ch, %u hz, %u bit\n", channels, rate,
+               pcm_format_to_bits(format));
+        }
+        total_frames = capture_mmap(pcm, file, frame_limit);
+        pcm_close(pcm);
+        return total_frames > UINT_MAX ? UINT_MAX : total_frames;
+    }
+
+    /* the ring absorbs stalls of the file system while the capture thread
+     * keeps up with the device */
+    ring_frames = rate * (buffering->ring_time ? buffering->ring_time : 1);
+    ring = pcm_ring_open(pcm_get_config(pcm), ring_frames);
+    if (!ring) {
+        fprintf(stderr, "Unable to allocate a ring of %u frames\n", ring_frames);
+        pcm_close(pcm);
+        return 0;
+    }
+    ring_frames = pcm_ring_get_size(ring);
+    bytes_per_frame = pcm_frames_to_bytes(pcm, 1);
+
+    fflush(file);
+    fd = fileno(file);
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0)
+        offset = 0;
+    allocated = offset;
+    preallocating = buffering->preallocate && file != stdout;
+    if (preallocating && frame_limit != ULLONG_MAX)
+        preallocating = preallocate(fd, &allocated, offset + frame_limit * bytes_per_frame);
+
+    pump = pcm_ring_pump_start(ring, pcm, buffering->priority);
+    if (!pump && buffering->priority > 0) {
+        fprintf(stderr, "Unable to capture at real-time priority %d, capturing without it\n",
+                buffering->priority);
+        pump = pcm_ring_pump_start(ring, pcm, 0);
+    }
+    if (!pump) {
+        fprintf(stderr, "Unable to start the capture thread\n");
+        pcm_ring_close(ring);
         pcm_close(pcm);
         return 0;
     }
@@ -246,23 +441,78 @@ unsigned int capture_sample(FILE *file, unsigned int card, unsigned int device,
            pcm_format_to_bits(format));
     }
 
-    bytes_per_frame = pcm_frames_to_bytes(pcm, 1);
-    total_frames_read = 0;
-    frames_read = 0;
-    while (capturing) {
-        frames_read = pcm_readi(pcm, buffer, pcm_get_buffer_size(pcm));
-        total_frames_read += frames_read;
-        if ((total_frames_read / rate) >= capture_time) {
-            capturing = 0;
+    /* without a full block, wait for about a tenth of one to come in */
+    idle.tv_sec = 0;
+    idle.tv_nsec = (long)(WRITE_BLOCK / 10) * 1000000000LL / ((long long)rate * bytes_per_frame);
+    if (idle.tv_nsec > 100000000)
+        idle.tv_nsec = 100000000;
+
+    while (total_frames < frame_limit) {
+        unsigned long long remaining = frame_limit - total_frames;
+        unsigned int wanted, frames;
+        void *data;
+
+        /* the capture thread exits on errors such as the device going away */
+        if ((!capturing || pcm_ring_pump_get_error(pump) < 0) && !pump_stopped) {
+            /* what is left in the ring is still written out */
+            error = pcm_ring_pump_stop(pump);
+            pump_stopped = 1;
         }
-        if (fwrite(buffer, bytes_per_frame, frames_read, file) != frames_read) {
-            fprintf(stderr,"Error capturing sample\n");
+
+        /* end each write on a block boundary of the file */
+        wanted = (WRITE_BLOCK - offset % WRITE_BLOCK) / bytes_per_frame;
+        if (wanted == 0)
+            wanted = 1;
+        if (wanted > remaining)
+            wanted = remaining;
+
+        if (pcm_ring_get_fill(ring) < wanted && !pump_stopped) {
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        frames = pcm_ring_read_begin(ring, &data, wanted);
+        if (frames == 0)
+            break;
+
+        if (preallocating)
+            preallocating = preallocate(fd, &allocated,
+                                        offset + (off_t)frames * bytes_per_frame + PREALLOCATE_AHEAD);
+
+        if (write_all(fd, data, (size_t)frames * bytes_per_frame) < 0) {
+            fprintf(stderr, "Error capturing sample: %s\n", strerror(errno));
             break;
         }
+        pcm_ring_read_commit(ring, frames);
+        offset += (off_t)frames * bytes_per_frame;
+        total_frames += frames;
+    }
+
+    if (!pump_stopped)
+        error = pcm_ring_pump_stop(pump);
+    if (error < 0)
+        fprintf(stderr, "Capture thread failed: %s\n", strerror(-error));
+
+    /* give back the space that was reserved beyond the data */
+    if (allocated > offset && ftruncate(fd, offset) < 0)
+        fprintf(stderr, "Unable to truncate file: %s\n", strerror(errno));
+
+    high_water = pcm_ring_get_high_water(ring, 0);
+    overruns = pcm_ring_get_overruns(ring);
+    if (prinfo || overruns) {
+        fprintf(prinfo ? stdout : stderr,
+                "Ring: %u frames, high water %u frames (%.1f%%, %u ms), "
+                "%u overruns (%u frames dropped)\n",
+                ring_frames, high_water, 100.0 * high_water / ring_frames,
+                (unsigned int)(1000ULL * high_water / rate),
+                overruns, overruns * pcm_get_config(pcm)->period_size);
     }
 
-    free(buffer);
+    /* overruns of the device itself mean the capture thread fell behind */
+    if (pcm_get_stats(pcm, &stats) == 0 && (prinfo || stats.overruns))
+        fprintf(prinfo ? stdout : stderr, "Device: %lu overruns\n", stats.overruns);
+
+    pcm_ring_close(ring);
     pcm_close(pcm);
-    return total_frames_read;
+    return total_frames > UINT_MAX ? UINT_MAX : total_frames;
 }
-
@@ -32,6 +32,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 struct cmd {
     const char *filename;
@@ -41,6 +45,7 @@ struct cmd {
     int flags;
     struct pcm_config config;
     unsigned int bits;
+    unsigned int prefetch_time;
 };
 
 void cmd_init(struct cmd *cmd)
@@ -59,6 +64,7 @@ void cmd_init(struct cmd *cmd)
     cmd->config.stop_threshold = 1024 * 2;
     cmd->config.start_threshold = 1024;
     cmd->bits = 16;
+    cmd->prefetch_time = 2;
 }
 
 int cmd_parse_arg(struct cmd *cmd, int argc, const char **argv)
@@ -114,6 +120,11 @@ int cmd_parse_arg(struct cmd *cmd, int argc, const char **argv)
         }
     } else if ((strcmp(argv[0], "-i") == 0) || (strcmp(argv[0], "--file-type") == 0)) {
         cmd->filetype = argv[1];
+    } else if ((strcmp(argv[0], "-P") == 0) || (strcmp(argv[0], "--prefetch") == 0)) {
+        if (sscanf(argv[1], "%u", &cmd->prefetch_time) != 1) {
+            fprintf(stderr, "failed parsing prefetch time '%s'\n", argv[1]);
+            return -1;
+        }
     } else {
         fprintf(stderr, "unknown option '%s'\n", argv[0]);
         return -1;
@@ -148,6 +159,9 @@ int cmd_parse_args(struct cmd *cmd, int argc, const char **argv)
 #define ID_FMT  0x20746d66
 #define ID_DATA 0x61746164
 
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+
 struct riff_wave_header {
     uint32_t riff_id;
     uint32_t riff_sz;
@@ -170,17 +184,91 @@ struct chunk_fmt {
 
 struct ctx {
     struct pcm *pcm;
+    int flags;
 
     struct riff_wave_header wave_header;
     struct chunk_header chunk_header;
     struct chunk_fmt chunk_fmt;
 
     FILE *file;
+
+    /* The file mapped into memory, if it could be */
+    void *map;
+    size_t map_size;
+    /* The audio data in the mapping */
+    const char *data;
+    size_t data_size;
+    /* How far ahead of the play position the data is read, in bytes */
+    size_t prefetch_size;
+    /* The end of the data that has been read ahead */
+    size_t prefetched;
 };
 
+/* Maps the file so that the audio data can be handed to the PCM straight
+ * from the page cache. Files that cannot be mapped, such as pipes, are read
+ * with stdio instead. */
+static void ctx_map_data(struct ctx *ctx, const struct cmd *cmd, size_t data_size)
+{
+    struct stat st;
+    long pos;
+
+    ctx->map = NULL;
+    ctx->data = NULL;
+
+    pos = ftell(ctx->file);
+    if (pos < 0 || fstat(fileno(ctx->file), &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_size <= pos)
+        return;
+
+    ctx->map_size = st.st_size;
+    ctx->map = mmap(NULL, ctx->map_size, PROT_READ, MAP_SHARED, fileno(ctx->file), 0);
+    if (ctx->map == MAP_FAILED) {
+        ctx->map = NULL;
+        return;
+    }
+
+    /* a data chunk that outgrew its size field runs to the end of the file */
+    ctx->data = (const char *)ctx->map + pos;
+    ctx->data_size = ctx->map_size - pos;
+    if (data_size != 0 && data_size < ctx->data_size)
+        ctx->data_size = data_size;
+
+    ctx->prefetch_size = (size_t)cmd->prefetch_time * pcm_frames_to_bytes(ctx->pcm, 1) *
+                         pcm_get_rate(ctx->pcm);
+    ctx->prefetched = 0;
+    madvise(ctx->map, ctx->map_size, MADV_SEQUENTIAL);
+}
+
+/* Keeps the data from the play position to the end of the prefetch window
+ * in the page cache. The window is extended by half of it at a time, so that
+ * there is one read-ahead request per half window played. */
+static void ctx_prefetch(struct ctx *ctx, size_t pos)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start, end;
+
+    if (ctx->prefetched >= ctx->data_size ||
+        ctx->prefetched > pos + ctx->prefetch_size / 2)
+        return;
+
+    end = pos + ctx->prefetch_size;
+    if (end < pos + page)
+        end = pos + page;
+    if (end > ctx->data_size)
+        end = ctx->data_size;
+
+    start = (ctx->data - (const char *)ctx->map) + ctx->prefetched;
+    start &= ~(page - 1);
+    madvise((char *)ctx->map + start,
+            (ctx->data - (const char *)ctx->map) + end - start, MADV_WILLNEED);
+    ctx->prefetched = end;
+}
+
 int ctx_init(struct ctx* ctx, const struct cmd *cmd)
 {
     unsigned int bits = cmd->bits;
+    unsigned int audio_format = 0;
+    size_t data_size = 0;
     struct pcm_config config = cmd->config;
 
     if (cmd->filename == NULL) {
@@ -226,6 +314,7 @@ int ctx_init(struct ctx* ctx, const struct cmd *cmd)
                 break;
             case ID_DATA:
                 /* Stop looking for chunks */
+                data_size = ctx->chunk_header.sz;
                 more_chunks = 0;
                 break;
             default:
@@ -236,9 +325,21 @@ int ctx_init(struct ctx* ctx, const struct cmd *cmd)
         config.channels = ctx->chunk_fmt.num_channels;
         config.rate = ctx->chunk_fmt.sample_rate;
         bits = ctx->chunk_fmt.bits_per_sample;
+        audio_format = ctx->chunk_fmt.audio_format;
     }
 
-    if (bits == 8) {
+    if (audio_format == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+        config.format = PCM_FORMAT_FLOAT_LE;
+    } else if (audio_format == WAVE_FORMAT_IEEE_FLOAT && bits == 64) {
+        config.format = PCM_FORMAT_FLOAT64_LE;
+    } else if (audio_format == WAVE_FORMAT_IEEE_FLOAT) {
+        fprintf(stderr, "float bit count '%u' not supported\n", bits);
+        fclose(ctx->file);
+        return -1;
+    } else if (bits == 8 && audio_format == WAVE_FORMAT_PCM) {
+        /* 8-bit wave files are unsigned */
+        config.format = PCM_FORMAT_U8;
+    } else if (bits == 8) {
         config.format = PCM_FORMAT_S8;
     } else if (bits == 16) {
         config.format = PCM_FORMAT_S16_LE;
@@ -252,6 +353,7 @@ int ctx_init(struct ctx* ctx, const struct cmd *cmd)
         return -1;
     }
 
+    ctx->flags = cmd->flags;
     ctx->pcm = pcm_open(cmd->card,
                         cmd->device,
                         cmd->flags,
@@ -267,6 +369,8 @@ int ctx_init(struct ctx* ctx, const struct cmd *cmd)
         return -1;
     }
 
+    ctx_map_data(ctx, cmd, data_size);
+
     return 0;
 }
 
@@ -278,12 +382,15 @@ void ctx_free(struct ctx *ctx)
     if (ctx->pcm != NULL) {
         pcm_close(ctx->pcm);
     }
+    if (ctx->map != NULL) {
+        munmap(ctx->map, ctx->map_size);
+    }
     if (ctx->file != NULL) {
         fclose(ctx->file);
     }
 }
 
-static int close = 0;
+static int closing = 0;
 
 int play_sample(struct ctx *ctx);
 
@@ -291,7 +398,7 @@ void stream_close(int sig)
 {
     /* allow the stream to be closed gracefully */
     signal(sig, SIG_IGN);
-    close = 1;
+    closing = 1;
 }
 
 void print_usage(const char *argv0)
@@ -307,6 +414,7 @@ void print_usage(const char *argv0)
     fprintf(stderr, "-r | --rate <rate>             The amount of frames per second\n");
     fprintf(stderr, "-b | --bits <bit-count>        The number of bits in one sample\n");
     fprintf(stderr, "-M | --mmap                    Use memory mapped IO to play audio\n");
+    fprintf(stderr, "-P | --prefetch <seconds>      How far ahead of playback the file is read\n");
 }
 
 int main(int argc, const char **argv)
@@ -390,12 +498,156 @@ int sample_is_playable(const struct cmd *cmd)
     return can_play;
 }
 
+static int play_sample_mmap(struct ctx *ctx)
+{
+    struct pcm *pcm = ctx->pcm;
+    unsigned int frame_size;
+    unsigned int start_threshold;
+    unsigned int queued = 0;
+    unsigned int offset;
+    unsigned int frames;
+    void *areas;
+    ssize_t num_read;
+    size_t data_pos = 0;
+    off_t pos;
+    int started = 0;
+    int fd;
+    int err;
+
+    /* bypass stdio, so that the ring buffer is the only copy of the data */
+    fd = fileno(ctx->file);
+    pos = ftell(ctx->file);
+    if ((ctx->data == NULL) && ((pos < 0) || (lseek(fd, pos, SEEK_SET) < 0))) {
+        fprintf(stderr, "unable to seek to the start of the audio data\n");
+        return -1;
+    }
+
+    frame_size = pcm_frames_to_bytes(pcm, 1);
+    start_threshold = pcm_get_config(pcm)->start_threshold;
+
+    /* catch ctrl-c to shutdown cleanly */
+    signal(SIGINT, stream_close);
+
+    while (!closing) {
+        frames = pcm_get_buffer_size(pcm);
+        if (pcm_mmap_begin(pcm, &areas, &offset, &frames) < 0) {
+            fprintf(stderr, "error mapping ring buffer: %s\n", pcm_get_error(pcm));
+            return -1;
+        }
+
+        if (frames == 0) {
+            /* the ring buffer is full */
+            if (!started) {
+                if (pcm_start(pcm) < 0) {
+                    fprintf(stderr, "error starting stream: %s\n", pcm_get_error(pcm));
+                    return -1;
+                }
+                started = 1;
+                continue;
+            }
+            err = pcm_wait(pcm, -1);
+            if (err == -EPIPE) {
+                fprintf(stderr, "underrun, restarting stream\n");
+                pcm_stop(pcm);
+                if (pcm_prepare(pcm) < 0) {
+                    fprintf(stderr, "error preparing stream: %s\n", pcm_get_error(pcm));
+                    return -1;
+                }
+                started = 0;
+                queued = 0;
+            } else if (err < 0) {
+                fprintf(stderr, "error waiting for stream: %s\n", strerror(-err));
+                return -1;
+            }
+            continue;
+        }
+
+        /* read straight into the ring buffer, the area ends at the wrap point */
+        if (ctx->data != NULL) {
+            num_read = pcm_frames_to_bytes(pcm, frames);
+            if ((size_t)num_read > ctx->data_size - data_pos)
+                num_read = ctx->data_size - data_pos;
+            ctx_prefetch(ctx, data_pos);
+            memcpy((char *)areas + pcm_frames_to_bytes(pcm, offset),
+                   ctx->data + data_pos, num_read);
+            data_pos += num_read - num_read % frame_size;
+        } else {
+            num_read = read(fd, (char *)areas + pcm_frames_to_bytes(pcm, offset),
+                            pcm_frames_to_bytes(pcm, frames));
+        }
+        if (num_read < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "error reading '%s'\n", strerror(errno));
+            return -1;
+        }
+        frames = num_read / frame_size;
+        if (frames == 0)
+            break;
+
+        if (pcm_mmap_commit(pcm, offset, frames) < 0) {
+            fprintf(stderr, "error committing frames: %s\n", pcm_get_error(pcm));
+            return -1;
+        }
+
+        queued += frames;
+        if (!started && (queued >= start_threshold)) {
+            if (pcm_start(pcm) < 0) {
+                fprintf(stderr, "error starting stream: %s\n", pcm_get_error(pcm));
+                return -1;
+            }
+            started = 1;
+        }
+    }
+
+    /* short files may never reach the start threshold */
+    if (!started && queued > 0 && pcm_start(pcm) < 0) {
+        fprintf(stderr, "error starting stream: %s\n", pcm_get_error(pcm));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Writes the data to the PCM from the mapping of the file, with no
+ * intermediate buffer */
+static int play_sample_mapped(struct ctx *ctx)
+{
+    struct pcm *pcm = ctx->pcm;
+    unsigned int frame_size = pcm_frames_to_bytes(pcm, 1);
+    size_t chunk = pcm_frames_to_bytes(pcm, pcm_get_buffer_size(pcm));
+    size_t pos = 0;
+
+    /* catch ctrl-c to shutdown cleanly */
+    signal(SIGINT, stream_close);
+
+    while (!closing && ctx->data_size - pos >= frame_size) {
+        size_t size = ctx->data_size - pos;
+        if (size > chunk)
+            size = chunk;
+
+        ctx_prefetch(ctx, pos);
+        if (pcm_writei(pcm, ctx->data + pos, size / frame_size) < 0) {
+            fprintf(stderr, "error playing sample\n");
+            break;
+        }
+        pos += size - size % frame_size;
+    }
+
+    return 0;
+}
+
 int play_sample(struct ctx *ctx)
 {
     char *buffer;
     int size;
     int num_read;
 
+    if (ctx->flags & PCM_MMAP)
+        return play_sample_mmap(ctx);
+    if (ctx->data != NULL)
+        return play_sample_mapped(ctx);
+
     size = pcm_frames_to_bytes(ctx->pcm, pcm_get_buffer_size(ctx->pcm));
     buffer = malloc(size);
     if (!buffer) {
@@ -415,7 +667,7 @@ int play_sample(struct ctx *ctx)
                 break;
             }
         }
-    } while (!close && num_read > 0);
+    } while (!closing && num_read > 0);
 
     free(buffer);
     return 0;
@@ -32,13 +32,34 @@
 #include <string.h>
 #include <signal.h>
 #include <math.h>
-#include <malloc.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <tinyalsa/pcm.h>
+#include <tinyalsa/convert.h>
 
 #define ID_RIFF 0x46464952
 #define ID_WAVE 0x45564157
 #define ID_FMT  0x20746d66
 #define ID_DATA 0x61746164
 
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+/* The number of samples converted to float at a time by each thread */
+#define CHUNK_SAMPLES 4096
+
+/* The number of frames in a block of accumulators */
+#define BLOCK_FRAMES 4
+
+/* Ranges smaller than this are not worth a thread of their own */
+#define MIN_THREAD_FRAMES 65536
+
 struct riff_wave_header {
     uint32_t riff_id;
     uint32_t riff_sz;
@@ -59,156 +80,414 @@ struct chunk_fmt {
     uint16_t bits_per_sample;
 };
 
-static int close = 0;
+typedef float float_vec __attribute__((vector_size(16)));
+typedef int32_t mask_vec __attribute__((vector_size(16)));
+typedef double double_vec __attribute__((vector_size(32)));
+
+#define LANES (sizeof(float_vec) / sizeof(float))
+
+/* The frames analysed by one thread, and what it found */
+struct analysis {
+    const uint8_t *data;
+    size_t frames;
+    unsigned int channels;
+    enum pcm_format format;
+    pthread_t thread;
+    /* The number of frames analysed before any interruption */
+    size_t done;
+    double *sum;
+    double *sum_squares;
+    float *max;
+    float *min;
+};
 
-void analyse_sample(FILE *file, unsigned int channels, unsigned int bits,
-                    unsigned int data_chunk_size);
+static volatile sig_atomic_t closing = 0;
 
 void stream_close(int sig)
 {
-    /* allow the stream to be closed gracefully */
+    /* allow the analysis to be stopped gracefully */
     signal(sig, SIG_IGN);
-    close = 1;
+    closing = 1;
+}
+
+static int wav_format(const struct chunk_fmt *fmt, uint16_t audio_format,
+                      enum pcm_format *format)
+{
+    unsigned int container;
+
+    if (fmt->num_channels == 0 || fmt->block_align % fmt->num_channels)
+        return -1;
+    container = fmt->block_align / fmt->num_channels;
+
+    if (audio_format == WAVE_FORMAT_IEEE_FLOAT) {
+        if (container == 4)
+            *format = PCM_FORMAT_FLOAT_LE;
+        else if (container == 8)
+            *format = PCM_FORMAT_FLOAT64_LE;
+        else
+            return -1;
+        return 0;
+    }
+
+    if (audio_format != WAVE_FORMAT_PCM)
+        return -1;
+
+    switch (container) {
+    case 1:
+        *format = PCM_FORMAT_U8;
+        break;
+    case 2:
+        *format = PCM_FORMAT_S16_LE;
+        break;
+    case 3:
+        *format = PCM_FORMAT_S24_3LE;
+        break;
+    case 4:
+        /* samples are left justified, so fewer valid bits than the
+         * container holds only leave the low bits at zero */
+        *format = PCM_FORMAT_S32_LE;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+static void *analyse_range(void *arg)
+{
+    struct analysis *analysis = arg;
+    unsigned int channels = analysis->channels;
+    unsigned int block_size = BLOCK_FRAMES * channels;
+    unsigned int frame_bytes = channels * (pcm_format_to_bits(analysis->format) / 8);
+    unsigned int chunk_frames, blocks, tail, i;
+    const uint8_t *data = analysis->data;
+    size_t frames = analysis->frames;
+    double *sum, *sum_squares;
+    float *scratch, *max, *min;
+
+    chunk_frames = CHUNK_SAMPLES / block_size * BLOCK_FRAMES;
+    if (chunk_frames == 0)
+        chunk_frames = BLOCK_FRAMES;
+
+    /* one accumulator per sample of a block, so that whole vectors are used */
+    scratch = malloc(chunk_frames * channels * sizeof(float));
+    sum = calloc(block_size, sizeof(double));
+    sum_squares = calloc(block_size, sizeof(double));
+    max = malloc(block_size * sizeof(float));
+    min = malloc(block_size * sizeof(float));
+    if (!scratch || !sum || !sum_squares || !max || !min) {
+        fprintf(stderr, "Unable to allocate analysis buffers\n");
+        goto done;
+    }
+    for (i = 0; i < block_size; i++) {
+        max[i] = -INFINITY;
+        min[i] = INFINITY;
+    }
+
+    while (frames > 0 && !closing) {
+        unsigned int n = frames < chunk_frames ? frames : chunk_frames;
+        const float *samples = scratch;
+
+        pcm_convert_to_float(scratch, data, analysis->format, n * channels);
+
+        for (blocks = n / BLOCK_FRAMES; blocks > 0; blocks--) {
+            for (i = 0; i < block_size; i += LANES) {
+                float_vec x, hi, lo;
+                double_vec xd, s, s2;
+                mask_vec above, below;
+
+                memcpy(&x, samples + i, sizeof(x));
+                memcpy(&hi, max + i, sizeof(hi));
+                memcpy(&lo, min + i, sizeof(lo));
+                memcpy(&s, sum + i, sizeof(s));
+                memcpy(&s2, sum_squares + i, sizeof(s2));
+
+                xd = __builtin_convertvector(x, double_vec);
+                s += xd;
+                s2 += xd * xd;
+                above = x > hi;
+                below = x < lo;
+                hi = (float_vec)(((mask_vec)x & above) | ((mask_vec)hi & ~above));
+                lo = (float_vec)(((mask_vec)x & below) | ((mask_vec)lo & ~below));
+
+                memcpy(max + i, &hi, sizeof(hi));
+                memcpy(min + i, &lo, sizeof(lo));
+                memcpy(sum + i, &s, sizeof(s));
+                memcpy(sum_squares + i, &s2, sizeof(s2));
+            }
+            samples += block_size;
+        }
+
+        tail = (n % BLOCK_FRAMES) * channels;
+        for (i = 0; i < tail; i++) {
+            sum[i] += samples[i];
+            sum_squares[i] += (double)samples[i] * samples[i];
+            if (samples[i] > max[i])
+                max[i] = samples[i];
+            if (samples[i] < min[i])
+                min[i] = samples[i];
+        }
+
+        data += (size_t)n * frame_bytes;
+        frames -= n;
+        analysis->done += n;
+    }
+
+    for (i = 0; i < block_size; i++) {
+        unsigned int ch = i % channels;
+        analysis->sum[ch] += sum[i];
+        analysis->sum_squares[ch] += sum_squares[i];
+        if (max[i] > analysis->max[ch])
+            analysis->max[ch] = max[i];
+        if (min[i] < analysis->min[ch])
+            analysis->min[ch] = min[i];
+    }
+
+done:
+    free(scratch);
+    free(sum);
+    free(sum_squares);
+    free(max);
+    free(min);
+    return NULL;
+}
+
+/* Tells the kernel that the data is read once, from start to end */
+static void advise_data(const uint8_t *data, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page - 1);
+
+    size += (uintptr_t)data - start;
+    madvise((void *)start, size, MADV_SEQUENTIAL);
+    madvise((void *)start, size, MADV_WILLNEED);
+}
+
+static double level_db(double level)
+{
+    return 20 * log10(level);
+}
+
+static int analyse_sample(const uint8_t *data, size_t data_size, unsigned int channels,
+                   enum pcm_format format, unsigned int threads)
+{
+    struct analysis *analyses;
+    unsigned int frame_bytes = channels * (pcm_format_to_bits(format) / 8);
+    size_t frames = data_size / frame_bytes;
+    size_t per_thread, done = 0;
+    struct timespec start, end;
+    unsigned int t, ch;
+    double seconds;
+
+    if (threads > frames / MIN_THREAD_FRAMES)
+        threads = frames / MIN_THREAD_FRAMES;
+    if (threads == 0)
+        threads = 1;
+    per_thread = frames / threads;
+
+    analyses = calloc(threads, sizeof(*analyses));
+    if (!analyses) {
+        fprintf(stderr, "Unable to allocate %u threads\n", threads);
+        return -1;
+    }
+
+    /* catch ctrl-c to shutdown cleanly */
+    signal(SIGINT, stream_close);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (t = 0; t < threads; t++) {
+        struct analysis *analysis = &analyses[t];
+
+        analysis->data = data + (size_t)t * per_thread * frame_bytes;
+        analysis->frames = (t == threads - 1) ? frames - (size_t)t * per_thread : per_thread;
+        analysis->channels = channels;
+        analysis->format = format;
+        analysis->sum = calloc(channels, sizeof(double));
+        analysis->sum_squares = calloc(channels, sizeof(double));
+        analysis->max = malloc(channels * sizeof(float));
+        analysis->min = malloc(channels * sizeof(float));
+        if (!analysis->sum || !analysis->sum_squares || !analysis->max || !analysis->min) {
+            fprintf(stderr, "Unable to allocate analysis results\n");
+            free(analysis->sum);
+            free(analysis->sum_squares);
+            free(analysis->max);
+            free(analysis->min);
+            closing = 1;
+            threads = t;
+            break;
+        }
+        for (ch = 0; ch < channels; ch++) {
+            analysis->max[ch] = -INFINITY;
+            analysis->min[ch] = INFINITY;
+        }
+
+        if (pthread_create(&analysis->thread, NULL, analyse_range, analysis)) {
+            /* carry on with the threads that did start */
+            analyse_range(analysis);
+            analysis->thread = pthread_self();
+        }
+    }
+
+    for (t = 0; t < threads; t++) {
+        if (!pthread_equal(analyses[t].thread, pthread_self()))
+            pthread_join(analyses[t].thread, NULL);
+        done += analyses[t].done;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    /* the totals of each thread are combined in double precision */
+    for (ch = 0; ch < channels; ch++) {
+        double sum = 0, sum_squares = 0, peak = 0, rms, dc;
+
+        for (t = 0; t < threads; t++) {
+            sum += analyses[t].sum[ch];
+            sum_squares += analyses[t].sum_squares[ch];
+            if (analyses[t].max[ch] > peak)
+                peak = analyses[t].max[ch];
+            if (-analyses[t].min[ch] > peak)
+                peak = -analyses[t].min[ch];
+        }
+
+        if (done == 0 || sum_squares == 0) {
+            printf("Channel [%2u] NO signal or ZERO signal\n", ch);
+            continue;
+        }
+        rms = sqrt(sum_squares / done);
+        dc = sum / done;
+        printf("Channel [%2u] Peak : %7.2f dBFS  RMS : %7.2f dBFS  DC offset : %+.6f\n",
+               ch, level_db(peak), level_db(rms), dc);
+    }
+
+    printf("\nAnalysed %zu frames in %.3f s with %u thread%s (%.2f GB/s)\n",
+           done, seconds, threads, threads > 1 ? "s" : "",
+           seconds > 0 ? (double)done * frame_bytes / seconds / 1e9 : 0.0);
+
+    for (t = 0; t < threads; t++) {
+        free(analyses[t].sum);
+        free(analyses[t].sum_squares);
+        free(analyses[t].max);
+        free(analyses[t].min);
+    }
+    free(analyses);
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
-    FILE *file;
-    struct riff_wave_header riff_wave_header;
-    struct chunk_header chunk_header;
     struct chunk_fmt chunk_fmt;
+    struct chunk_header chunk_header;
+    struct riff_wave_header riff_wave_header;
+    const uint8_t *file, *data = NULL;
+    size_t file_size, offset, data_size = 0;
+    enum pcm_format format;
+    uint16_t audio_format;
     char *filename;
-    int more_chunks = 1;
+    long threads;
+    struct stat st;
+    int fd, ret, have_fmt = 0;
 
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s file.wav \n", argv[0]);
+        fprintf(stderr, "Usage: %s file.wav [-t threads]\n", argv[0]);
         return 1;
     }
 
     filename = argv[1];
-    file = fopen(filename, "rb");
-    if (!file) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    argv += 2;
+    while (*argv) {
+        if (strcmp(*argv, "-t") == 0) {
+            argv++;
+            if (*argv)
+                threads = atol(*argv);
+        }
+        if (*argv)
+            argv++;
+    }
+    if (threads < 1)
+        threads = 1;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
         fprintf(stderr, "Unable to open file '%s'\n", filename);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    file_size = st.st_size;
+    if (file_size < sizeof(riff_wave_header)) {
+        fprintf(stderr, "Error: '%s' is not a riff/wave file\n", filename);
+        close(fd);
+        return 1;
+    }
+
+    /* the whole file is mapped, and only the data is read ahead */
+    file = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Unable to map file '%s'\n", filename);
         return 1;
     }
 
-    fread(&riff_wave_header, sizeof(riff_wave_header), 1, file);
+    memcpy(&riff_wave_header, file, sizeof(riff_wave_header));
     if ((riff_wave_header.riff_id != ID_RIFF) ||
         (riff_wave_header.wave_id != ID_WAVE)) {
         fprintf(stderr, "Error: '%s' is not a riff/wave file\n", filename);
-        fclose(file);
+        munmap((void *)file, file_size);
         return 1;
     }
 
-    do {
-        fread(&chunk_header, sizeof(chunk_header), 1, file);
+    memset(&chunk_fmt, 0, sizeof(chunk_fmt));
+    audio_format = 0;
+    offset = sizeof(riff_wave_header);
+    while (!data && offset + sizeof(chunk_header) <= file_size) {
+        memcpy(&chunk_header, file + offset, sizeof(chunk_header));
+        offset += sizeof(chunk_header);
 
         switch (chunk_header.id) {
         case ID_FMT:
-            fread(&chunk_fmt, sizeof(chunk_fmt), 1, file);
-            /* If the format header is larger, skip the rest */
-            if (chunk_header.sz > sizeof(chunk_fmt))
-                fseek(file, chunk_header.sz - sizeof(chunk_fmt), SEEK_CUR);
+            if (chunk_header.sz < sizeof(chunk_fmt) ||
+                offset + chunk_header.sz > file_size)
+                break;
+            memcpy(&chunk_fmt, file + offset, sizeof(chunk_fmt));
+            audio_format = chunk_fmt.audio_format;
+            /* the sub format of an extensible header starts with the format tag */
+            if (audio_format == WAVE_FORMAT_EXTENSIBLE && chunk_header.sz >= 26)
+                memcpy(&audio_format, file + offset + 24, sizeof(audio_format));
+            have_fmt = 1;
             break;
         case ID_DATA:
-            /* Stop looking for chunks */
-            more_chunks = 0;
+            /* captures that outgrew the size field run to the end of the file */
+            data = file + offset;
+            data_size = file_size - offset;
+            if (chunk_header.sz != 0 && chunk_header.sz < data_size)
+                data_size = chunk_header.sz;
             break;
         default:
-            /* Unknown chunk, skip bytes */
-            fseek(file, chunk_header.sz, SEEK_CUR);
+            break;
         }
-    } while (more_chunks);
+        /* chunks are padded to an even size */
+        offset += chunk_header.sz + (chunk_header.sz & 1);
+    }
+
+    if (!have_fmt || !data || wav_format(&chunk_fmt, audio_format, &format) < 0) {
+        fprintf(stderr, "Error: '%s' has no supported format or data chunk\n", filename);
+        munmap((void *)file, file_size);
+        return 1;
+    }
+
+    advise_data(data, data_size);
 
     printf("Input File       : %s \n", filename);
     printf("Channels         : %u \n", chunk_fmt.num_channels);
     printf("Sample Rate      : %u \n", chunk_fmt.sample_rate);
     printf("Bits per sample  : %u \n\n", chunk_fmt.bits_per_sample);
 
-    analyse_sample(file, chunk_fmt.num_channels, chunk_fmt.bits_per_sample,
-                    chunk_header.sz);
+    ret = analyse_sample(data, data_size, chunk_fmt.num_channels, format, threads);
 
-    fclose(file);
+    munmap((void *)file, file_size);
 
-    return 0;
+    return ret < 0 ? 1 : 0;
 }
-
-void analyse_sample(FILE *file, unsigned int channels, unsigned int bits,
-                    unsigned int data_chunk_size)
-{
-    void *buffer;
-    int size;
-    int num_read;
-    int i;
-    unsigned int ch;
-    int frame_size = 1024;
-    unsigned int byte_align = 0;
-    float *power;
-    int total_sample_per_channel;
-    float normalization_factor;
-
-    if (bits == 32)
-        byte_align = 4;
-    else if (bits == 16)
-        byte_align = 2;
-
-    normalization_factor = (float)pow(2.0, (bits-1));
-
-    size = channels * byte_align * frame_size;
-    buffer = memalign(byte_align, size);
-
-    if (!buffer) {
-        fprintf(stderr, "Unable to allocate %d bytes\n", size);
-        free(buffer);
-        return;
-    }
-
-    power = (float *) calloc(channels, sizeof(float));
-
-    total_sample_per_channel = data_chunk_size / (channels * byte_align);
-
-    /* catch ctrl-c to shutdown cleanly */
-    signal(SIGINT, stream_close);
-
-    do {
-        num_read = fread(buffer, 1, size, file);
-        if (num_read > 0) {
-            if (2 == byte_align) {
-                short *buffer_ptr = (short *)buffer;
-                for (i = 0; i < num_read; i += channels) {
-                    for (ch = 0; ch < channels; ch++) {
-                        int temp = *buffer_ptr++;
-                        /* Signal Normalization */
-                        float f = (float) temp / normalization_factor;
-                        *(power + ch) += (float) (f * f);
-                    }
-                }
-            }
-            if (4 == byte_align) {
-                int *buffer_ptr = (int *)buffer;
-                for (i = 0; i < num_read; i += channels) {
-                    for (ch = 0; ch < channels; ch++) {
-                        int temp = *buffer_ptr++;
-                        /* Signal Normalization */
-                        float f = (float) temp / normalization_factor;
-                        *(power + ch) += (float) (f * f);
-                    }
-                }
-            }
-        }
-    }while (!close && num_read > 0);
-
-    for (ch = 0; ch < channels; ch++) {
-        float average_power = 10 * log10((*(power + ch)) / total_sample_per_channel);
-        if(isinf (average_power)) {
-            printf("Channel [%2u] Average Power : NO signal or ZERO signal\n", ch);
-        } else {
-            printf("Channel [%2u] Average Power : %.2f dB\n", ch, average_power);
-        }
-    }
-
-    free(buffer);
-    free(power);
-
-}
-